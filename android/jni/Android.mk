@@ -5,9 +5,19 @@ include $(CLEAR_VARS)
 LOCAL_MODULE     := humanity
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../include
 LOCAL_SRC_FILES  := \
+	../../src/io/batch.cpp \
 	../../src/io/file.cpp \
+	../../src/io/glob_filter.cpp \
 	../../src/io/directory.cpp \
+	../../src/io/directory_walker.cpp \
+	../../src/io/parallel_remove.cpp \
+	../../src/io/parallel_scan.cpp \
 	../../src/io/path.cpp \
+	../../src/io/path_table.cpp \
+	../../src/io/stat_cache.cpp \
+	../../src/log.cpp \
+	../../src/log_binary.cpp \
+	../../src/memory.cpp \
 	../../src/string_utils.cpp
 LOCAL_CFLAGS     := 
 LOCAL_LDFLAGS    := 
@@ -15,3 +25,11 @@ LOCAL_LDLIBS     := -llog
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+
+LOCAL_MODULE     := humanity_log_decode
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../include
+LOCAL_SRC_FILES  := ../../tools/log_decode.cpp
+LOCAL_SHARED_LIBRARIES := humanity
+
+include $(BUILD_EXECUTABLE)
@@ -1,4 +1,4 @@
 APP_ABI := armeabi-v7a x86
 APP_STL := gnustl_shared
-APP_CPPFLAGS := -frtti -fexceptions
-APP_MODULES := humanity
+APP_CPPFLAGS := -std=c++11 -frtti -fexceptions
+APP_MODULES := humanity humanity_log_decode
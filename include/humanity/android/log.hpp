@@ -19,7 +19,7 @@
 #    define LOG_(fp, type, fmt, file, line, ...) __android_log_print(type, HUMANITY_LOG_TAG, fmt, ##__VA_ARGS__)
 #  endif
 #  define HUMANITY_LOG_LEVEL_INFO  ANDROID_LOG_INFO
-#  define HUMANITY_LOG_LEVEL_VERB  ANDROID_LOG_VERB
+#  define HUMANITY_LOG_LEVEL_VERB  ANDROID_LOG_VERBOSE
 #  define HUMANITY_LOG_LEVEL_ERROR ANDROID_LOG_ERROR
 #  define HUMANITY_LOG_LEVEL_WARN  ANDROID_LOG_WARN
 #  define HUMANITY_LOG_LEVEL_DEBUG ANDROID_LOG_DEBUG
@@ -6,11 +6,23 @@
 #define HUMANITY_ARRAY_H
 
 #include <humanity/humanity.hpp>
+#include <humanity/exception.hpp>
+#include <algorithm>
+#include <cassert>
 #include <cstdlib>
 #include <cstddef>
-
-#ifdef _EXCEPTION
+#include <cstring>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  if defined(__AVX2__)
+#    include <immintrin.h>
+#  endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
 #endif
 
 HUMANITY_NS_BEGIN
@@ -18,16 +30,19 @@ HUMANITY_NS_BEGIN
 /**
  * 配列を扱うためのテンプレートクラス。<br/>
  * 基本的にはC++11の std::array の模倣。
+ * 集成体なので array<int, 3> a = {{ 1, 2, 3 }}; のように初期化でき、
+ * 要素型がリテラル型であれば定数式の中で構築してコンパイル時に参照テーブルを作れる。
+ * 初期化子を指定せずに構築した場合、組み込み型の要素は初期化されない（ゼロで初期化する場合は {} を指定する）。
+ * operator[] は範囲チェックを行わない（NDEBUGが定義されていない場合はassertで検査する）。範囲チェックが必要な場合は at を使う。
  */
 template <typename T_, std::size_t Size_> class array {
-private:
-    T_ array_[Size_];
-
 public:
     /** 格納している要素の型 */
     typedef T_ value_type;
     /** サイズの型 */
     typedef std::size_t size_type;
+    /** 差の型 */
+    typedef std::ptrdiff_t difference_type;
     /** 参照型 */
     typedef value_type& reference;
     /** 変更不可能な参照型 */
@@ -36,103 +51,317 @@ public:
     typedef T_* pointer;
     /** 変更不可能なポインタ型 */
     typedef T_ const* const_pointer;
+    /** イテレータ型 */
+    typedef T_* iterator;
+    /** 変更不可能なイテレータ型 */
+    typedef T_ const* const_iterator;
 
-    array() : array_() {}
-    /** コピーコンストラクタ */
-    array(array const &src) : array_(src.array_) {}
-    ~array() {}
+    /** 要素を格納する配列（集成体として初期化するために公開しているが、直接参照しないこと） */
+    T_ array_[Size_ ? Size_ : 1];
 
-    /** 引数で指定した位置の要素を取得する */
+    /** 引数で指定した位置の要素を取得する（範囲外の位置を指定した場合はstd::out_of_rangeを送出する） */
     reference at(size_type pos) {
         THROW_IF(pos >= Size_, std::out_of_range, "index out of range");
         return array_[pos];
     }
-    /** 引数で指定した位置の要素を取得する */
+    /** 引数で指定した位置の要素を取得する（範囲外の位置を指定した場合はstd::out_of_rangeを送出する） */
     const_reference at(size_type pos) const {
         THROW_IF(pos >= Size_, std::out_of_range, "index out of range");
         return array_[pos];
     }
 
-    /** []演算子 */
-    reference operator [] (size_type pos) {
-        return at(pos);
+    /** []演算子（範囲外の位置を指定した場合の動作は未定義） */
+    HUMANITY_CONSTEXPR14 reference operator [] (size_type pos) {
+        return assert(pos < Size_), array_[pos];
     }
-    /** []演算子 */
-    const_reference operator [] (size_type pos) const {
-        return at(pos);
+    /** []演算子（範囲外の位置を指定した場合の動作は未定義） */
+    constexpr const_reference operator [] (size_type pos) const {
+        return assert(pos < Size_), array_[pos];
     }
 
     /** 配列の先頭要素を取得する */
-    reference front() {
+    HUMANITY_CONSTEXPR14 reference front() {
         return array_[0];
     }
     /** 配列の先頭要素を取得する */
-    const_reference front() const {
+    constexpr const_reference front() const {
         return array_[0];
     }
 
     /** 配列の末尾の要素を取得する */
-    reference back() {
+    HUMANITY_CONSTEXPR14 reference back() {
         return array_[Size_ - 1];
     }
     /** 配列の末尾の要素を取得する */
-    const_reference back() const {
+    constexpr const_reference back() const {
         return array_[Size_ - 1];
     }
 
     /** 配列の先頭要素へのポインタを返す */
-    pointer data() {
+    HUMANITY_CONSTEXPR14 pointer data() {
         return array_;
     }
     /** 配列の先頭要素へのポインタを返す */
-    const_pointer data() const {
+    constexpr const_pointer data() const {
+        return array_;
+    }
+
+    /** 先頭要素を指すイテレータを取得する */
+    HUMANITY_CONSTEXPR14 iterator begin() {
         return array_;
     }
+    /** 先頭要素を指すイテレータを取得する */
+    constexpr const_iterator begin() const {
+        return array_;
+    }
+    /** 先頭要素を指すイテレータを取得する */
+    constexpr const_iterator cbegin() const {
+        return array_;
+    }
+    /** 終端を指すイテレータを取得する */
+    HUMANITY_CONSTEXPR14 iterator end() {
+        return array_ + Size_;
+    }
+    /** 終端を指すイテレータを取得する */
+    constexpr const_iterator end() const {
+        return array_ + Size_;
+    }
+    /** 終端を指すイテレータを取得する */
+    constexpr const_iterator cend() const {
+        return array_ + Size_;
+    }
 
     /** 空配列かどうかを判定する */
-    bool empty() const {
-        return 0 == Size_ ? true : false;
+    constexpr bool empty() const {
+        return 0 == Size_;
     }
 
     /** 配列の要素数を取得する */
-    size_type size() const {
+    constexpr size_type size() const {
         return Size_;
     }
 
     /** 配列の要素数の最大値を取得する */
-    size_type max_size() const {
+    constexpr size_type max_size() const {
         return Size_;
     }
+
+    /**
+     * 全ての要素に値を代入する
+     * @param value 代入する値
+     */
+    HUMANITY_CONSTEXPR14 void fill(const_reference value) {
+        for (size_type i = 0; i < Size_; ++i) {
+            array_[i] = value;
+        }
+    }
+
+    /**
+     * 他の配列と要素を交換する
+     * @param other 交換する配列
+     */
+    HUMANITY_CONSTEXPR14 void swap(array &other) {
+        for (size_type i = 0; i < Size_; ++i) {
+            T_ tmp(std::move(array_[i]));
+            array_[i] = std::move(other.array_[i]);
+            other.array_[i] = std::move(tmp);
+        }
+    }
 };
 
-/** arrayに対する等値比較演算子 */
-template <typename T_, std::size_t N_> bool operator == (array<T_, N_> const &l, array<T_, N_> const &r) {
-    return 0 == std::memcmp(l.data(), r.data(), N_);
+/** 二つの配列の要素を交換する */
+template <typename T_, std::size_t N_> HUMANITY_CONSTEXPR14 void swap(array<T_, N_> &l, array<T_, N_> &r) {
+    l.swap(r);
+}
+
+/**
+ * arrayの比較の実装。<br/>
+ * 整数型、列挙型、ポインタ型の要素はバイト列が等しいことと値が等しいことが一致するため、
+ * 最初に異なるバイトの位置をSIMD命令で求め、その位置の要素だけを値として比較する。
+ * それ以外の型（浮動小数点型など）は要素の比較演算子で比較する。
+ */
+template <typename T_, bool Bitwise_ = std::is_integral<T_>::value || std::is_enum<T_>::value || std::is_pointer<T_>::value>
+struct array_compare {
+    /** 全ての要素が等しいかどうかを判定する */
+    static bool equal(T_ const *l, T_ const *r, std::size_t n) {
+        return std::equal(l, l + n, r);
+    }
+    /** 辞書式順序でlがrより小さいかどうかを判定する */
+    static bool less(T_ const *l, T_ const *r, std::size_t n) {
+        return std::lexicographical_compare(l, l + n, r, r + n);
+    }
+};
+
+/**
+ * バイト列で比較できる要素型に対するarrayの比較の実装
+ */
+template <typename T_> struct array_compare<T_, true> {
+    /** 全ての要素が等しいかどうかを判定する（長い配列は実行時にCPUに合わせた実装を選ぶmemcmpを使う） */
+    static bool equal(T_ const *l, T_ const *r, std::size_t n) {
+        if (n * sizeof(T_) >= 64) {
+            return 0 == std::memcmp(l, r, n * sizeof(T_));
+        }
+        return mismatch(l, r, n * sizeof(T_)) == n * sizeof(T_);
+    }
+    /** 辞書式順序でlがrより小さいかどうかを判定する */
+    static bool less(T_ const *l, T_ const *r, std::size_t n) {
+        std::size_t const i = mismatch(l, r, n * sizeof(T_)) / sizeof(T_);
+        return (i < n) && (l[i] < r[i]);
+    }
+
+    /**
+     * 二つのバイト列で最初に異なるバイトの位置を求める
+     * @param lp 比較するバイト列
+     * @param rp 比較するバイト列
+     * @param n バイト列の長さ
+     * @return 最初に異なるバイトの位置、全て等しい場合はnを返す
+     */
+    static std::size_t mismatch(void const *lp, void const *rp, std::size_t n) {
+        unsigned char const *l = static_cast<unsigned char const*>(lp);
+        unsigned char const *r = static_cast<unsigned char const*>(rp);
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        // 長いバイト列は64バイトずつまとめて比較し、異なるバイトを含む場合だけ位置を求める
+        for (; i + 64 <= n; i += 64) {
+            __m256i const e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(l + i)),
+                _mm256_loadu_si256(reinterpret_cast<__m256i const*>(r + i)));
+            __m256i const e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(l + i + 32)),
+                _mm256_loadu_si256(reinterpret_cast<__m256i const*>(r + i + 32)));
+            if (-1 != _mm256_movemask_epi8(_mm256_and_si256(e0, e1))) {
+                unsigned int const d0 = ~static_cast<unsigned int>(_mm256_movemask_epi8(e0));
+                if (0 != d0) {
+                    return i + __builtin_ctz(d0);
+                }
+                return i + 32 + __builtin_ctz(~static_cast<unsigned int>(_mm256_movemask_epi8(e1)));
+            }
+        }
+        for (; i + 32 <= n; i += 32) {
+            __m256i const a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(l + i));
+            __m256i const b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(r + i));
+            unsigned int const diff = ~static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+            if (0 != diff) {
+                return i + __builtin_ctz(diff);
+            }
+        }
+#elif defined(__SSE2__)
+        // 長いバイト列は64バイトずつまとめて比較し、異なるバイトを含む場合だけ位置を求める
+        for (; i + 64 <= n; i += 64) {
+            __m128i const e0 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(l + i)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i)));
+            __m128i const e1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(l + i + 16)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i + 16)));
+            __m128i const e2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(l + i + 32)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i + 32)));
+            __m128i const e3 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(l + i + 48)),
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i + 48)));
+            if (0xFFFF != _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3)))) {
+                break;
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        for (; i + 16 <= n; i += 16) {
+            __m128i const a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(l + i));
+            __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(r + i));
+            unsigned int const diff = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) & 0xFFFFU;
+            if (0 != diff) {
+                return i + __builtin_ctz(diff);
+            }
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        // 異なるバイトを含むブロックが見つかったら、位置は後の逐次比較で求める
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t const eq = vceqq_u8(vld1q_u8(l + i), vld1q_u8(r + i));
+            uint8x8_t m = vand_u8(vget_low_u8(eq), vget_high_u8(eq));
+            m = vpmin_u8(m, m);
+            m = vpmin_u8(m, m);
+            m = vpmin_u8(m, m);
+            if (0xFF != vget_lane_u8(m, 0)) {
+                break;
+            }
+        }
+#endif
+        for (; i < n; ++i) {
+            if (l[i] != r[i]) {
+                return i;
+            }
+        }
+        return n;
+    }
+};
+
+/**
+ * 定数式の中で評価するarrayの比較の実装。<br/>
+ * C++11のconstexpr関数でも書けるように再帰で比較し、定数式の評価の再帰の深さの上限に掛からないよう半分ずつに分ける。
+ */
+template <typename T_> struct array_constexpr_compare {
+    /** 全ての要素が等しいかどうかを判定する */
+    static constexpr bool equal(T_ const *l, T_ const *r, std::size_t n) {
+        return (0 == n) || ((1 == n) ? (*l == *r) : (equal(l, r, n / 2) && equal(l + n / 2, r + n / 2, n - n / 2)));
+    }
+    /** 辞書式順序でlがrより小さいかどうかを判定する */
+    static constexpr bool less(T_ const *l, T_ const *r, std::size_t n) {
+        return compare(l, r, n) < 0;
+    }
+
+private:
+    /** 辞書式順序でlがrより小さい場合は負の値、大きい場合は正の値、等しい場合は0を返す */
+    static constexpr int compare(T_ const *l, T_ const *r, std::size_t n) {
+        return (0 == n) ? 0
+            : (1 == n) ? ((*l < *r) ? -1 : ((*r < *l) ? 1 : 0))
+            : compare_rest(compare(l, r, n / 2), l + n / 2, r + n / 2, n - n / 2);
+    }
+    /** 前半の比較結果が等しい場合だけ後半を比較する */
+    static constexpr int compare_rest(int head, T_ const *l, T_ const *r, std::size_t n) {
+        return (0 != head) ? head : compare(l, r, n);
+    }
+};
+
+#if defined(HUMANITY_IS_CONSTANT_EVALUATED)
+/** arrayの比較演算子に付ける指定子（定数式の中と実行時で実装を切り替えられる環境でだけconstexprになる） */
+#  define HUMANITY_ARRAY_COMPARE_CONSTEXPR constexpr
+#else
+#  define HUMANITY_ARRAY_COMPARE_CONSTEXPR
+#endif
+
+/** arrayに対する等値比較演算子（定数式の中ではarray_constexpr_compare、実行時はarray_compareで比較する） */
+template <typename T_, std::size_t N_> HUMANITY_ARRAY_COMPARE_CONSTEXPR bool operator == (array<T_, N_> const &l, array<T_, N_> const &r) {
+#if defined(HUMANITY_IS_CONSTANT_EVALUATED)
+    return HUMANITY_IS_CONSTANT_EVALUATED() ? array_constexpr_compare<T_>::equal(l.data(), r.data(), N_)
+        : array_compare<T_>::equal(l.data(), r.data(), N_);
+#else
+    return array_compare<T_>::equal(l.data(), r.data(), N_);
+#endif
 }
 
 /** arrayに対する等値比較演算子 */
-template <typename T_, std::size_t N_> bool operator != (array<T_, N_> const &l, array<T_, N_> const &r) {
+template <typename T_, std::size_t N_> HUMANITY_ARRAY_COMPARE_CONSTEXPR bool operator != (array<T_, N_> const &l, array<T_, N_> const &r) {
     return !(l == r);
 }
 
-/** arrayに対する等値比較演算子 */
-template <typename T_, std::size_t N_> bool operator < (array<T_, N_> const &l, array<T_, N_> const &r) {
-    return std::memcmp(l.data(), r.data(), N_) < 0;
+/** arrayに対する比較演算子（要素の辞書式順序、定数式の中ではarray_constexpr_compare、実行時はarray_compareで比較する） */
+template <typename T_, std::size_t N_> HUMANITY_ARRAY_COMPARE_CONSTEXPR bool operator < (array<T_, N_> const &l, array<T_, N_> const &r) {
+#if defined(HUMANITY_IS_CONSTANT_EVALUATED)
+    return HUMANITY_IS_CONSTANT_EVALUATED() ? array_constexpr_compare<T_>::less(l.data(), r.data(), N_)
+        : array_compare<T_>::less(l.data(), r.data(), N_);
+#else
+    return array_compare<T_>::less(l.data(), r.data(), N_);
+#endif
 }
 
-/** arrayに対する等値比較演算子 */
-template <typename T_, std::size_t N_> bool operator > (array<T_, N_> const &l, array<T_, N_> const &r) {
-    return std::memcmp(l.data(), r.data(), N_) > 0;
+/** arrayに対する比較演算子（要素の辞書式順序） */
+template <typename T_, std::size_t N_> HUMANITY_ARRAY_COMPARE_CONSTEXPR bool operator > (array<T_, N_> const &l, array<T_, N_> const &r) {
+    return r < l;
 }
 
-/** arrayに対する等値比較演算子 */
-template <typename T_, std::size_t N_> bool operator <= (array<T_, N_> const &l, array<T_, N_> const &r) {
-    return std::memcmp(l.data(), r.data(), N_) <= 0;
+/** arrayに対する比較演算子（要素の辞書式順序） */
+template <typename T_, std::size_t N_> HUMANITY_ARRAY_COMPARE_CONSTEXPR bool operator <= (array<T_, N_> const &l, array<T_, N_> const &r) {
+    return !(r < l);
 }
 
-/** arrayに対する等値比較演算子 */
-template <typename T_, std::size_t N_> bool operator >= (array<T_, N_> const &l, array<T_, N_> const &r) {
-    return std::memcmp(l.data(), r.data(), N_) >= 0;
+/** arrayに対する比較演算子（要素の辞書式順序） */
+template <typename T_, std::size_t N_> HUMANITY_ARRAY_COMPARE_CONSTEXPR bool operator >= (array<T_, N_> const &l, array<T_, N_> const &r) {
+    return !(l < r);
 }
 
 HUMANITY_NS_END
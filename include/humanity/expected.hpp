@@ -0,0 +1,245 @@
+/**
+ * 値またはエラーのどちらかを保持するためのクラスの定義ファイル
+ * @file expected.hpp
+ */
+
+#ifndef HUMANITY_EXPECTED_H
+#define HUMANITY_EXPECTED_H
+
+#include <humanity/humanity.hpp>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * expectedにエラーを格納するためのクラス。<br/>
+ * 基本的にはC++23の std::unexpected の模倣。
+ */
+template <typename E_> class unexpected {
+public:
+	/** エラーを指定して構築するコンストラクタ */
+	explicit unexpected(E_ const &error) : error_(error) {}
+
+	/** エラーを取得する */
+	E_ const &error() const { return error_; }
+
+private:
+	E_ error_;
+};
+
+/**
+ * unexpectedを生成する
+ * @param error エラー
+ * @return エラーを保持するunexpectedを返す
+ */
+template <typename E_> unexpected<E_> make_unexpected(E_ const &error) {
+	return unexpected<E_>(error);
+}
+
+/**
+ * 処理の結果の値、または失敗した理由のエラーのどちらかを保持するテンプレートクラス。<br/>
+ * 基本的にはC++23の std::expected の模倣。
+ * 例外を送出せずにエラーを返すために使い、エラーには既定でerrnoの値（int）を格納する。
+ * エラーを保持している場合に値を参照した場合（またはその逆）の動作は未定義（NDEBUGが定義されていない場合はassertで検査する）。
+ */
+template <typename T_, typename E_ = int> class expected {
+public:
+	/** 値の型 */
+	typedef T_ value_type;
+	/** エラーの型 */
+	typedef E_ error_type;
+
+	/** 値を指定して構築するコンストラクタ */
+	expected(T_ const &value) : has_value_(true) {
+		new (&value_) T_(value);
+	}
+	/** 値を指定して構築するコンストラクタ */
+	expected(T_ &&value) : has_value_(true) {
+		new (&value_) T_(std::move(value));
+	}
+	/** エラーを指定して構築するコンストラクタ */
+	template <typename G_> expected(unexpected<G_> const &u) : has_value_(false) {
+		new (&error_) E_(u.error());
+	}
+	/** コピーコンストラクタ */
+	expected(expected const &src) : has_value_(src.has_value_) {
+		if (has_value_) {
+			new (&value_) T_(src.value_);
+		} else {
+			new (&error_) E_(src.error_);
+		}
+	}
+	/** ムーブコンストラクタ */
+	expected(expected &&src)
+		noexcept(std::is_nothrow_move_constructible<T_>::value && std::is_nothrow_move_constructible<E_>::value)
+		: has_value_(src.has_value_)
+	{
+		if (has_value_) {
+			new (&value_) T_(std::move(src.value_));
+		} else {
+			new (&error_) E_(std::move(src.error_));
+		}
+	}
+	~expected() {
+		destroy();
+	}
+
+	/** 代入演算子 */
+	expected &operator = (expected const &r) {
+		if (&r != this) {
+			expected tmp(r);
+			*this = std::move(tmp);
+		}
+		return *this;
+	}
+	/**
+	 * ムーブ代入演算子。<br/>
+	 * 新しい値（またはエラー）の構築で例外が発生した場合は、元の値（またはエラー）を保持したままにする。
+	 */
+	expected &operator = (expected &&r)
+		noexcept(std::is_nothrow_move_constructible<T_>::value && std::is_nothrow_move_constructible<E_>::value)
+	{
+		if (&r != this) {
+			if (has_value_) {
+				if (r.has_value_) {
+					reinit(value_, value_, r.value_);
+				} else {
+					reinit(value_, error_, r.error_);
+				}
+			} else {
+				if (r.has_value_) {
+					reinit(error_, value_, r.value_);
+				} else {
+					reinit(error_, error_, r.error_);
+				}
+			}
+			has_value_ = r.has_value_;
+		}
+		return *this;
+	}
+
+	/** 値を保持しているかどうかを判定する */
+	bool has_value() const { return has_value_; }
+	/** 値を保持しているかどうかを判定する */
+	explicit operator bool () const { return has_value_; }
+
+	/** 値を取得する */
+	T_ &value() {
+		assert(has_value_);
+		return value_;
+	}
+	/** 値を取得する */
+	T_ const &value() const {
+		assert(has_value_);
+		return value_;
+	}
+	/** 値を取得する */
+	T_ &operator * () { return value(); }
+	/** 値を取得する */
+	T_ const &operator * () const { return value(); }
+	/** 値のメンバを参照する */
+	T_ *operator -> () { return &value(); }
+	/** 値のメンバを参照する */
+	T_ const *operator -> () const { return &value(); }
+
+	/**
+	 * 値を取得する
+	 * @param default_value エラーを保持している場合に返す値
+	 * @return 値を保持している場合はその値、そうでなければdefault_valueを返す
+	 */
+	template <typename U_> T_ value_or(U_ &&default_value) const {
+		return has_value_ ? value_ : static_cast<T_>(std::forward<U_>(default_value));
+	}
+
+	/** エラーを取得する */
+	E_ const &error() const {
+		assert(!has_value_);
+		return error_;
+	}
+
+private:
+	void destroy() {
+		if (has_value_) {
+			value_.~T_();
+		} else {
+			error_.~E_();
+		}
+	}
+
+	/**
+	 * 保持しているオブジェクトを破棄し、同じ領域に別のオブジェクトをムーブして構築する
+	 * @param old 破棄するオブジェクト
+	 * @param dst 構築先（oldと同じ領域）
+	 * @param src ムーブ元のオブジェクト
+	 */
+	template <typename Old_, typename New_> static void reinit(Old_ &old, New_ &dst, New_ &src) {
+		reinit(old, dst, src, std::integral_constant<bool, std::is_nothrow_move_constructible<New_>::value>());
+	}
+	template <typename Old_, typename New_> static void reinit(Old_ &old, New_ &dst, New_ &src, std::true_type) {
+		old.~Old_();
+		new (&dst) New_(std::move(src));
+	}
+	template <typename Old_, typename New_> static void reinit(Old_ &old, New_ &dst, New_ &src, std::false_type) {
+#if defined(HUMANITY_ENABLE_EXCEPTIONS)
+		// 構築に失敗した場合に戻せるよう、元のオブジェクトを退避しておく
+		Old_ backup(std::move(old));
+		old.~Old_();
+		try {
+			new (&dst) New_(std::move(src));
+		} catch (...) {
+			new (&old) Old_(std::move(backup));
+			throw;
+		}
+#else
+		old.~Old_();
+		new (&dst) New_(std::move(src));
+#endif
+	}
+
+	bool has_value_;
+	union {
+		T_ value_;
+		E_ error_;
+	};
+};
+
+/**
+ * 値を返さない処理の成否、または失敗した理由のエラーを保持するテンプレートクラス
+ */
+template <typename E_> class expected<void, E_> {
+public:
+	/** 値の型 */
+	typedef void value_type;
+	/** エラーの型 */
+	typedef E_ error_type;
+
+	/** 成功を表すインスタンスを構築するコンストラクタ */
+	expected() : has_value_(true), error_() {}
+	/** エラーを指定して構築するコンストラクタ */
+	template <typename G_> expected(unexpected<G_> const &u) : has_value_(false), error_(u.error()) {}
+
+	/** 成功したかどうかを判定する */
+	bool has_value() const { return has_value_; }
+	/** 成功したかどうかを判定する */
+	explicit operator bool () const { return has_value_; }
+
+	/** 成功したことを検査する */
+	void value() const { assert(has_value_); }
+
+	/** エラーを取得する */
+	E_ const &error() const {
+		assert(!has_value_);
+		return error_;
+	}
+
+private:
+	bool has_value_;
+	E_ error_;
+};
+
+HUMANITY_NS_END
+
+#endif // end of HUMANITY_EXPECTED_H
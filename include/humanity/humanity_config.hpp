@@ -11,5 +11,21 @@
 #define HUMANITY_USE_ASSERT_INSTEAD_OF_EXCEPTIONS
 #endif
 
+#if __cplusplus >= 201402L
+/** C++14以降でだけconstexprにできる関数（本体に複数の文を含むものや、非constのメンバ関数）に付ける指定子 */
+#define HUMANITY_CONSTEXPR14 constexpr
+#else
+#define HUMANITY_CONSTEXPR14
+#endif
+
+#if defined(__has_builtin)
+#  if __has_builtin(__builtin_is_constant_evaluated)
+/** 定数式の中で評価されているかどうかを判定する（判定できない環境では定義されない） */
+#    define HUMANITY_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#  endif
+#elif defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 9)
+#  define HUMANITY_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#endif
+
 #endif // end of HUMANITY_CONFIG_H
 
@@ -0,0 +1,68 @@
+/**
+ * ファイル操作をまとめて実行するためのクラス定義ファイル
+ * @file batch.hpp
+ */
+
+#ifndef HUMANITY_IO_BATCH_H
+#define HUMANITY_IO_BATCH_H
+
+#include <humanity/io/io.hpp>
+#include <humanity/memory.hpp>
+#include <humanity/utils.hpp>
+#include <cstddef>
+#include <functional>
+
+HUMANITY_IO_NS_BEGIN
+
+class path;
+
+/**
+ * 複数のファイル操作を溜めておき、まとめて実行するためのクラス。<br/>
+ * io_uringが利用できる環境ではカーネルへの一括投入で実行し、
+ * 利用できない環境や io_uring が対応していない操作はスレッドプールで実行する。
+ * 各操作の完了はsubmitを呼び出したスレッド上でコールバックにより通知される。
+ */
+class batch : private non_copyable<batch> {
+private:
+	struct impl;
+
+public:
+	/**
+	 * 操作の完了を通知するコールバック。<br/>
+	 * 第1引数は操作対象のパス、第2引数は成功した場合は0、失敗した場合はerrnoの値。
+	 */
+	typedef std::function<void (path const &, int)> callback_type;
+
+	/**
+	 * 操作を実行する方式
+	 */
+	enum backend_type {
+		/** io_uringが利用できればio_uring、そうでなければスレッドプール */
+		BACKEND_AUTO,
+		/** io_uring（利用できない場合はスレッドプール） */
+		BACKEND_URING,
+		/** スレッドプール */
+		BACKEND_THREADS,
+	};
+
+	batch();
+	explicit batch(unsigned int workers, backend_type backend = BACKEND_AUTO);
+	~batch();
+
+	void is_exist(path const &path, callback_type const &callback);
+	void chmod(path const &path, uint16_t mode, callback_type const &callback);
+	void remove(path const &path, callback_type const &callback);
+	void rename(path const &src, path const &dst, callback_type const &callback);
+	void mkdir(path const &path, callback_type const &callback);
+
+	std::size_t size() const;
+	backend_type backend() const;
+	std::size_t submit();
+
+private:
+	auto_ptr<impl> pimpl;
+};
+
+HUMANITY_IO_NS_END
+
+#endif // end of HUMANITY_IO_BATCH_H
@@ -7,14 +7,27 @@
 #define HUMANITY_IO_DIRECTORY_H
 
 #include <humanity/io/io.hpp>
+#include <humanity/exception.hpp>
+#include <humanity/expected.hpp>
 #include <humanity/memory.hpp>
+#include <humanity/string_view.hpp>
+#include <atomic>
+#include <cstddef>
 #include <cstring>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
 #include <string>
 #include <vector>
+#include <dirent.h>
 
 HUMANITY_IO_NS_BEGIN
 
 class path;
+class parallel_remover;
+class parallel_scanner;
+class directory_walker;
+class glob_filter;
 
 /**
  * ディレクトリに格納されているエントリの情報を保持するクラス
@@ -27,14 +40,18 @@ private:
 	directory_entry();
 public:
 	directory_entry(directory_entry const &entry);
+	directory_entry(directory_entry &&entry) noexcept;
 	~directory_entry();
 
 	directory_entry &operator = (directory_entry const &r);
+	directory_entry &operator = (directory_entry &&r) noexcept;
 
 	char const *name() const;
 	bool is_directory() const;
 	bool is_link() const;
 	bool is_regular() const;
+	unsigned char type() const;
+	uint64_t inode() const;
 
 private:
 	auto_ptr<impl> pimpl;
@@ -50,30 +67,511 @@ public:
 };
 
 /**
- * ディレクトリを扱うためのクラス
+ * ディレクトリをスキャンした結果を少ないメモリで格納するためのコンテナクラス。<br/>
+ * パスをディレクトリ部分と名前に分け、連続して追加された同じディレクトリ部分は一度だけ格納する。
+ * 文字列は全て連続した領域に詰めて格納し、要素ごとには名前の位置とディレクトリの番号だけを保持する。
+ * 要素は文字列を参照するビューとして取り出すため、要素を追加するとそれまでに取得したビューは無効になる。
+ */
+class compact_file_names {
+public:
+	/**
+	 * 格納されているパスを参照するクラス
+	 */
+	class file_name {
+	public:
+		file_name(string_view const &dir, string_view const &name) : dir_(dir), name_(name) {}
+
+		/** ディレクトリ部分を取得する（ルート直下のファイルの場合は空文字列） */
+		string_view const &directory() const { return dir_; }
+		/** 名前の部分を取得する */
+		string_view const &name() const { return name_; }
+		/** パス全体の長さを取得する */
+		std::size_t length() const {
+			return dir_.empty() ? name_.size() : dir_.size() + 1 + name_.size();
+		}
+		/** パス全体を文字列の末尾に追加する */
+		void append_to(std::string &out) const {
+			if (!dir_.empty()) {
+				out.append(dir_.data(), dir_.size());
+				out += '/';
+			}
+			out.append(name_.data(), name_.size());
+		}
+		/** パス全体をコピーした文字列を取得する */
+		std::string str() const {
+			std::string ret;
+			ret.reserve(length());
+			append_to(ret);
+			return ret;
+		}
+
+	private:
+		string_view dir_;
+		string_view name_;
+	};
+
+	/**
+	 * 要素を順に参照するためのイテレータ
+	 */
+	class const_iterator {
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef file_name value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef file_name const *pointer;
+		typedef file_name reference;
+
+		const_iterator() : names_(NULL), pos_(0) {}
+		const_iterator(compact_file_names const *names, std::size_t pos) : names_(names), pos_(pos) {}
+
+		reference operator * () const { return (*names_)[pos_]; }
+		reference operator [] (difference_type n) const { return (*names_)[pos_ + n]; }
+		const_iterator &operator ++ () { ++pos_; return *this; }
+		const_iterator operator ++ (int) { const_iterator ret(*this); ++pos_; return ret; }
+		const_iterator &operator -- () { --pos_; return *this; }
+		const_iterator operator -- (int) { const_iterator ret(*this); --pos_; return ret; }
+		const_iterator &operator += (difference_type n) { pos_ += n; return *this; }
+		const_iterator &operator -= (difference_type n) { pos_ -= n; return *this; }
+		const_iterator operator + (difference_type n) const { return const_iterator(names_, pos_ + n); }
+		const_iterator operator - (difference_type n) const { return const_iterator(names_, pos_ - n); }
+		difference_type operator - (const_iterator const &r) const {
+			return static_cast<difference_type>(pos_) - static_cast<difference_type>(r.pos_);
+		}
+		bool operator == (const_iterator const &r) const { return pos_ == r.pos_; }
+		bool operator != (const_iterator const &r) const { return pos_ != r.pos_; }
+		bool operator < (const_iterator const &r) const { return pos_ < r.pos_; }
+		bool operator > (const_iterator const &r) const { return pos_ > r.pos_; }
+		bool operator <= (const_iterator const &r) const { return pos_ <= r.pos_; }
+		bool operator >= (const_iterator const &r) const { return pos_ >= r.pos_; }
+
+	private:
+		compact_file_names const *names_;
+		std::size_t pos_;
+	};
+
+	typedef file_name value_type;
+	typedef std::size_t size_type;
+	typedef const_iterator iterator;
+
+	compact_file_names() : dir_arena_(), dir_offsets_(1, 0), name_arena_(), records_() {}
+	~compact_file_names() {}
+
+	/** 格納している要素の数を取得する */
+	size_type size() const { return records_.size(); }
+	/** 要素が格納されていないかどうかを判定する */
+	bool empty() const { return records_.empty(); }
+
+	/** 引数で指定した位置の要素を取得する（範囲外の位置を指定した場合の動作は未定義） */
+	file_name operator [] (size_type pos) const {
+		record const &r = records_[pos];
+		uint32_t const name_end = (pos + 1 < records_.size()) ? records_[pos + 1].name_offset_ : static_cast<uint32_t>(name_arena_.size());
+		return file_name(
+			string_view(dir_arena_.data() + dir_offsets_[r.dir_], dir_offsets_[r.dir_ + 1] - dir_offsets_[r.dir_]),
+			string_view(name_arena_.data() + r.name_offset_, name_end - r.name_offset_));
+	}
+
+	/** 先頭の要素を指すイテレータを取得する */
+	const_iterator begin() const { return const_iterator(this, 0); }
+	/** 終端を指すイテレータを取得する */
+	const_iterator end() const { return const_iterator(this, records_.size()); }
+
+	/**
+	 * ディレクトリ部分と名前を分けてパスを追加する。<br/>
+	 * 直前に追加した要素とディレクトリ部分が同じであれば、ディレクトリ部分の文字列は共有される。
+	 * @param dir ディレクトリ部分（ルート直下のファイルの場合は空文字列）
+	 * @param name 名前の部分
+	 */
+	void push_back(string_view const &dir, string_view const &name) {
+		THROW_IF(std::numeric_limits<uint32_t>::max() - name_arena_.size() < name.size(), std::length_error, "compact_file_names is too large");
+		if (records_.empty() || (dir != directory_of(records_.back()))) {
+			THROW_IF(std::numeric_limits<uint32_t>::max() - dir_arena_.size() < dir.size(), std::length_error, "compact_file_names is too large");
+			dir_arena_.append(dir.data(), dir.size());
+			dir_offsets_.push_back(static_cast<uint32_t>(dir_arena_.size()));
+		}
+		record r;
+		r.name_offset_ = static_cast<uint32_t>(name_arena_.size());
+		r.dir_ = static_cast<uint32_t>(dir_offsets_.size() - 2);
+		records_.push_back(r);
+		name_arena_.append(name.data(), name.size());
+	}
+
+	/**
+	 * パスを追加する。最後の/より前をディレクトリ部分として扱う。
+	 * @param rel_path 追加するパス
+	 */
+	void push_back(string_view const &rel_path) {
+		std::size_t const pos = rel_path.rfind('/');
+		if (string_view::npos == pos) {
+			push_back(string_view(), rel_path);
+		} else {
+			push_back(rel_path.substr(0, pos), rel_path.substr(pos + 1));
+		}
+	}
+
+	/**
+	 * 追加する要素の数と文字列の合計の長さを見積もって領域を確保する
+	 * @param entries 要素の数
+	 * @param name_bytes 名前の部分の文字列の合計の長さ
+	 */
+	void reserve(size_type entries, size_type name_bytes) {
+		records_.reserve(entries);
+		name_arena_.reserve(name_bytes);
+	}
+
+	/** 全ての要素を取り除く */
+	void clear() {
+		dir_arena_.clear();
+		dir_offsets_.assign(1, 0);
+		name_arena_.clear();
+		records_.clear();
+	}
+
+	/**
+	 * 要素の格納に使っている領域の大きさを取得する
+	 * @return 確保済みの領域を含めた大きさ（バイト単位）を返す
+	 */
+	std::size_t memory_usage() const {
+		return dir_arena_.capacity() + name_arena_.capacity()
+			+ dir_offsets_.capacity() * sizeof(uint32_t) + records_.capacity() * sizeof(record);
+	}
+
+private:
+	/** 要素ごとに保持する情報 */
+	struct record {
+		/** 名前の部分のname_arena_上の位置（長さは次の要素の位置との差） */
+		uint32_t name_offset_;
+		/** ディレクトリ部分の番号 */
+		uint32_t dir_;
+	};
+
+	string_view directory_of(record const &r) const {
+		return string_view(dir_arena_.data() + dir_offsets_[r.dir_], dir_offsets_[r.dir_ + 1] - dir_offsets_[r.dir_]);
+	}
+
+	/** ディレクトリ部分の文字列を詰めて格納する領域 */
+	std::string dir_arena_;
+	/** 各ディレクトリ部分のdir_arena_上の位置（末尾に終端の位置を持つ） */
+	std::vector<uint32_t> dir_offsets_;
+	/** 名前の部分の文字列を詰めて格納する領域 */
+	std::string name_arena_;
+	/** 各要素の情報 */
+	std::vector<record> records_;
+};
+
+/**
+ * 一つのディレクトリのエントリをまとめて読み込んだ結果を保持するコンテナクラス。<br/>
+ * 名前はNULL終端で一つの領域に詰めて格納し、名前の位置、種類（d_type）、iノード番号はそれぞれ別の配列に保持する。
+ * 種類やiノード番号だけを順に調べる処理では、その配列だけを連続して読むことになる。
+ * "."と".."は格納しない。
+ */
+class directory_snapshot {
+public:
+	typedef std::size_t size_type;
+
+	directory_snapshot() : names_(), name_offsets_(1, 0), types_(), inodes_() {}
+	~directory_snapshot() {}
+
+	/** 格納しているエントリの数を取得する */
+	size_type size() const { return types_.size(); }
+	/** エントリが格納されていないかどうかを判定する */
+	bool empty() const { return types_.empty(); }
+
+	/** 引数で指定した位置のエントリの名前をNULL終端の文字列として取得する（範囲外の位置を指定した場合の動作は未定義） */
+	char const *name(size_type pos) const { return names_.data() + name_offsets_[pos]; }
+	/** 引数で指定した位置のエントリの名前を取得する（範囲外の位置を指定した場合の動作は未定義） */
+	string_view name_view(size_type pos) const {
+		return string_view(names_.data() + name_offsets_[pos], name_offsets_[pos + 1] - name_offsets_[pos] - 1);
+	}
+	/** 引数で指定した位置のエントリの種類（d_typeと同じ値）を取得する */
+	unsigned char type(size_type pos) const { return types_[pos]; }
+	/** 引数で指定した位置のエントリのiノード番号を取得する */
+	uint64_t inode(size_type pos) const { return inodes_[pos]; }
+	/** 引数で指定した位置のエントリがディレクトリかどうかを判定する */
+	bool is_directory(size_type pos) const { return DT_DIR == types_[pos]; }
+	/** 引数で指定した位置のエントリがシンボリックリンクかどうかを判定する */
+	bool is_link(size_type pos) const { return DT_LNK == types_[pos]; }
+	/** 引数で指定した位置のエントリがレギュラーファイルかどうかを判定する */
+	bool is_regular(size_type pos) const { return DT_REG == types_[pos]; }
+
+	/**
+	 * エントリを追加する
+	 * @param name エントリの名前
+	 * @param type エントリの種類（d_typeと同じ値）
+	 * @param inode エントリのiノード番号
+	 */
+	void push_back(string_view const &name, unsigned char type, uint64_t inode) {
+		THROW_IF(std::numeric_limits<uint32_t>::max() - names_.size() <= name.size(), std::length_error, "directory_snapshot is too large");
+		names_.append(name.data(), name.size());
+		names_ += '\0';
+		name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+		types_.push_back(type);
+		inodes_.push_back(inode);
+	}
+
+	/**
+	 * 追加するエントリの数と名前の合計の長さを見積もって領域を確保する
+	 * @param entries エントリの数
+	 * @param name_bytes 名前の合計の長さ
+	 */
+	void reserve(size_type entries, size_type name_bytes) {
+		names_.reserve(name_bytes + entries);
+		name_offsets_.reserve(entries + 1);
+		types_.reserve(entries);
+		inodes_.reserve(entries);
+	}
+
+	/** 全てのエントリを取り除く（確保済みの領域は再利用する） */
+	void clear() {
+		names_.clear();
+		name_offsets_.assign(1, 0);
+		types_.clear();
+		inodes_.clear();
+	}
+
+	void sort_by_inode();
+
+	/**
+	 * エントリの格納に使っている領域の大きさを取得する
+	 * @return 確保済みの領域を含めた大きさ（バイト単位）を返す
+	 */
+	std::size_t memory_usage() const {
+		return names_.capacity() + name_offsets_.capacity() * sizeof(uint32_t)
+			+ types_.capacity() + inodes_.capacity() * sizeof(uint64_t);
+	}
+
+private:
+	/** NULL終端の名前を詰めて格納する領域 */
+	std::string names_;
+	/** 各エントリの名前のnames_上の位置（末尾に終端の位置を持つ） */
+	std::vector<uint32_t> name_offsets_;
+	/** 各エントリの種類 */
+	std::vector<unsigned char> types_;
+	/** 各エントリのiノード番号 */
+	std::vector<uint64_t> inodes_;
+};
+
+/**
+ * ディレクトリのスキャンの統計情報
+ */
+class scan_stats {
+public:
+	/** d_typeが不明（DT_UNKNOWN）だったため、fstatatで種類を調べたエントリの数 */
+	uint64_t type_fallbacks;
+
+	scan_stats() : type_fallbacks(0) {}
+	~scan_stats() {}
+};
+
+/**
+ * ディレクトリのスキャン方法を指定するためのクラス
+ */
+class scan_options {
+public:
+	/**
+	 * スキャン結果の並び順
+	 */
+	enum order_type {
+		/** 逐次的に探索した場合と同じ順序 */
+		ORDER_WALKER,
+		/** パス文字列の昇順 */
+		ORDER_SORTED,
+	};
+
+	/** スキャンに使うスレッド数（0の場合はハードウェアの並列度を使う） */
+	unsigned int workers;
+	/** スキャン結果の並び順 */
+	order_type order;
+	/** 対象とするファイルを絞り込むフィルタ（NULLの場合は全ての通常ファイルが対象） */
+	glob_filter const *filter;
+	/** d_typeが不明なエントリの種類をまとめて調べる際のスレッド数（0の場合はハードウェアの並列度を使う） */
+	unsigned int stat_workers;
+	/** スキャンの終了時に統計情報を格納する先（NULLの場合は格納しない） */
+	scan_stats *stats;
+	/**
+	 * スキャン中の作業領域を確保するアリーナ（NULLの場合はスキャンごとに用意する）。<br/>
+	 * 作業領域はスキャンの終了後も解放されず、アリーナの解放時にまとめて解放される。
+	 */
+	monotonic_arena *arena;
+
+	scan_options() : workers(1), order(ORDER_WALKER), filter(NULL), stat_workers(1), stats(NULL), arena(NULL) {}
+	~scan_options() {}
+};
+
+/**
+ * ディレクトリの削除の進捗を表すカウンタ。<br/>
+ * 削除の実行中に他のスレッドから参照できる。
+ */
+class rmdir_progress {
+public:
+	/** 削除したエントリの数 */
+	std::atomic<uint64_t> entries_removed;
+	/** 削除したファイルが使用していた領域の大きさ（バイト単位） */
+	std::atomic<uint64_t> bytes_freed;
+	/** 発生したエラーの数 */
+	std::atomic<uint64_t> errors;
+	/** d_typeが不明（DT_UNKNOWN）だったため、fstatatで種類を調べたエントリの数 */
+	std::atomic<uint64_t> type_fallbacks;
+
+	rmdir_progress() : entries_removed(0), bytes_freed(0), errors(0), type_fallbacks(0) {}
+	~rmdir_progress() {}
+};
+
+/**
+ * ディレクトリの削除方法を指定するためのクラス
+ */
+class rmdir_options {
+public:
+	/** 削除に使うスレッド数（0の場合はハードウェアの並列度を使う） */
+	unsigned int workers;
+	/** 進捗を通知するカウンタ（NULLの場合は通知しない） */
+	rmdir_progress *progress;
+	/**
+	 * 削除中の作業領域を確保するアリーナ（NULLの場合は削除ごとに用意する）。<br/>
+	 * 作業領域は削除の終了後も解放されず、アリーナの解放時にまとめて解放される。
+	 */
+	monotonic_arena *arena;
+
+	rmdir_options() : workers(1), progress(NULL), arena(NULL) {}
+	~rmdir_options() {}
+};
+
+/**
+ * ディレクトリを扱うためのクラス。<br/>
+ * try_で始まる関数は例外を送出せず、失敗した場合はerrnoの値をexpectedに格納して返す。
  */
 class directory {
+	friend class parallel_remover;
+	friend class parallel_scanner;
+	friend class directory_walker;
 private:
 	struct impl;
 
 public:
+	/**
+	 * エントリを一括して読み込むためのバッファの大きさ
+	 */
+	enum {
+		BUFFER_SIZE_MIN     = 64 * 1024,
+		BUFFER_SIZE_MAX     = 1024 * 1024,
+		BUFFER_SIZE_DEFAULT = BUFFER_SIZE_MIN,
+	};
+
 	directory(path const &path);
+	directory(path const &path, std::size_t buffer_size);
+	directory(directory const &parent, char const *name);
+	directory(directory &&src) noexcept;
 	~directory();
 
+	static expected<directory> try_open(path const &path);
+	static expected<directory> try_open(path const &path, std::size_t buffer_size);
+	static expected<directory> try_open(directory const &parent, char const *name);
+
 	bool next();
+	expected<bool> try_next();
 	directory_entry &entry();
 	directory_entry const &entry() const;
 
+	void set_stat_workers(unsigned int workers);
+	uint64_t type_fallbacks() const;
+
+	bool read_all(directory_snapshot &snapshot);
+	static bool read_all(path const &dir_path, directory_snapshot &snapshot);
+	expected<void> try_read_all(directory_snapshot &snapshot);
+	static expected<void> try_read_all(path const &dir_path, directory_snapshot &snapshot);
+
 	static bool scan_all(path const &dir_path, contained_file_names &container);
+	static bool scan_all(path const &dir_path, contained_file_names &container, scan_options const &options);
+	static bool scan_all(path const &dir_path, compact_file_names &container);
 
 	static bool is_exist(path const &path);
 	static bool rename(path const &src, path const &dst);
 	static bool rmdir(path const &path);
+	static bool rmdir(path const &path, rmdir_options const &options);
 	static bool mkdir(path const &path);
 
+	static expected<bool> try_is_exist(path const &path);
+	static expected<void> try_rename(path const &src, path const &dst);
+	static expected<void> try_rmdir(path const &path);
+	static expected<void> try_rmdir(path const &path, rmdir_options const &options);
+	static expected<void> try_mkdir(path const &path);
+
 private:
-	static bool scan(path const &root_dir_path, path const &dir_path, contained_file_names &container);
+	directory();
 
+	int open(int dirfd, char const *name, int flags, std::size_t buffer_size);
+	int descriptor() const;
+	int release_descriptor();
+
+	static int remove_entries(directory &dir);
+
+	auto_ptr<impl> pimpl;
+};
+
+/**
+ * ディレクトリ中のエントリを再帰的に一つずつ列挙するためのクラス。<br/>
+ * エントリは見つかった時点で返され、保持するのは開いているディレクトリの階層だけなので、
+ * 使用するメモリはエントリの数ではなく階層の深さに比例する。
+ * ディレクトリはその内容より先に返され、次のエントリに進む時に中に入る。
+ * サブディレクトリはシンボリックリンクを辿らずに親ディレクトリからの相対パスで開く。
+ */
+class directory_walker : private non_copyable<directory_walker> {
+private:
+	struct impl;
+
+public:
+	/** 階層の深さを制限しない場合に指定する値 */
+	enum { DEPTH_UNLIMITED = 0xFFFFFFFFU };
+
+	/**
+	 * 範囲for文で使うための入力イテレータ。<br/>
+	 * 参照先は directory_walker 自身で、ループの中から entry や skip_subdirectory などを呼び出せる。
+	 */
+	class iterator {
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef directory_walker value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef directory_walker *pointer;
+		typedef directory_walker &reference;
+
+		iterator() : walker_(NULL) {}
+		explicit iterator(directory_walker *walker) : walker_(walker) {}
+
+		reference operator * () const { return *walker_; }
+		pointer operator -> () const { return walker_; }
+		iterator &operator ++ () {
+			if (!walker_->next()) {
+				walker_ = NULL;
+			}
+			return *this;
+		}
+		bool operator == (iterator const &r) const { return walker_ == r.walker_; }
+		bool operator != (iterator const &r) const { return walker_ != r.walker_; }
+
+	private:
+		directory_walker *walker_;
+	};
+
+	explicit directory_walker(path const &root);
+	directory_walker(path const &root, unsigned int max_depth);
+	directory_walker(path const &root, unsigned int max_depth, glob_filter const *filter);
+	directory_walker(path const &root, unsigned int max_depth, scan_options const &options);
+	~directory_walker();
+
+	bool next();
+	directory_entry const &entry() const;
+	std::string const &relative_path() const;
+	std::string const &parent_path() const;
+	unsigned int depth() const;
+	uint64_t type_fallbacks() const;
+
+	void skip_subdirectory();
+	void leave_directory();
+
+	iterator begin();
+	iterator end();
+
+private:
 	auto_ptr<impl> pimpl;
 };
 
@@ -7,13 +7,16 @@
 #define HUMANITY_IO_FILE_H
 
 #include <humanity/io/io.hpp>
+#include <humanity/expected.hpp>
 
 HUMANITY_IO_NS_BEGIN
 
 class path;
 
 /**
- * ファイルを扱うためのクラス
+ * ファイルを扱うためのクラス。<br/>
+ * try_で始まる関数は例外を送出せず、失敗した場合はerrnoの値をexpectedに格納して返す。
+ * 存在しないファイルを頻繁に扱う場合はこちらを使う。
  */
 class file {
 public:
@@ -49,6 +52,12 @@ public:
 	static bool chmod(path const &path, uint16_t mode);
 	static bool remove(path const &path);
 	static bool rename(path const &src, path const &dst);
+
+	static expected<bool> try_is_link(path const &path);
+	static expected<bool> try_is_exist(path const &path);
+	static expected<void> try_chmod(path const &path, uint16_t mode);
+	static expected<void> try_remove(path const &path);
+	static expected<void> try_rename(path const &src, path const &dst);
 };
 
 HUMANITY_IO_NS_END
@@ -0,0 +1,89 @@
+/**
+ * ディレクトリのスキャン結果をパターンで絞り込むためのクラス定義ファイル
+ * @file glob_filter.hpp
+ */
+
+#ifndef HUMANITY_IO_GLOB_FILTER_H
+#define HUMANITY_IO_GLOB_FILTER_H
+
+#include <humanity/io/io.hpp>
+#include <humanity/string_view.hpp>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * スキャンのルートからの相対パスをglobパターンで絞り込むクラス。<br/>
+ * パターンは"/"で区切った要素ごとに照合し、各要素では"*"（任意の文字列）、"?"（任意の一文字）、
+ * "[...]"（文字クラス、"[!...]"で否定）、"\"（エスケープ）が使える。
+ * "**"だけの要素は0個以上の任意の要素に一致する。
+ * "/"を含まないパターン（"*.so"や"lib*"）はどの階層の名前にも一致する（先頭に"**"の要素を補ったパターンと同じ）。
+ * 先頭の"/"と末尾の"/"は無視する。
+ *
+ * スキャン中はディレクトリごとに照合の途中経過（state）を保持し、
+ * ファイルはその名前（d_name）だけで判定するため、除外されるエントリのパス文字列は作られない。
+ * includeを一つも登録しない場合は全てのファイルが対象になり、
+ * excludeに一致したファイルは除外され、excludeに一致したディレクトリは中を探索しない。
+ * includeに一致するファイルを含み得ないディレクトリも中を探索しない。
+ * 構築後は複数のスレッドから同時に使える。
+ */
+class glob_filter {
+public:
+	/**
+	 * ディレクトリごとの照合の途中経過
+	 */
+	class state {
+		friend class glob_filter;
+	public:
+		state() : bits_() {}
+		~state() {}
+
+	private:
+		/** パターンごとに、照合し終えた要素の位置の集合 */
+		std::vector<uint64_t> bits_;
+	};
+
+	/** 一つのパターンに含められる要素の数の上限 */
+	enum { MAX_SEGMENTS = 63 };
+
+	glob_filter();
+	~glob_filter();
+
+	void include(string_view pattern);
+	void exclude(string_view pattern);
+
+	/** パターンが一つも登録されていないかどうかを判定する */
+	bool empty() const { return includes_.empty() && excludes_.empty(); }
+
+	state root() const;
+	bool enter(state const &parent, string_view name, state &child) const;
+	bool accept(state const &dir, string_view name) const;
+	bool match(string_view rel_path) const;
+
+	static bool match_segment(string_view pattern, string_view name);
+
+private:
+	/**
+	 * 要素に分割したパターン
+	 */
+	struct pattern {
+		/** パターンの各要素 */
+		std::vector<std::string> segments_;
+		/** "**"である要素の位置の集合 */
+		uint64_t globstar_;
+	};
+
+	static pattern compile(string_view pattern);
+	static uint64_t closure(pattern const &p, uint64_t bits);
+	static uint64_t step(pattern const &p, uint64_t bits, string_view name);
+	static uint64_t accepted(pattern const &p) { return 1ULL << p.segments_.size(); }
+
+	std::vector<pattern> includes_;
+	std::vector<pattern> excludes_;
+};
+
+HUMANITY_IO_NS_END
+
+#endif // end of HUMANITY_IO_GLOB_FILTER_H
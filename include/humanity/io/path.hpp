@@ -7,28 +7,93 @@
 #define HUMANITY_IO_PATH_H
 
 #include <humanity/io/io.hpp>
-#include <humanity/memory.hpp>
+#include <humanity/expected.hpp>
+#include <humanity/string_view.hpp>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
 #include <string>
 
 //HUMANITY_IO_NS_BEGIN
 namespace Humanity { namespace io {
 
 /**
- * ファイルのパスを扱うクラス
+ * ファイルのパスを扱うクラス。<br/>
+ * ルートより上に遡るパス（"/.."など）を正規化する関数は std::runtime_error を送出する。
+ * try_で始まる関数は例外を送出せず、その場合はEINVALをexpectedに格納して返す。
  */
 class path {
-private:
-	struct impl;
-
 public:
+	/**
+	 * パスの要素を先頭から順にたどるイテレータ。<br/>
+	 * 要素はパス文字列を参照するstring_viewで、絶対パスの場合は最初の要素が"/"になる。
+	 * 空の要素は読み飛ばすが、"."や".."は正規化せずにそのまま返す。
+	 * 参照先のpathを変更または破棄するとイテレータは無効になる。
+	 */
+	class component_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef string_view value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef string_view const *pointer;
+		typedef string_view const &reference;
+
+		component_iterator() : end_(NULL), current_() {}
+		/** パス文字列の範囲を指定して、先頭の要素を指すイテレータを構築するコンストラクタ */
+		component_iterator(char const *begin, char const *end) : end_(end), current_() {
+			if ((begin < end) && ('/' == *begin)) {
+				current_ = string_view(begin, 1);
+			} else {
+				seek(begin);
+			}
+		}
+
+		reference operator * () const { return current_; }
+		pointer operator -> () const { return &current_; }
+		component_iterator &operator ++ () {
+			seek(current_.data() + current_.size());
+			return *this;
+		}
+		component_iterator operator ++ (int) {
+			component_iterator ret(*this);
+			++*this;
+			return ret;
+		}
+		bool operator == (component_iterator const &r) const { return current_.data() == r.current_.data(); }
+		bool operator != (component_iterator const &r) const { return current_.data() != r.current_.data(); }
+
+	private:
+		/** 指定した位置以降で最初の要素を探す（見つからなければ終端になる） */
+		void seek(char const *p) {
+			while ((p < end_) && ('/' == *p)) {
+				++p;
+			}
+			if (p >= end_) {
+				current_ = string_view();
+				return;
+			}
+			char const *sep = static_cast<char const*>(std::memchr(p, '/', end_ - p));
+			current_ = string_view(p, ((NULL == sep) ? end_ : sep) - p);
+		}
+
+		char const *end_;
+		string_view current_;
+	};
+	/** 要素をたどるイテレータ */
+	typedef component_iterator const_iterator;
+	/** 要素をたどるイテレータ（要素は変更できない） */
+	typedef component_iterator iterator;
+
 	path();
 	path(std::string const &path_str);
 	path(char const *path_str);
 	path(char const *path_str, std::size_t n);
 	path(path const &src);
+	path(path &&src) noexcept;
 	~path();
 
 	path &operator = (path const &r);
+	path &operator = (path &&r) noexcept;
 
 	bool operator == (path const &r) const;
 	bool operator != (path const &r) const;
@@ -45,12 +110,43 @@ public:
 
 	std::string file_name() const;
 	char const *full_path() const;
+	std::size_t length() const;
 
 	path parent() const;
 	path add_file_name_suffix(std::string const &suffix) const;
 
+	expected<path> try_append(path const &r) const;
+	expected<bool> try_is_parent(path const &child) const;
+	expected<path> try_make_relative(path const &child) const;
+	expected<std::string> try_file_name() const;
+	expected<path> try_parent() const;
+	expected<path> try_add_file_name_suffix(std::string const &suffix) const;
+
+	string_view file_name_view() const;
+	string_view parent_view() const;
+	string_view extension() const;
+
+	component_iterator begin() const;
+	component_iterator end() const;
+
 private:
-	auto_ptr<impl> pimpl;
+	/** 内部バッファに格納できるパス文字列の長さ（終端文字を含む） */
+	enum { INLINE_CAPACITY = 160 };
+
+	void assign(char const *str, std::size_t n);
+	void reserve(std::size_t n);
+	int append(path const &r);
+	int normalize();
+	void steal(path &src) noexcept;
+
+	/** パス文字列の先頭（inline_またはヒープ上の領域を指す） */
+	char *data_;
+	/** パス文字列の長さ */
+	std::size_t length_;
+	/** data_が指す領域の大きさ */
+	std::size_t capacity_;
+	/** 短いパス文字列を格納するための内部バッファ */
+	char inline_[INLINE_CAPACITY];
 };
 
 HUMANITY_IO_NS_END
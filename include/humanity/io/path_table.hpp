@@ -0,0 +1,146 @@
+/**
+ * パスを正規化して一意に登録するためのクラス定義ファイル
+ * @file path_table.hpp
+ */
+
+#ifndef HUMANITY_IO_PATH_TABLE_H
+#define HUMANITY_IO_PATH_TABLE_H
+
+#include <humanity/io/io.hpp>
+#include <humanity/memory.hpp>
+#include <humanity/string_view.hpp>
+#include <humanity/utils.hpp>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+HUMANITY_IO_NS_BEGIN
+
+class path;
+class path_table;
+
+/**
+ * path_tableに登録されたパスの一要素。<br/>
+ * 親の要素へのリンクを持ち、ルートからの並びで一つの正規化済みのパスを表す。
+ * 登録したpath_tableが破棄されるまで同じアドレスに存在する。
+ */
+struct path_node {
+	/** 親の要素（ルートの場合はNULL） */
+	path_node const *parent_;
+	/** 要素の名前（ルートの場合は"/"または空文字列） */
+	char const *name_;
+	/** 要素の名前の長さ */
+	uint32_t name_length_;
+	/** ルートからの深さ（ルートは0） */
+	uint32_t depth_;
+	/** ルートからの全要素から計算したハッシュ値 */
+	std::size_t hash_;
+};
+
+/**
+ * path_tableに登録されたパスを表すハンドル。<br/>
+ * 同じtableに登録された正規化後に等しいパスは必ず同じハンドルになるため、
+ * 等値比較とハッシュ値の取得は文字列を扱わずに定数時間で行える。
+ * 異なるpath_tableのハンドル同士は比較できない。
+ */
+class path_handle {
+	friend class path_table;
+public:
+	path_handle() : node_(NULL) {}
+	~path_handle() {}
+
+	/** 等値比較演算子 */
+	bool operator == (path_handle const &r) const { return node_ == r.node_; }
+	/** 等値比較演算子 */
+	bool operator != (path_handle const &r) const { return node_ != r.node_; }
+	/** 比較演算子（順序は登録したアドレスによるもので、パス文字列の順序ではない） */
+	bool operator < (path_handle const &r) const { return std::less<path_node const*>()(node_, r.node_); }
+
+	/** ハンドルが何も指していないかどうかを判定する */
+	bool empty() const { return NULL == node_; }
+	/** 登録時に計算したハッシュ値を取得する */
+	std::size_t hash() const { return (NULL == node_) ? 0 : node_->hash_; }
+	/** ルートからの深さを取得する（ルートは0） */
+	std::size_t depth() const { return (NULL == node_) ? 0 : node_->depth_; }
+	/** 末尾の要素の名前を取得する */
+	string_view name() const {
+		return (NULL == node_) ? string_view() : string_view(node_->name_, node_->name_length_);
+	}
+	/** 親のハンドルを取得する（ルートの場合は空のハンドルを返す） */
+	path_handle parent() const { return path_handle((NULL == node_) ? NULL : node_->parent_); }
+
+	/**
+	 * ハンドルが引数に指定したハンドルの親（祖先）かどうかを判定する。<br/>
+	 * 子のハンドルから深さの差だけ親をたどって比較する。
+	 * @param child 子要素のハンドル
+	 * @return 親のハンドルの場合はtrue、そうでなければfalseを返す
+	 */
+	bool is_parent(path_handle const &child) const {
+		if ((NULL == node_) || (NULL == child.node_) || (child.node_->depth_ <= node_->depth_)) {
+			return false;
+		}
+		path_node const *p = child.node_;
+		while (p->depth_ > node_->depth_) {
+			p = p->parent_;
+		}
+		return p == node_;
+	}
+
+	bool is_absolute() const;
+	std::string str() const;
+	path to_path() const;
+
+private:
+	explicit path_handle(path_node const *node) : node_(node) {}
+
+	path_node const *node_;
+};
+
+/**
+ * パスを正規化して登録し、同じパスには同じハンドルを返すテーブル。<br/>
+ * パスは要素ごとに親へのリンクを持つ木として保持し、正規化とハッシュ値の計算は登録時に一度だけ行う。
+ * 登録した要素はテーブルが破棄されるまで解放されず、ハンドルも有効なままとなる。
+ * 登録は複数のスレッドから同時に行える。
+ */
+class path_table : private non_copyable<path_table> {
+private:
+	struct impl;
+
+public:
+	/** テーブルを分割するシャードの数 */
+	enum { SHARDS = 64 };
+
+	path_table();
+	~path_table();
+
+	path_handle insert(path const &path);
+	path_handle insert(char const *path_str, std::size_t n);
+	path_handle insert(path_handle const &parent, string_view name);
+	path_handle find(path const &path) const;
+
+	path_handle root() const;
+	path_handle current() const;
+
+	std::size_t size() const;
+	std::size_t memory_usage() const;
+
+private:
+	auto_ptr<impl> pimpl;
+};
+
+HUMANITY_IO_NS_END
+
+namespace std {
+
+/**
+ * path_handleを非順序連想コンテナのキーにするためのstd::hashの特殊化
+ */
+template <> struct hash<Humanity::io::path_handle> {
+	std::size_t operator () (Humanity::io::path_handle const &h) const {
+		return h.hash();
+	}
+};
+
+}
+
+#endif // end of HUMANITY_IO_PATH_TABLE_H
@@ -0,0 +1,53 @@
+/**
+ * ファイルの状態をキャッシュするためのクラス定義ファイル
+ * @file stat_cache.hpp
+ */
+
+#ifndef HUMANITY_IO_STAT_CACHE_H
+#define HUMANITY_IO_STAT_CACHE_H
+
+#include <humanity/io/io.hpp>
+#include <cstddef>
+
+HUMANITY_IO_NS_BEGIN
+
+class path;
+
+/**
+ * file::is_exist、file::is_link、directory::is_exist が使うlstatの結果をキャッシュするクラス。<br/>
+ * 既定では無効で、enableを呼び出すと有効になる。
+ * キャッシュは連続したセパレータと"."の要素を取り除いたパス文字列をキーとしてシャードに分けたハッシュテーブルに保持し、
+ * lstatの結果が字面と一致しない".."を含むパスと、末尾がセパレータで終わるパスはキャッシュしない。
+ * 各エントリは指定した有効期間が過ぎると破棄される。
+ * このライブラリを通したファイルの削除・リネーム・モードの変更・ディレクトリの作成と削除ではキャッシュを無効化するが、
+ * 他のプロセスなどによる変更は有効期間が過ぎるまで反映されない。
+ * 相対パスはカレントディレクトリを含めずにキーとするため、カレントディレクトリを変更した場合はinvalidate_allを呼び出す。
+ */
+class stat_cache {
+public:
+	/** キャッシュを分割するシャードの数 */
+	enum { SHARDS = 64 };
+	/** シャードごとに保持するエントリ数の上限 */
+	enum { MAX_ENTRIES_PER_SHARD = 16 * 1024 };
+
+	static void enable(unsigned int ttl_ms);
+	static void disable();
+	static bool is_enabled();
+
+	static void invalidate(path const &path);
+	static void invalidate_tree(path const &path);
+	static void invalidate_rename(path const &src, path const &dst);
+	static void invalidate_all();
+
+	static uint64_t hits();
+	static uint64_t misses();
+
+	static int lstat_mode(path const &path, uint32_t &mode);
+
+private:
+	stat_cache();
+};
+
+HUMANITY_IO_NS_END
+
+#endif // end of HUMANITY_IO_STAT_CACHE_H
@@ -5,19 +5,43 @@
 #ifndef HUMANITY_LOG_H
 #define HUMANITY_LOG_H
 
-#if defined(__ANDROID__)
+#if defined(HUMANITY_LOG_BINARY)
+/** 書式の番号と引数だけをバイナリ形式で記録する（tools/log_decodeで文字列に変換する） */
+#  include <humanity/log_binary.hpp>
+#  include <humanity/log_level.hpp>
+#  define HUMANITY_LOG_LEVEL_VERB  HUMANITY_LOG_PRIO_VERBOSE
+#  define HUMANITY_LOG_LEVEL_DEBUG HUMANITY_LOG_PRIO_DEBUG
+#  define HUMANITY_LOG_LEVEL_INFO  HUMANITY_LOG_PRIO_INFO
+#  define HUMANITY_LOG_LEVEL_WARN  HUMANITY_LOG_PRIO_WARN
+#  define HUMANITY_LOG_LEVEL_ERROR HUMANITY_LOG_PRIO_ERROR
+#  define LOG_(fp, type, fmt, file, line, ...) do { \
+		static HUMANITY_NS::binary_log_format const humanity_log_format_(type, fmt, file, line); \
+		HUMANITY_NS::log_binary(humanity_log_format_, ##__VA_ARGS__); \
+	} while (0)
+#elif defined(__ANDROID__)
 #  include <humanity/android/log.hpp>
 #elif defined(HUMANITY_LOG_STDIO)
 #  include <cstdio>
+#  ifndef HUMANITY_LOG_TAG
+/** ログに出力されるタグ文字列 */
+#    define HUMANITY_LOG_TAG "humanity"
+#  endif
+#  if defined(HUMANITY_LOG_ASYNC)
+/** 書式化と書き込みをバックグラウンドのスレッドで行う */
+#    include <humanity/log_async.hpp>
+#    define HUMANITY_LOG_PRINT_ HUMANITY_NS::log_async
+#  else
+#    define HUMANITY_LOG_PRINT_ std::fprintf
+#  endif
 #  define HUMANITY_LOG_LEVEL_INFO  ":INFO "
 #  define HUMANITY_LOG_LEVEL_VERB  ":VERB "
 #  define HUMANITY_LOG_LEVEL_ERROR ":ERR  "
 #  define HUMANITY_LOG_LEVEL_WARN  ":WARN "
 #  define HUMANITY_LOG_LEVEL_DEBUG ":DBG  "
 #  if defined(HUMANITY_LOG_ENABLE_DETAIL)
-#    define LOG_(fp, type, fmt, file, line, ...) std::fprintf(fp, HUMANITY_LOG_TAG type fmt "\n", ##__VA_ARGS__)
+#    define LOG_(fp, type, fmt, file, line, ...) HUMANITY_LOG_PRINT_(fp, HUMANITY_LOG_TAG type "(%s:%d)" fmt "\n", file, line, ##__VA_ARGS__)
 #  else
-#    define LOG_(fp, type, fmt, file, line, ...) std::fprintf(fp, HUMANITY_LOG_TAG type "(%s:%d)" fmt "\n", file, line, ##__VA_ARGS__)
+#    define LOG_(fp, type, fmt, file, line, ...) HUMANITY_LOG_PRINT_(fp, HUMANITY_LOG_TAG type fmt "\n", ##__VA_ARGS__)
 #  endif
 #else
 #  define HUMANITY_LOG_LEVEL_INFO
@@ -26,23 +50,58 @@
 #  define HUMANITY_LOG_LEVEL_WARN
 #  define HUMANITY_LOG_LEVEL_DEBUG
 #  define LOG_(fp, type, fmt, file, line, ...)
+#  define HUMANITY_LOG_DISABLED
+#endif
+
+#include <humanity/log_level.hpp>
+
+#if defined(HUMANITY_LOG_DISABLED)
+#  define HUMANITY_LOG_IF_(level, fp, type, fmt, ...)
+#else
+/** 実行時のレベルを確認してからログを出力する */
+#  define HUMANITY_LOG_IF_(level, fp, type, fmt, ...) do { \
+		if (HUMANITY_NS::is_log_enabled(level)) { \
+			LOG_(fp, type, fmt, __FILE__, __LINE__, ##__VA_ARGS__); \
+		} \
+	} while (0)
 #endif
 
-#define LOGI(fmt, ...)    LOG_(stdout, HUMANITY_LOG_LEVEL_INFO,  fmt, __FILE__, __LINE__, ##__VA_ARGS__)
-#define LOGV(fmt, ...)    LOG_(stdout, HUMANITY_LOG_LEVEL_VERB,  fmt, __FILE__, __LINE__, ##__VA_ARGS__)
-#define LOGE(fmt, ...)    LOG_(stderr, HUMANITY_LOG_LEVEL_ERROR, fmt, __FILE__, __LINE__, ##__VA_ARGS__)
-#define LOGW(fmt, ...)    LOG_(stderr, HUMANITY_LOG_LEVEL_WARN,  fmt, __FILE__, __LINE__, ##__VA_ARGS__)
+#if HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_VERBOSE
+#  define LOGV(fmt, ...)  HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_VERBOSE, stdout, HUMANITY_LOG_LEVEL_VERB,  fmt, ##__VA_ARGS__)
+#else
+#  define LOGV(fmt, ...)
+#endif
+#if HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_INFO
+#  define LOGI(fmt, ...)  HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_INFO,    stdout, HUMANITY_LOG_LEVEL_INFO,  fmt, ##__VA_ARGS__)
+#else
+#  define LOGI(fmt, ...)
+#endif
+#if HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_WARN
+#  define LOGW(fmt, ...)  HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_WARN,    stderr, HUMANITY_LOG_LEVEL_WARN,  fmt, ##__VA_ARGS__)
+#else
+#  define LOGW(fmt, ...)
+#endif
+#if HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_ERROR
+#  define LOGE(fmt, ...)  HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_ERROR,   stderr, HUMANITY_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#  define LOGE(fmt, ...)
+#endif
 
-#if defined(HUMANITY_LOG_ENABLE_DEBUG)
-#  define LOGD(fmt, ...)  LOG_(stdout, HUMANITY_LOG_LEVEL_DEBUG, fmt, __FILE__, __LINE__, ##__VA_ARGS__)
-#  define LOGED(fmt, ...) LOG_(stdout, HUMANITY_LOG_LEVEL_ERROR, fmt, __FILE__, __LINE__, ##__VA_ARGS__)
-#  define LOGWD(fmt, ...) LOG_(stdout, HUMANITY_LOG_LEVEL_WARN,  fmt, __FILE__, __LINE__, ##__VA_ARGS__)
+#if defined(HUMANITY_LOG_ENABLE_DEBUG) && (HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_DEBUG)
+#  define LOGD(fmt, ...)  HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_DEBUG,   stdout, HUMANITY_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
 #else
 #  define LOGD(fmt, ...)
+#endif
+#if defined(HUMANITY_LOG_ENABLE_DEBUG) && (HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_ERROR)
+#  define LOGED(fmt, ...) HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_ERROR,   stdout, HUMANITY_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
 #  define LOGED(fmt, ...)
+#endif
+#if defined(HUMANITY_LOG_ENABLE_DEBUG) && (HUMANITY_LOG_MIN_LEVEL <= HUMANITY_LOG_PRIO_WARN)
+#  define LOGWD(fmt, ...) HUMANITY_LOG_IF_(HUMANITY_LOG_PRIO_WARN,    stdout, HUMANITY_LOG_LEVEL_WARN,  fmt, ##__VA_ARGS__)
+#else
 #  define LOGWD(fmt, ...)
 #endif
 
-
 #endif // end of HUMANITY_LOG_H
 
@@ -0,0 +1,70 @@
+/**
+ * ログを別スレッドで書き出すための定義ファイル。<br/>
+ * HUMANITY_LOG_STDIOとHUMANITY_LOG_ASYNCを定義すると、LOGI等のマクロがこの実装を使う。
+ * @file humanity/log_async.hpp
+ */
+
+#ifndef HUMANITY_LOG_ASYNC_H
+#define HUMANITY_LOG_ASYNC_H
+
+#include <humanity/humanity.hpp>
+#include <humanity/log_record.hpp>
+#include <cstddef>
+#include <cstdio>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * ログをスレッドごとのリングバッファに積み、バックグラウンドのスレッドで書式化して書き出すクラス。<br/>
+ * ログを出力するスレッドは引数の値をリングバッファにコピーするだけで、stdioのロックを取らない。
+ * 同じスレッドから出力したログの順序は保たれるが、異なるスレッド間の順序は保証されない。
+ */
+class async_log {
+public:
+	/**
+	 * リングバッファに空きが無い時の動作
+	 */
+	enum overflow_policy {
+		/** ログを捨てる */
+		OVERFLOW_DROP,
+		/** 空きができるまで待つ */
+		OVERFLOW_BLOCK,
+		/** ログを捨て、捨てた数を後でまとめて出力する */
+		OVERFLOW_COUNT,
+	};
+
+	/** スレッドごとのリングバッファの大きさ */
+	enum { RING_SIZE = 64 * 1024 };
+
+	static void set_overflow_policy(overflow_policy policy);
+	static overflow_policy get_overflow_policy();
+	static uint64_t dropped();
+	static void flush();
+
+	static char *reserve(std::FILE *fp, char const *fmt, std::size_t args_size);
+	static void commit();
+
+private:
+	async_log();
+};
+
+/**
+ * ログを非同期に出力する。<br/>
+ * 引数は書式文字列に関わらず型に従って保存され、書式化はバックグラウンドのスレッドで行われる。
+ * 書式文字列は文字列リテラルなど、プログラムの終了まで有効なものでなければならない。
+ * @param fp 出力先のストリーム
+ * @param fmt printfと同じ形式の書式文字列
+ * @param args 書式文字列に対応する引数
+ */
+template <typename... Args_> void log_async(std::FILE *fp, char const *fmt, Args_... args)
+{
+	char *p = async_log::reserve(fp, fmt, log_args_size(args...));
+	if (NULL != p) {
+		encode_log_args(p, args...);
+		async_log::commit();
+	}
+}
+
+HUMANITY_NS_END
+
+#endif // end of HUMANITY_LOG_ASYNC_H
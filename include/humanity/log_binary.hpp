@@ -0,0 +1,112 @@
+/**
+ * ログを書式化せずにバイナリ形式で記録するための定義ファイル。<br/>
+ * HUMANITY_LOG_BINARYを定義すると、LOGI等のマクロがこの実装を使う。
+ * 記録したファイルはlog_decodeで文字列に変換する。
+ * @file humanity/log_binary.hpp
+ */
+
+#ifndef HUMANITY_LOG_BINARY_H
+#define HUMANITY_LOG_BINARY_H
+
+#include <humanity/humanity.hpp>
+#include <humanity/log_record.hpp>
+#include <humanity/utils.hpp>
+#include <atomic>
+#include <cstddef>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * ログの出力箇所ごとの書式の定義。<br/>
+ * 出力箇所ごとに関数内のstatic変数として一度だけ構築され、構築時に番号が割り当てられる。
+ * 書式文字列やファイル名は文字列リテラルなど、プログラムの終了まで有効なものでなければならない。
+ */
+class binary_log_format : private non_copyable<binary_log_format> {
+public:
+	binary_log_format(int level, char const *fmt, char const *file, int line);
+	~binary_log_format() {}
+
+	/** 書式に割り当てられた番号を取得する */
+	uint32_t id() const { return id_; }
+	/** ログのレベルを取得する */
+	int level() const { return level_; }
+	/** 書式文字列を取得する */
+	char const *format() const { return fmt_; }
+	/** 出力箇所のファイル名を取得する */
+	char const *file() const { return file_; }
+	/** 出力箇所の行番号を取得する */
+	int line() const { return line_; }
+
+private:
+	uint32_t id_;
+	int level_;
+	char const *fmt_;
+	char const *file_;
+	int line_;
+};
+
+/**
+ * バイナリ形式のログファイルを管理するクラス。<br/>
+ * 各スレッドはログをスレッドごとのバッファに書き込み、バッファが一杯になった時、flushを呼び出した時、
+ * スレッドが終了した時にまとめてファイルに書き出す。
+ * ファイルを開いていない間に出力されたログと、ファイルを閉じた時に他のスレッドのバッファに残っていたログは捨てられる。
+ * <pre>
+ * ファイルの形式（数値は全て書き込んだ環境のバイトオーダー）
+ *   ヘッダ   : "HMNBLOG\0", uint32_t バイトオーダー確認用の値(0x01020304), uint32_t バージョン
+ *   書式定義 : uint8_t 2, uint32_t 番号, uint8_t レベル, uint32_t 行番号,
+ *              uint16_t ファイル名の長さ, ファイル名, uint16_t 書式文字列の長さ, 書式文字列
+ *   ログ     : uint8_t 1, uint32_t 書式の番号, uint32_t スレッド番号, uint64_t 時刻（UNIX時間のナノ秒）,
+ *              uint32_t 引数の大きさ, encode_log_argsで詰めた引数
+ * </pre>
+ * 書式定義は、その書式を使うログより前に書き込まれる。
+ */
+class binary_log {
+public:
+	/** ファイルの形式のバージョン */
+	enum { VERSION = 1 };
+
+	/** ファイル中のレコードの種類 */
+	enum record_type {
+		RECORD_LOG    = 1,
+		RECORD_FORMAT = 2,
+	};
+
+	/** スレッドごとのバッファの大きさ（これを超えるとファイルに書き出す） */
+	enum { BUFFER_SIZE = 64 * 1024 };
+
+	/** ログのレコードの固定長部分の大きさ */
+	enum { RECORD_HEADER_SIZE = 1 + 4 + 4 + 8 + 4 };
+
+	static bool open(char const *path);
+	static void close();
+	static void flush();
+
+	/** ファイルを開いているかどうかを判定する */
+	static bool is_open() {
+		return opened_.load(std::memory_order_relaxed);
+	}
+
+	static char *reserve(uint32_t id, std::size_t args_size);
+
+private:
+	binary_log();
+
+	static std::atomic<bool> opened_;
+};
+
+/**
+ * ログを書式化せずにバイナリ形式で記録する
+ * @param format 出力箇所の書式の定義
+ * @param args 書式文字列に対応する引数
+ */
+template <typename... Args_> void log_binary(binary_log_format const &format, Args_... args)
+{
+	if (!binary_log::is_open()) {
+		return;
+	}
+	encode_log_args(binary_log::reserve(format.id(), log_args_size(args...)), args...);
+}
+
+HUMANITY_NS_END
+
+#endif // end of HUMANITY_LOG_BINARY_H
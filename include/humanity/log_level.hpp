@@ -0,0 +1,69 @@
+/**
+ * ログのレベルによる出力の制御を定義するファイル。<br/>
+ * HUMANITY_LOG_MIN_LEVELより低いレベルのログはコンパイル時に取り除かれ、引数も評価されない。
+ * それ以外のログは実行時に設定したレベルと比較してから出力される。
+ * @file humanity/log_level.hpp
+ */
+
+#ifndef HUMANITY_LOG_LEVEL_H
+#define HUMANITY_LOG_LEVEL_H
+
+#include <humanity/humanity.hpp>
+#include <atomic>
+
+/** ログのレベル（数値はAndroidのログの優先度と同じ） */
+#define HUMANITY_LOG_PRIO_VERBOSE 2
+#define HUMANITY_LOG_PRIO_DEBUG   3
+#define HUMANITY_LOG_PRIO_INFO    4
+#define HUMANITY_LOG_PRIO_WARN    5
+#define HUMANITY_LOG_PRIO_ERROR   6
+#define HUMANITY_LOG_PRIO_SILENT  8
+
+#ifndef HUMANITY_LOG_MIN_LEVEL
+/** コンパイル時に残すログの最低のレベル */
+#  define HUMANITY_LOG_MIN_LEVEL HUMANITY_LOG_PRIO_VERBOSE
+#endif
+
+HUMANITY_NS_BEGIN
+
+/**
+ * 実行時に出力するログの最低のレベルを保持する変数を取得する
+ */
+inline std::atomic<int> &log_runtime_level()
+{
+	static std::atomic<int> level(HUMANITY_LOG_PRIO_VERBOSE);
+	return level;
+}
+
+/**
+ * 実行時に出力するログの最低のレベルを設定する。<br/>
+ * HUMANITY_LOG_MIN_LEVELより低いレベルを設定しても、コンパイル時に取り除かれたログは出力されない。
+ * @param level 出力するログの最低のレベル（HUMANITY_LOG_PRIO_*）
+ */
+inline void set_log_level(int level)
+{
+	log_runtime_level().store(level, std::memory_order_relaxed);
+}
+
+/**
+ * 実行時に出力するログの最低のレベルを取得する
+ * @return 出力するログの最低のレベルを返す
+ */
+inline int get_log_level()
+{
+	return log_runtime_level().load(std::memory_order_relaxed);
+}
+
+/**
+ * 指定したレベルのログを出力するかどうかを判定する
+ * @param level ログのレベル
+ * @return 出力する場合はtrue、そうでなければfalseを返す
+ */
+inline bool is_log_enabled(int level)
+{
+	return level >= log_runtime_level().load(std::memory_order_relaxed);
+}
+
+HUMANITY_NS_END
+
+#endif // end of HUMANITY_LOG_LEVEL_H
@@ -0,0 +1,156 @@
+/**
+ * ログの書式引数をバイト列に詰めて保存するための定義ファイル。<br/>
+ * 呼び出し元では引数の値を書き込むだけにして、書式化は後から別の場所で行うために使う。
+ * @file humanity/log_record.hpp
+ */
+
+#ifndef HUMANITY_LOG_RECORD_H
+#define HUMANITY_LOG_RECORD_H
+
+#include <humanity/humanity.hpp>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * バイト列に詰めた引数の種類
+ */
+enum log_arg_type {
+	/** 符号付き整数（int64_tで保存する） */
+	LOG_ARG_INT     = 1,
+	/** 符号無し整数（uint64_tで保存する） */
+	LOG_ARG_UINT    = 2,
+	/** 浮動小数点数（doubleで保存する） */
+	LOG_ARG_DOUBLE  = 3,
+	/** 文字列（uint32_tの長さに続けてNUL終端した内容を保存する） */
+	LOG_ARG_STRING  = 4,
+	/** ポインタ（uint64_tで保存する） */
+	LOG_ARG_POINTER = 5,
+};
+
+/**
+ * 引数の型からバイト列上の表現を決めるためのテンプレートクラス。<br/>
+ * printfに渡せない型を渡した場合はコンパイルエラーになる。
+ */
+template <typename T_, typename Enable_ = void> struct log_arg_traits;
+
+/** 符号付き整数と列挙型 */
+template <typename T_> struct log_arg_traits<T_, typename std::enable_if<
+		(std::is_integral<T_>::value && std::is_signed<T_>::value) || std::is_enum<T_>::value>::type> {
+	static std::size_t size(T_) {
+		return 1 + sizeof(int64_t);
+	}
+	static char *encode(char *p, T_ v) {
+		int64_t const x = static_cast<int64_t>(v);
+		*p++ = LOG_ARG_INT;
+		std::memcpy(p, &x, sizeof(x));
+		return p + sizeof(x);
+	}
+};
+
+/** 符号無し整数 */
+template <typename T_> struct log_arg_traits<T_, typename std::enable_if<
+		std::is_integral<T_>::value && !std::is_signed<T_>::value>::type> {
+	static std::size_t size(T_) {
+		return 1 + sizeof(uint64_t);
+	}
+	static char *encode(char *p, T_ v) {
+		uint64_t const x = static_cast<uint64_t>(v);
+		*p++ = LOG_ARG_UINT;
+		std::memcpy(p, &x, sizeof(x));
+		return p + sizeof(x);
+	}
+};
+
+/** 浮動小数点数 */
+template <typename T_> struct log_arg_traits<T_, typename std::enable_if<std::is_floating_point<T_>::value>::type> {
+	static std::size_t size(T_) {
+		return 1 + sizeof(double);
+	}
+	static char *encode(char *p, T_ v) {
+		double const x = static_cast<double>(v);
+		*p++ = LOG_ARG_DOUBLE;
+		std::memcpy(p, &x, sizeof(x));
+		return p + sizeof(x);
+	}
+};
+
+/** 文字列以外のポインタ */
+template <typename T_> struct log_arg_traits<T_, typename std::enable_if<
+		(std::is_pointer<T_>::value && !std::is_same<typename std::remove_cv<typename std::remove_pointer<T_>::type>::type, char>::value)
+		|| std::is_same<T_, std::nullptr_t>::value>::type> {
+	static std::size_t size(T_) {
+		return 1 + sizeof(uint64_t);
+	}
+	static char *encode(char *p, T_ v) {
+		uint64_t const x = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(static_cast<void const*>(v)));
+		*p++ = LOG_ARG_POINTER;
+		std::memcpy(p, &x, sizeof(x));
+		return p + sizeof(x);
+	}
+};
+
+/** 文字列（呼び出し元が解放しても良いように内容をコピーする） */
+template <typename T_> struct log_arg_traits<T_, typename std::enable_if<
+		std::is_pointer<T_>::value && std::is_same<typename std::remove_cv<typename std::remove_pointer<T_>::type>::type, char>::value>::type> {
+	static std::size_t size(T_ v) {
+		return 1 + sizeof(uint32_t) + (NULL == v ? sizeof("(null)") : std::strlen(v) + 1);
+	}
+	static char *encode(char *p, T_ v) {
+		char const *s = (NULL == v) ? "(null)" : v;
+		uint32_t const n = static_cast<uint32_t>(std::strlen(s) + 1);
+		*p++ = LOG_ARG_STRING;
+		std::memcpy(p, &n, sizeof(n));
+		p += sizeof(n);
+		std::memcpy(p, s, n);
+		return p + n;
+	}
+};
+
+/**
+ * 引数を詰めるのに必要なバイト数を求める
+ */
+inline std::size_t log_args_size()
+{
+	return 0;
+}
+
+/**
+ * 引数を詰めるのに必要なバイト数を求める
+ * @param first 先頭の引数
+ * @param rest 残りの引数
+ * @return 全ての引数を詰めるのに必要なバイト数を返す
+ */
+template <typename First_, typename... Rest_> std::size_t log_args_size(First_ first, Rest_... rest)
+{
+	return log_arg_traits<First_>::size(first) + log_args_size(rest...);
+}
+
+/**
+ * 引数をバイト列に詰める
+ */
+inline char *encode_log_args(char *p)
+{
+	return p;
+}
+
+/**
+ * 引数をバイト列に詰める
+ * @param p 書き込み先（log_args_sizeで求めた大きさ以上の領域が必要）
+ * @param first 先頭の引数
+ * @param rest 残りの引数
+ * @return 書き込んだ領域の終端を返す
+ */
+template <typename First_, typename... Rest_> char *encode_log_args(char *p, First_ first, Rest_... rest)
+{
+	return encode_log_args(log_arg_traits<First_>::encode(p, first), rest...);
+}
+
+void format_log_record(std::string &out, char const *fmt, char const *args, std::size_t size);
+
+HUMANITY_NS_END
+
+#endif // end of HUMANITY_LOG_RECORD_H
@@ -7,7 +7,12 @@
 
 #include <humanity/humanity.hpp>
 #include <humanity/utils.hpp>
+#include <cstddef>
+#include <limits>
+#include <mutex>
 #include <new>
+#include <string>
+#include <utility>
 
 HUMANITY_NS_BEGIN
 
@@ -55,8 +60,18 @@ public:
      */
     explicit auto_ptr(T_ *ptr) : ptr_(ptr) {
     }
+    /** ムーブコンストラクタ */
+    auto_ptr(auto_ptr &&src) noexcept : ptr_(src.release()) {
+    }
     ~auto_ptr() {
-        checked_delete<T_>(ptr_);
+        checked_delete<T_>()(ptr_);
+    }
+    /** ムーブ代入演算子 */
+    auto_ptr &operator = (auto_ptr &&r) noexcept {
+        if (&r != this) {
+            reset(r.release());
+        }
+        return *this;
     }
     /** 等値比較演算子の実装 */
     friend bool operator == (T_ const * const l, auto_ptr<T_> const &r) {
@@ -143,10 +158,20 @@ public:
 	 * @param deleter リソースを削除するためのオブジェクト・関数ポインタなど
 	 */
 	unique_ptr(pointer ptr, Del_ deleter) : ptr_(ptr), deleter_(deleter) {}
+	/** ムーブコンストラクタ */
+	unique_ptr(unique_ptr &&src) noexcept : ptr_(src.release()), deleter_(std::move(src.deleter_)) {}
 	~unique_ptr() {
 		if (ptr_)
 			deleter_(ptr_);
 	}
+	/** ムーブ代入演算子 */
+	unique_ptr &operator = (unique_ptr &&r) noexcept {
+		if (&r != this) {
+			reset(r.release());
+			deleter_ = std::move(r.deleter_);
+		}
+		return *this;
+	}
     /** !演算子の実装 */
     bool operator !() const {
         return !ptr_;
@@ -177,11 +202,14 @@ public:
     }
     /** 所持しているリソースを放棄する。 */
     pointer release() const {
-        return ptr_;
+        pointer ret = ptr_;
+        ptr_ = pointer();
+        return ret;
     }
     /** 新しいリソースを設定する。<br/>古いリソースは自動的に解放される。 */
     void reset(pointer ptr = pointer()) {
-		deleter_(ptr_);
+		if (ptr_)
+			deleter_(ptr_);
         ptr_ = ptr;
     }
 	/** 削除子を取得する。 */
@@ -223,6 +251,323 @@ template <typename T_, typename D1_, typename D2_> bool operator >= (unique_ptr<
 }
 
 
+/**
+ * 確保した領域を個別には解放せず、まとめて解放するアリーナ。<br/>
+ * ブロック単位で確保した領域をポインタを進めるだけで切り出すため、一回の確保は数命令で終わる。
+ * 切り出した領域は release を呼び出すかアリーナを破棄した時にまとめて解放され、
+ * 中に構築したオブジェクトのデストラクタは呼び出されない。
+ * 一つのインスタンスを複数のスレッドから同時に使うことはできないが、
+ * 上位のアリーナを指定して構築すると、ブロックを上位のアリーナから排他的に受け取るため、
+ * スレッドごとのアリーナで確保した領域を上位のアリーナの解放だけでまとめて解放できる。
+ */
+class monotonic_arena : private non_copyable<monotonic_arena> {
+public:
+	enum {
+		/** ブロックの大きさの既定値 */
+		BLOCK_SIZE_DEFAULT = 64 * 1024,
+		/** アラインメントを指定しない場合の境界 */
+		ALIGNMENT_DEFAULT  = 2 * sizeof(void*),
+	};
+
+	explicit monotonic_arena(std::size_t block_size = BLOCK_SIZE_DEFAULT);
+	explicit monotonic_arena(monotonic_arena *upstream, std::size_t block_size = BLOCK_SIZE_DEFAULT);
+	~monotonic_arena();
+
+	/**
+	 * 領域を切り出す
+	 * @param n 領域の大きさ（バイト単位）
+	 * @param alignment 領域の境界（2の冪）
+	 * @return 切り出した領域の先頭を返す
+	 */
+	void *allocate(std::size_t n, std::size_t alignment = ALIGNMENT_DEFAULT) {
+		std::size_t const pad = (alignment - (reinterpret_cast<std::size_t>(cur_) & (alignment - 1))) & (alignment - 1);
+		if ((static_cast<std::size_t>(end_ - cur_) < pad) || (static_cast<std::size_t>(end_ - cur_) - pad < n)) {
+			return allocate_slow(n, alignment);
+		}
+		char *ret = cur_ + pad;
+		cur_ = ret + n;
+		return ret;
+	}
+	/** 何もしない（領域はアリーナの解放時にまとめて解放される） */
+	void deallocate(void *ptr, std::size_t n) {
+		(void)ptr;
+		(void)n;
+	}
+
+	/**
+	 * 領域を切り出してオブジェクトを構築する。<br/>
+	 * デストラクタが必要な場合は arena_delete を使うか、明示的に呼び出すこと。
+	 * @param args コンストラクタに渡す引数
+	 * @return 構築したオブジェクトへのポインタを返す
+	 */
+	template <typename T_, typename... Args_> T_ *create(Args_&&... args) {
+		return new (allocate(sizeof(T_), alignof(T_))) T_(std::forward<Args_>(args)...);
+	}
+
+	/**
+	 * 文字列をコピーする
+	 * @param str コピーする文字列
+	 * @param n コピーする文字列の長さ
+	 * @return コピーしたNULL終端の文字列を返す
+	 */
+	char *duplicate(char const *str, std::size_t n) {
+		char *ret = static_cast<char*>(allocate(n + 1, 1));
+		std::char_traits<char>::copy(ret, str, n);
+		ret[n] = '\0';
+		return ret;
+	}
+
+	void release();
+	std::size_t memory_usage() const;
+
+private:
+	/** ブロックの先頭に置く管理情報 */
+	struct block {
+		block *next_;
+		std::size_t size_;
+	};
+
+	void *allocate_slow(std::size_t n, std::size_t alignment);
+	void *allocate_block(std::size_t n);
+
+	/** 自身で確保したブロックのリスト */
+	block *blocks_;
+	/** 切り出していない領域の先頭 */
+	char *cur_;
+	/** 切り出していない領域の終端 */
+	char *end_;
+	/** 新しく確保するブロックの大きさ */
+	std::size_t block_size_;
+	/** 確保したブロックの大きさの合計 */
+	std::size_t usage_;
+	/** ブロックを受け取る上位のアリーナ（NULLの場合は自身で確保する） */
+	monotonic_arena *upstream_;
+	/** 下位のアリーナへブロックを渡す処理を排他するためのミューテックス */
+	std::mutex mutex_;
+};
+
+/**
+ * 同じ大きさのブロックを再利用するスレッドローカルなプール。<br/>
+ * 解放されたブロックはスレッドごとのリストに戻され、同じスレッドの次の確保で使われるため、
+ * 生成と破棄を繰り返すオブジェクトの確保でmallocのロックを取らずに済む。
+ * 別のスレッドで解放したブロックはそのスレッドのリストに入る。
+ * リストに保持するブロックの数はMaxCached_までで、それを超えた分とスレッドの終了時に残っている分はoperator deleteで解放する。
+ */
+template <std::size_t Size_, std::size_t MaxCached_ = 64> class fixed_pool {
+public:
+	enum {
+		/** ブロックの大きさ */
+		BLOCK_SIZE = (Size_ < sizeof(void*)) ? sizeof(void*) : Size_,
+		/** スレッドごとに保持するブロックの数の上限 */
+		MAX_CACHED = MaxCached_,
+	};
+
+	/**
+	 * ブロックを確保する
+	 * @return BLOCK_SIZEバイトのブロックを返す
+	 */
+	static void *allocate() {
+		cache &c = local();
+		if (NULL == c.head_) {
+			return ::operator new(BLOCK_SIZE);
+		}
+		node *ret = c.head_;
+		c.head_ = ret->next_;
+		--c.count_;
+		return ret;
+	}
+
+	/**
+	 * ブロックを解放する
+	 * @param ptr allocateで確保したブロック（NULLの場合は何もしない）
+	 */
+	static void deallocate(void *ptr) {
+		if (NULL == ptr) {
+			return;
+		}
+		cache &c = local();
+		if (c.count_ >= MAX_CACHED) {
+			::operator delete(ptr);
+			return;
+		}
+		node *n = static_cast<node*>(ptr);
+		n->next_ = c.head_;
+		c.head_ = n;
+		++c.count_;
+	}
+
+private:
+	struct node {
+		node *next_;
+	};
+	/** スレッドごとの解放済みブロックのリスト */
+	struct cache {
+		node *head_;
+		std::size_t count_;
+
+		cache() : head_(NULL), count_(0) {}
+		~cache() {
+			while (NULL != head_) {
+				node *n = head_;
+				head_ = n->next_;
+				::operator delete(n);
+			}
+		}
+	};
+
+	static cache &local() {
+		static thread_local cache c;
+		return c;
+	}
+};
+
+/**
+ * monotonic_arena から領域を確保するSTL互換のアロケータ。<br/>
+ * deallocateは何もせず、領域はアリーナの解放時にまとめて解放される。
+ */
+template <typename T_> class arena_allocator {
+	template <typename U_> friend class arena_allocator;
+public:
+	typedef T_ value_type;
+	typedef T_* pointer;
+	typedef T_ const* const_pointer;
+	typedef T_& reference;
+	typedef T_ const& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template <typename U_> struct rebind {
+		typedef arena_allocator<U_> other;
+	};
+
+	/**
+	 * アリーナを指定して構築するコンストラクタ
+	 * @param arena 領域を確保するアリーナ（アロケータを使うコンテナより長く存在すること）
+	 */
+	explicit arena_allocator(monotonic_arena &arena) : arena_(&arena) {}
+	/** 異なる型のアロケータから構築するコンストラクタ */
+	template <typename U_> arena_allocator(arena_allocator<U_> const &src) : arena_(src.arena_) {}
+
+	pointer allocate(size_type n, void const * = NULL) {
+		return static_cast<pointer>(arena_->allocate(n * sizeof(T_), alignof(T_)));
+	}
+	void deallocate(pointer ptr, size_type n) {
+		arena_->deallocate(ptr, n * sizeof(T_));
+	}
+
+	pointer address(reference r) const { return &r; }
+	const_pointer address(const_reference r) const { return &r; }
+	size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(T_); }
+	template <typename U_, typename... Args_> void construct(U_ *ptr, Args_&&... args) {
+		new (static_cast<void*>(ptr)) U_(std::forward<Args_>(args)...);
+	}
+	template <typename U_> void destroy(U_ *ptr) { ptr->~U_(); }
+
+	/** 等値比較演算子（同じアリーナを使うアロケータは等しい） */
+	template <typename U_> bool operator == (arena_allocator<U_> const &r) const { return arena_ == r.arena_; }
+	/** 等値比較演算子 */
+	template <typename U_> bool operator != (arena_allocator<U_> const &r) const { return arena_ != r.arena_; }
+
+private:
+	monotonic_arena *arena_;
+};
+
+/**
+ * 要素一つ分の確保を fixed_pool から行うSTL互換のアロケータ。<br/>
+ * std::listやstd::mapのように、ノードを一つずつ確保するコンテナで使う。
+ * 複数の要素を一度に確保する場合はoperator newを使う。
+ */
+template <typename T_> class pool_allocator {
+public:
+	typedef T_ value_type;
+	typedef T_* pointer;
+	typedef T_ const* const_pointer;
+	typedef T_& reference;
+	typedef T_ const& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template <typename U_> struct rebind {
+		typedef pool_allocator<U_> other;
+	};
+
+	pool_allocator() {}
+	/** 異なる型のアロケータから構築するコンストラクタ */
+	template <typename U_> pool_allocator(pool_allocator<U_> const &) {}
+
+	pointer allocate(size_type n, void const * = NULL) {
+		if (1 == n) {
+			return static_cast<pointer>(fixed_pool<sizeof(T_)>::allocate());
+		}
+		return static_cast<pointer>(::operator new(n * sizeof(T_)));
+	}
+	void deallocate(pointer ptr, size_type n) {
+		if (1 == n) {
+			fixed_pool<sizeof(T_)>::deallocate(ptr);
+		} else {
+			::operator delete(ptr);
+		}
+	}
+
+	pointer address(reference r) const { return &r; }
+	const_pointer address(const_reference r) const { return &r; }
+	size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(T_); }
+	template <typename U_, typename... Args_> void construct(U_ *ptr, Args_&&... args) {
+		new (static_cast<void*>(ptr)) U_(std::forward<Args_>(args)...);
+	}
+	template <typename U_> void destroy(U_ *ptr) { ptr->~U_(); }
+
+	/** 等値比較演算子（プールは型ごとに共通なので常に等しい） */
+	template <typename U_> bool operator == (pool_allocator<U_> const &) const { return true; }
+	/** 等値比較演算子 */
+	template <typename U_> bool operator != (pool_allocator<U_> const &) const { return false; }
+};
+
+/**
+ * monotonic_arena::create で構築したオブジェクトのデストラクタを呼び出す関数オブジェクト。<br/>
+ * unique_ptrの削除子として使う。領域はアリーナの解放時にまとめて解放される。
+ */
+template <typename T_> struct arena_delete {
+	void operator () (T_ *ptr) const {
+		if (ptr) ptr->~T_();
+	}
+};
+
+/**
+ * pool_create で構築したオブジェクトを破棄して、ブロックをプールに戻す関数オブジェクト。<br/>
+ * unique_ptrの削除子として使う。
+ */
+template <typename T_> struct pool_delete {
+	void operator () (T_ *ptr) const {
+		if (ptr) {
+			ptr->~T_();
+			fixed_pool<sizeof(T_)>::deallocate(ptr);
+		}
+	}
+};
+
+/**
+ * fixed_pool から確保した領域にオブジェクトを構築する。<br/>
+ * 破棄には pool_delete を使うこと。
+ * @param args コンストラクタに渡す引数
+ * @return 構築したオブジェクトへのポインタを返す
+ */
+template <typename T_, typename... Args_> T_ *pool_create(Args_&&... args)
+{
+	static_assert(alignof(T_) <= monotonic_arena::ALIGNMENT_DEFAULT, "over-aligned type is not supported");
+	void *ptr = fixed_pool<sizeof(T_)>::allocate();
+#if defined(HUMANITY_ENABLE_EXCEPTIONS)
+	try {
+		return new (ptr) T_(std::forward<Args_>(args)...);
+	} catch (...) {
+		fixed_pool<sizeof(T_)>::deallocate(ptr);
+		throw;
+	}
+#else
+	return new (ptr) T_(std::forward<Args_>(args)...);
+#endif
+}
+
 HUMANITY_NS_END
 
 #endif // end of HUMANITY_MEMORY_H
@@ -7,7 +7,10 @@
 #define HUMANITY_STRING_UTILS_H
 
 #include <humanity/humanity.hpp>
+#include <humanity/string_view.hpp>
+#include <cstddef>
 #include <string>
+#include <vector>
 
 HUMANITY_NS_BEGIN
 
@@ -16,11 +19,81 @@ HUMANITY_NS_BEGIN
  */
 class string_utils {
 public:
-	static bool ends_with(std::string const &target, std::string const &suffix);
-	static bool starts_with(std::string const &target, std::string const &prefix);
+	static bool ends_with(string_view target, string_view suffix);
+	static bool starts_with(string_view target, string_view prefix);
+};
+
+/**
+ * 複数の接頭辞・接尾辞とまとめて照合するためのクラス。<br/>
+ * 登録したパターンから木（接尾辞は末尾から並べた木）を構築しておき、
+ * 対象の文字列を一度たどるだけで全てのパターンと照合する。照合時に領域は確保しない。
+ * string_utils::starts_with / ends_with と同様に、空のパターンはどの文字列にも一致しない。
+ * 照合は複数のスレッドから同時に行えるが、パターンの追加中は照合できない。
+ */
+class string_matcher {
+public:
+	/** 一致するパターンが無いことを表す値 */
+	static std::size_t const npos = static_cast<std::size_t>(-1);
+
+	string_matcher();
+	~string_matcher();
+
+	void add_prefix(string_view prefix);
+	void add_suffix(string_view suffix);
+	void clear();
+
+	/** パターンが一つも登録されていないかどうかを判定する */
+	bool empty() const { return prefixes_.empty() && suffixes_.empty(); }
+
+	std::size_t find_prefix(string_view target) const;
+	std::size_t find_suffix(string_view target) const;
+
+	/** いずれかの接頭辞で開始しているかどうかを判定する */
+	bool starts_with_any(string_view target) const { return npos != find_prefix(target); }
+	/** いずれかの接尾辞で終了しているかどうかを判定する */
+	bool ends_with_any(string_view target) const { return npos != find_suffix(target); }
+	/** いずれかの接頭辞で開始しているか、いずれかの接尾辞で終了しているかを判定する */
+	bool matches(string_view target) const { return starts_with_any(target) || ends_with_any(target); }
+
+private:
+	/**
+	 * パターンの木の節点。<br/>
+	 * 子への辺は edges_ の [first_edge_, first_edge_ + edge_count_) に文字の順で並ぶ。
+	 */
+	struct node {
+		uint32_t first_edge_;
+		uint32_t edge_count_;
+		/** この節点で終わるパターンの番号（無い場合はnpos） */
+		std::size_t pattern_;
+	};
+
+	/** 節点間の辺 */
+	struct edge {
+		unsigned char c_;
+		uint32_t child_;
+	};
+
+	/**
+	 * 照合用の木。<br/>
+	 * 根からの最初の一文字は表で引き、以降は辺を二分探索する。
+	 */
+	struct trie {
+		/** 根の子（1文字目で引く、無い場合は0） */
+		uint32_t root_[256];
+		std::vector<node> nodes_;
+		std::vector<edge> edges_;
+
+		trie();
+		void build(std::vector<std::string> const &patterns, bool reverse);
+		uint32_t child(uint32_t n, unsigned char c) const;
+	};
+
+	std::vector<std::string> prefixes_;
+	std::vector<std::string> suffixes_;
+	trie prefix_trie_;
+	trie suffix_trie_;
 };
 
 HUMANITY_NS_END
 
 #endif // end of HUMANITY_STRING_UTILS_H
-
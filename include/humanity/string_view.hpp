@@ -0,0 +1,179 @@
+/**
+ * 文字列の一部を所有せずに参照するためのクラスの定義ファイル
+ * @file string_view.hpp
+ */
+
+#ifndef HUMANITY_STRING_VIEW_H
+#define HUMANITY_STRING_VIEW_H
+
+#include <humanity/humanity.hpp>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * 文字列の一部を所有せずに参照するためのテンプレートクラス。<br/>
+ * 基本的にはC++17の std::basic_string_view の模倣。
+ * 参照先の文字列はこのクラスのインスタンスより長く生存している必要がある。
+ */
+template <typename Char_, typename Traits_ = std::char_traits<Char_> > class basic_string_view {
+public:
+	/** 文字の型 */
+	typedef Char_ value_type;
+	/** 文字の特性を表す型 */
+	typedef Traits_ traits_type;
+	/** サイズの型 */
+	typedef std::size_t size_type;
+	/** 変更不可能なポインタ型 */
+	typedef Char_ const* const_pointer;
+	/** 変更不可能な参照型 */
+	typedef Char_ const& const_reference;
+	/** 変更不可能なイテレータ型 */
+	typedef Char_ const* const_iterator;
+	/** イテレータ型（文字列は変更できない） */
+	typedef const_iterator iterator;
+
+	/** 文字が見つからなかったことを表す値 */
+	static size_type const npos = static_cast<size_type>(-1);
+
+	basic_string_view() : data_(NULL), size_(0) {}
+	/** NUL終端された文字列を参照して構築するコンストラクタ */
+	basic_string_view(Char_ const *s) : data_(s), size_(Traits_::length(s)) {}
+	/** 文字列の先頭と長さを指定して構築するコンストラクタ */
+	basic_string_view(Char_ const *s, size_type n) : data_(s), size_(n) {}
+	/** std::basic_stringを参照して構築するコンストラクタ */
+	template <typename Alloc_> basic_string_view(std::basic_string<Char_, Traits_, Alloc_> const &s)
+		: data_(s.data()), size_(s.size())
+	{
+	}
+
+	/** 参照している文字列の先頭を取得する（NUL終端されているとは限らない） */
+	const_pointer data() const { return data_; }
+	/** 文字列の長さを取得する */
+	size_type size() const { return size_; }
+	/** 文字列の長さを取得する */
+	size_type length() const { return size_; }
+	/** 文字列が空かどうかを判定する */
+	bool empty() const { return 0 == size_; }
+
+	/** 先頭を指すイテレータを取得する */
+	const_iterator begin() const { return data_; }
+	/** 終端を指すイテレータを取得する */
+	const_iterator end() const { return data_ + size_; }
+
+	/** []演算子（範囲外の位置を指定した場合の動作は未定義） */
+	const_reference operator [] (size_type pos) const { return data_[pos]; }
+	/** 先頭の文字を取得する */
+	const_reference front() const { return data_[0]; }
+	/** 末尾の文字を取得する */
+	const_reference back() const { return data_[size_ - 1]; }
+
+	/** 先頭からn文字を取り除く */
+	void remove_prefix(size_type n) { data_ += n; size_ -= n; }
+	/** 末尾からn文字を取り除く */
+	void remove_suffix(size_type n) { size_ -= n; }
+
+	/**
+	 * 部分文字列を取得する（posが長さを超える場合は空の文字列を返す）
+	 * @param pos 部分文字列の開始位置
+	 * @param n 部分文字列の長さ
+	 */
+	basic_string_view substr(size_type pos, size_type n = npos) const {
+		if (pos > size_) {
+			pos = size_;
+		}
+		size_type const rest = size_ - pos;
+		return basic_string_view(data_ + pos, n < rest ? n : rest);
+	}
+
+	/**
+	 * 辞書順で比較する
+	 * @return 自身が小さければ負の値、等しければ0、大きければ正の値を返す
+	 */
+	int compare(basic_string_view const &r) const {
+		size_type const n = size_ < r.size_ ? size_ : r.size_;
+		int const ret = (0 == n) ? 0 : Traits_::compare(data_, r.data_, n);
+		if (0 != ret) {
+			return ret;
+		}
+		return size_ == r.size_ ? 0 : (size_ < r.size_ ? -1 : 1);
+	}
+
+	/** 指定した文字列で始まっているかどうかを判定する */
+	bool starts_with(basic_string_view const &prefix) const {
+		return (size_ >= prefix.size_) && (0 == prefix.size_ || 0 == Traits_::compare(data_, prefix.data_, prefix.size_));
+	}
+	/** 指定した文字列で終わっているかどうかを判定する */
+	bool ends_with(basic_string_view const &suffix) const {
+		return (size_ >= suffix.size_) && (0 == suffix.size_ || 0 == Traits_::compare(data_ + size_ - suffix.size_, suffix.data_, suffix.size_));
+	}
+
+	/** pos以降で最初に文字cが現れる位置を取得する（見つからなければnposを返す） */
+	size_type find(Char_ c, size_type pos = 0) const {
+		if (pos >= size_) {
+			return npos;
+		}
+		Char_ const *p = Traits_::find(data_ + pos, size_ - pos, c);
+		return NULL == p ? npos : static_cast<size_type>(p - data_);
+	}
+	/** pos以前で最後に文字cが現れる位置を取得する（見つからなければnposを返す） */
+	size_type rfind(Char_ c, size_type pos = npos) const {
+		if (0 == size_) {
+			return npos;
+		}
+		size_type i = (pos < size_) ? pos + 1 : size_;
+		while (0 < i) {
+			--i;
+			if (Traits_::eq(data_[i], c)) {
+				return i;
+			}
+		}
+		return npos;
+	}
+
+	/** 参照している文字列をコピーしたstd::basic_stringを取得する */
+	std::basic_string<Char_, Traits_> str() const {
+		return std::basic_string<Char_, Traits_>(data_, size_);
+	}
+
+	/** 等値比較演算子の実装 */
+	friend bool operator == (basic_string_view const &l, basic_string_view const &r) {
+		return (l.size_ == r.size_) && (0 == l.size_ || 0 == Traits_::compare(l.data_, r.data_, l.size_));
+	}
+	/** 等値比較演算子の実装 */
+	friend bool operator != (basic_string_view const &l, basic_string_view const &r) {
+		return !(l == r);
+	}
+	/** 比較演算子の実装 */
+	friend bool operator < (basic_string_view const &l, basic_string_view const &r) {
+		return 0 > l.compare(r);
+	}
+	/** 比較演算子の実装 */
+	friend bool operator > (basic_string_view const &l, basic_string_view const &r) {
+		return 0 < l.compare(r);
+	}
+	/** 比較演算子の実装 */
+	friend bool operator <= (basic_string_view const &l, basic_string_view const &r) {
+		return 0 >= l.compare(r);
+	}
+	/** 比較演算子の実装 */
+	friend bool operator >= (basic_string_view const &l, basic_string_view const &r) {
+		return 0 <= l.compare(r);
+	}
+
+private:
+	Char_ const *data_;
+	size_type size_;
+};
+
+template <typename Char_, typename Traits_>
+typename basic_string_view<Char_, Traits_>::size_type const basic_string_view<Char_, Traits_>::npos;
+
+/** char型の文字列を参照するためのクラス */
+typedef basic_string_view<char> string_view;
+
+HUMANITY_NS_END
+
+#endif // end of HUMANITY_STRING_VIEW_H
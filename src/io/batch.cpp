@@ -0,0 +1,601 @@
+#include <humanity/io/batch.hpp>
+#include <humanity/io/path.hpp>
+#include <humanity/io/stat_cache.hpp>
+#include "work_stealing_pool.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(__ANDROID__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    if defined(IORING_FEAT_CQE_SKIP)
+/** io_uringを使って操作を一括投入する設定（Androidのアプリはseccompでio_uringが禁止されているため使わない） */
+#      define HUMANITY_IO_USE_URING
+#      include <sys/mman.h>
+#      include <sys/syscall.h>
+#    endif
+#  endif
+#endif
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * 溜めておく操作の種類
+ */
+enum batch_op_type {
+	BATCH_OP_IS_EXIST,
+	BATCH_OP_CHMOD,
+	BATCH_OP_REMOVE,
+	BATCH_OP_RENAME,
+	BATCH_OP_MKDIR,
+};
+
+/**
+ * 溜めておく一つの操作
+ */
+struct batch_op {
+	/** 操作の種類 */
+	batch_op_type type_;
+	/** 操作対象のパス */
+	path path_;
+	/** リネーム後のパス */
+	std::string dst_;
+	/** 変更後のモード */
+	uint16_t mode_;
+	/** 完了を通知するコールバック */
+	batch::callback_type callback_;
+	/** 操作の結果（成功した場合は0、失敗した場合はerrnoの値） */
+	int error_;
+	/** 完了を通知したかどうか */
+	bool completed_;
+
+	batch_op(batch_op_type type, path const &p, batch::callback_type const &callback)
+		: type_(type), path_(p), dst_(), mode_(0), callback_(callback), error_(0), completed_(false)
+	{
+	}
+};
+
+/**
+ * 操作の結果を file や directory の同名の関数と同じ意味に揃える
+ */
+static int adjust_result(batch_op const &op, int err)
+{
+	if ((BATCH_OP_MKDIR == op.type_) && (EEXIST == err)) {
+		return 0;
+	}
+	return err;
+}
+
+/**
+ * 操作によって変わった可能性のあるパスをstat_cacheから破棄する
+ */
+static void invalidate_cache(batch_op const &op)
+{
+	if (!stat_cache::is_enabled()) {
+		return;
+	}
+	switch (op.type_) {
+	case BATCH_OP_CHMOD:
+	case BATCH_OP_REMOVE:
+	case BATCH_OP_MKDIR:
+		stat_cache::invalidate(op.path_);
+		break;
+	case BATCH_OP_RENAME:
+		stat_cache::invalidate_rename(op.path_, path(op.dst_));
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * 操作をその場でシステムコールを使って実行する
+ * @return 成功した場合は0、失敗した場合はerrnoの値を返す
+ */
+static int run_sync(batch_op const &op)
+{
+	int ret = -1;
+	switch (op.type_) {
+	case BATCH_OP_IS_EXIST:
+		{
+			struct stat s;
+			ret = ::lstat(op.path_.full_path(), &s);
+		}
+		break;
+	case BATCH_OP_CHMOD:
+		ret = ::chmod(op.path_.full_path(), static_cast<mode_t>(op.mode_));
+		break;
+	case BATCH_OP_REMOVE:
+		ret = std::remove(op.path_.full_path());
+		break;
+	case BATCH_OP_RENAME:
+		ret = std::rename(op.path_.full_path(), op.dst_.c_str());
+		break;
+	case BATCH_OP_MKDIR:
+		ret = ::mkdir(op.path_.full_path(), S_IRWXU);
+		break;
+	}
+	return adjust_result(op, 0 == ret ? 0 : errno);
+}
+
+#if defined(HUMANITY_IO_USE_URING)
+
+/**
+ * io_uringのリングを管理するクラス
+ */
+class uring : private non_copyable<uring> {
+public:
+	/** リングに同時に積む操作の数 */
+	enum { ENTRIES = 256 };
+
+	uring()
+		: fd_(-1), sq_ptr_(NULL), sq_size_(0), cq_ptr_(NULL), cq_size_(0), sqes_(NULL), sqes_size_(0),
+		  sq_head_(NULL), sq_tail_(NULL), sq_mask_(0), sq_array_(NULL),
+		  cq_head_(NULL), cq_tail_(NULL), cq_mask_(0), cqes_(NULL), entries_(0)
+	{
+		std::memset(supported_, 0, sizeof(supported_));
+
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		int const fd = static_cast<int>(::syscall(__NR_io_uring_setup, ENTRIES, &params));
+		if (0 > fd) {
+			return;
+		}
+		fd_ = fd;
+
+		sq_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool const single_mmap = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+		if (single_mmap && (cq_size_ > sq_size_)) {
+			sq_size_ = cq_size_;
+		}
+		void *sq = ::mmap(NULL, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		if (MAP_FAILED == sq) {
+			return;
+		}
+		sq_ptr_ = sq;
+		if (single_mmap) {
+			cq_ptr_ = sq_ptr_;
+		} else {
+			void *cq = ::mmap(NULL, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+			if (MAP_FAILED == cq) {
+				return;
+			}
+			cq_ptr_ = cq;
+		}
+		sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+		void *sqes = ::mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+		if (MAP_FAILED == sqes) {
+			return;
+		}
+		sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+		char *sq_base = static_cast<char*>(sq_ptr_);
+		sq_head_  = reinterpret_cast<unsigned int*>(sq_base + params.sq_off.head);
+		sq_tail_  = reinterpret_cast<unsigned int*>(sq_base + params.sq_off.tail);
+		sq_mask_  = *reinterpret_cast<unsigned int*>(sq_base + params.sq_off.ring_mask);
+		sq_array_ = reinterpret_cast<unsigned int*>(sq_base + params.sq_off.array);
+		char *cq_base = static_cast<char*>(cq_ptr_);
+		cq_head_  = reinterpret_cast<unsigned int*>(cq_base + params.cq_off.head);
+		cq_tail_  = reinterpret_cast<unsigned int*>(cq_base + params.cq_off.tail);
+		cq_mask_  = *reinterpret_cast<unsigned int*>(cq_base + params.cq_off.ring_mask);
+		cqes_     = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+		entries_  = params.sq_entries;
+
+		probe();
+	}
+
+	~uring() {
+		if (NULL != sqes_) {
+			::munmap(sqes_, sqes_size_);
+		}
+		if ((NULL != cq_ptr_) && (cq_ptr_ != sq_ptr_)) {
+			::munmap(cq_ptr_, cq_size_);
+		}
+		if (NULL != sq_ptr_) {
+			::munmap(sq_ptr_, sq_size_);
+		}
+		if (0 <= fd_) {
+			::close(fd_);
+		}
+	}
+
+	/** リングが利用可能かどうかを判定する */
+	bool is_valid() const {
+		return NULL != cqes_;
+	}
+
+	/** 操作をio_uringで実行できるかどうかを判定する */
+	bool is_supported(batch_op_type type) const {
+		return supported_[type];
+	}
+
+	/**
+	 * io_uringで実行できる操作をまとめて実行し、完了したものからコールバックを呼び出す
+	 * @param ops 全ての操作
+	 * @param targets io_uringで実行する操作のインデックス
+	 * @return 失敗した操作の数
+	 */
+	std::size_t run(std::vector<batch_op> &ops, std::vector<std::size_t> const &targets) {
+		std::size_t failed = 0;
+		std::size_t next = 0;
+		std::size_t inflight = 0;
+		unsigned int unsubmitted = 0;
+
+		while ((next < targets.size()) || (0 < inflight)) {
+			unsigned int tail = *sq_tail_;
+			while ((next < targets.size()) && (inflight < entries_)) {
+				std::size_t const index = targets[next++];
+				unsigned int const slot = tail & sq_mask_;
+				prepare(sqes_[slot], ops[index], index);
+				sq_array_[slot] = slot;
+				++tail;
+				++inflight;
+				++unsubmitted;
+			}
+			__atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+			int const r = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0));
+			if (0 <= r) {
+				unsubmitted -= static_cast<unsigned int>(r);
+			} else if ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno)) {
+				int const err = errno;
+				// カーネルが受け取らなかった操作はリングから取り除き、まだ積んでいない操作と一緒にその場で実行する
+				unsigned int const head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+				for (unsigned int i = head; i != tail; ++i) {
+					batch_op &op = ops[static_cast<std::size_t>(sqes_[sq_array_[i & sq_mask_]].user_data)];
+					failed += complete(op, run_sync(op));
+					--inflight;
+				}
+				__atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+				for (std::size_t i = next; i < targets.size(); ++i) {
+					failed += complete(ops[targets[i]], run_sync(ops[targets[i]]));
+				}
+				// カーネルが受け取った操作の完了を待ち、待てなくなった場合はエラーとして通知する
+				if (!drain(ops, inflight, failed)) {
+					for (std::size_t i = 0; i < next; ++i) {
+						if (!ops[targets[i]].completed_) {
+							failed += complete(ops[targets[i]], err);
+						}
+					}
+				}
+				break;
+			}
+
+			failed += reap(ops, inflight);
+		}
+		return failed;
+	}
+
+private:
+	void probe() {
+		std::size_t const size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+		std::vector<char> buf(size, 0);
+		io_uring_probe *p = reinterpret_cast<io_uring_probe*>(&buf[0]);
+		if (0 > ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, p, 256)) {
+			return;
+		}
+		supported_[BATCH_OP_IS_EXIST] = is_op_supported(p, IORING_OP_STATX);
+		supported_[BATCH_OP_REMOVE]   = is_op_supported(p, IORING_OP_UNLINKAT);
+		supported_[BATCH_OP_RENAME]   = is_op_supported(p, IORING_OP_RENAMEAT);
+		supported_[BATCH_OP_MKDIR]    = is_op_supported(p, IORING_OP_MKDIRAT);
+	}
+
+	static bool is_op_supported(io_uring_probe const *p, unsigned int op) {
+		return (op <= p->last_op) && (0 != (p->ops[op].flags & IO_URING_OP_SUPPORTED));
+	}
+
+	void prepare(io_uring_sqe &sqe, batch_op const &op, std::size_t index) {
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.fd = AT_FDCWD;
+		sqe.addr = reinterpret_cast<uintptr_t>(op.path_.full_path());
+		sqe.user_data = index;
+		switch (op.type_) {
+		case BATCH_OP_IS_EXIST:
+			// 結果の内容は使わないので、全てのSTATXで同じ領域を共有する
+			sqe.opcode = IORING_OP_STATX;
+			sqe.len = 0x00000001U; // STATX_TYPE
+			sqe.off = reinterpret_cast<uintptr_t>(statx_buf_);
+			sqe.rw_flags = AT_SYMLINK_NOFOLLOW;
+			break;
+		case BATCH_OP_REMOVE:
+			sqe.opcode = IORING_OP_UNLINKAT;
+			break;
+		case BATCH_OP_RENAME:
+			sqe.opcode = IORING_OP_RENAMEAT;
+			sqe.len = static_cast<uint32_t>(AT_FDCWD);
+			sqe.off = reinterpret_cast<uintptr_t>(op.dst_.c_str());
+			break;
+		case BATCH_OP_MKDIR:
+			sqe.opcode = IORING_OP_MKDIRAT;
+			sqe.len = S_IRWXU;
+			break;
+		default:
+			sqe.opcode = IORING_OP_NOP;
+			break;
+		}
+	}
+
+	std::size_t reap(std::vector<batch_op> &ops, std::size_t &inflight) {
+		std::size_t failed = 0;
+		unsigned int head = *cq_head_;
+		unsigned int const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			io_uring_cqe const &cqe = cqes_[head & cq_mask_];
+			batch_op &op = ops[static_cast<std::size_t>(cqe.user_data)];
+			int err = (0 > cqe.res) ? -cqe.res : 0;
+			if ((BATCH_OP_REMOVE == op.type_) && (EISDIR == err)) {
+				// std::removeと同様に、ディレクトリであればrmdirで削除する
+				err = (0 == ::rmdir(op.path_.full_path())) ? 0 : errno;
+			}
+			failed += complete(op, adjust_result(op, err));
+			--inflight;
+		}
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		return failed;
+	}
+
+	/**
+	 * 投入済みの操作が全て完了するまで待つ
+	 * @param ops 全ての操作
+	 * @param inflight 完了を待っている操作の数
+	 * @param failed 失敗した操作の数を加える変数
+	 * @return 全て完了した場合はtrue、完了を待てなくなった場合はfalseを返す
+	 */
+	bool drain(std::vector<batch_op> &ops, std::size_t &inflight, std::size_t &failed) {
+		while (0 < inflight) {
+			if (0 > ::syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0)) {
+				if ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno)) {
+					failed += reap(ops, inflight);
+					return 0 == inflight;
+				}
+			}
+			failed += reap(ops, inflight);
+		}
+		return true;
+	}
+
+	static std::size_t complete(batch_op &op, int err) {
+		op.completed_ = true;
+		op.error_ = err;
+		invalidate_cache(op);
+		if (op.callback_) {
+			op.callback_(op.path_, err);
+		}
+		return 0 == err ? 0 : 1;
+	}
+
+	int fd_;
+	void *sq_ptr_;
+	std::size_t sq_size_;
+	void *cq_ptr_;
+	std::size_t cq_size_;
+	io_uring_sqe *sqes_;
+	std::size_t sqes_size_;
+	unsigned int *sq_head_;
+	unsigned int *sq_tail_;
+	unsigned int sq_mask_;
+	unsigned int *sq_array_;
+	unsigned int *cq_head_;
+	unsigned int *cq_tail_;
+	unsigned int cq_mask_;
+	io_uring_cqe *cqes_;
+	unsigned int entries_;
+	bool supported_[BATCH_OP_MKDIR + 1];
+	/** STATXの結果を受け取る領域（struct statxと同じ大きさ） */
+	uint64_t statx_buf_[32];
+};
+
+#endif // end of HUMANITY_IO_USE_URING
+
+/**
+ * バッチ処理の内部実装用データ構造
+ */
+struct batch::impl {
+	/** スレッドプールで実行する場合のスレッド数 */
+	unsigned int workers_;
+	/** 操作を実行する方式 */
+	backend_type backend_;
+	/** 溜めている操作 */
+	std::vector<batch_op> ops_;
+	/** io_uringで実行できない操作を実行するスレッドプール（最初に必要になった時に作り、submitをまたいで使い回す） */
+	auto_ptr< work_stealing_pool<std::size_t> > pool_;
+#if defined(HUMANITY_IO_USE_URING)
+	/** io_uringのリング */
+	auto_ptr<uring> ring_;
+#endif
+
+	impl(unsigned int workers, backend_type backend) : workers_(workers), backend_(BACKEND_THREADS), ops_(), pool_() {
+		if (0 == workers_) {
+			workers_ = std::thread::hardware_concurrency();
+		}
+		if (0 == workers_) {
+			workers_ = 1;
+		}
+#if defined(HUMANITY_IO_USE_URING)
+		if (BACKEND_THREADS != backend) {
+			ring_.reset(new uring());
+			if (ring_->is_valid()) {
+				backend_ = BACKEND_URING;
+			} else {
+				ring_.reset();
+			}
+		}
+#else
+		(void)backend;
+#endif
+	}
+};
+
+/**
+ * スレッド数を自動的に決め、利用可能であればio_uringを使うバッチを構築する
+ */
+batch::batch()
+	: pimpl(new impl(0, BACKEND_AUTO))
+{
+}
+
+/**
+ * スレッド数と実行方式を指定してバッチを構築する
+ * @param workers スレッドプールで実行する場合のスレッド数（0の場合はハードウェアの並列度を使う）
+ * @param backend 操作を実行する方式
+ */
+batch::batch(unsigned int workers, backend_type backend)
+	: pimpl(new impl(workers, backend))
+{
+}
+
+batch::~batch()
+{
+}
+
+/**
+ * ファイルが存在するかどうかの判定を追加する。<br/>
+ * コールバックには、存在する場合は0、存在しない場合はENOENTなどのエラーコードが渡される。
+ * @param path 判定対象のファイルのパス
+ * @param callback 完了を通知するコールバック
+ */
+void batch::is_exist(path const &path, callback_type const &callback)
+{
+	pimpl->ops_.push_back(batch_op(BATCH_OP_IS_EXIST, path, callback));
+}
+
+/**
+ * ファイルのモードの変更を追加する
+ * @param path モードを変更する対象のファイルのパス
+ * @param mode 変更後のモード（file::FMODE_*をビット和でまとめて指定する）
+ * @param callback 完了を通知するコールバック
+ */
+void batch::chmod(path const &path, uint16_t mode, callback_type const &callback)
+{
+	pimpl->ops_.push_back(batch_op(BATCH_OP_CHMOD, path, callback));
+	pimpl->ops_.back().mode_ = mode;
+}
+
+/**
+ * ファイルの削除を追加する。<br/>
+ * std::removeと同様に、空のディレクトリも削除できる。
+ * @param path 削除対象のファイルのパス
+ * @param callback 完了を通知するコールバック
+ */
+void batch::remove(path const &path, callback_type const &callback)
+{
+	pimpl->ops_.push_back(batch_op(BATCH_OP_REMOVE, path, callback));
+}
+
+/**
+ * ファイルの名前の変更を追加する
+ * @param src 変更前のファイルのパス
+ * @param dst 変更後のファイルのパス
+ * @param callback 完了を通知するコールバック（変更前のパスが渡される）
+ */
+void batch::rename(path const &src, path const &dst, callback_type const &callback)
+{
+	pimpl->ops_.push_back(batch_op(BATCH_OP_RENAME, src, callback));
+	pimpl->ops_.back().dst_.assign(dst.full_path(), dst.length());
+}
+
+/**
+ * ディレクトリの作成を追加する。<br/>
+ * 親ディレクトリは作成しない。既に存在する場合は成功として扱う。
+ * @param path 作成するディレクトリのパス
+ * @param callback 完了を通知するコールバック
+ */
+void batch::mkdir(path const &path, callback_type const &callback)
+{
+	pimpl->ops_.push_back(batch_op(BATCH_OP_MKDIR, path, callback));
+}
+
+/**
+ * 溜めている操作の数を取得する
+ * @return 溜めている操作の数
+ */
+std::size_t batch::size() const
+{
+	return pimpl->ops_.size();
+}
+
+/**
+ * 実際に使われる実行方式を取得する
+ * @return io_uringが利用できる場合はBACKEND_URING、そうでなければBACKEND_THREADSを返す
+ */
+batch::backend_type batch::backend() const
+{
+	return pimpl->backend_;
+}
+
+/**
+ * 溜めている操作を全て実行し、完了するまで待つ。<br/>
+ * コールバックはこの関数を呼び出したスレッドで呼び出される。
+ * 実行した操作は取り除かれるので、続けて新しい操作を追加できる。
+ * 操作間の実行順序は保証されない。
+ * @return 失敗した（コールバックに0以外が渡された）操作の数を返す
+ */
+std::size_t batch::submit()
+{
+	std::vector<batch_op> ops;
+	ops.swap(pimpl->ops_);
+
+	std::size_t failed = 0;
+	std::vector<std::size_t> sync_ops;
+	sync_ops.reserve(ops.size());
+#if defined(HUMANITY_IO_USE_URING)
+	if (pimpl->ring_.get()) {
+		std::vector<std::size_t> uring_ops;
+		uring_ops.reserve(ops.size());
+		for (std::size_t i = 0; i < ops.size(); ++i) {
+			if (pimpl->ring_->is_supported(ops[i].type_)) {
+				uring_ops.push_back(i);
+			} else {
+				sync_ops.push_back(i);
+			}
+		}
+		failed += pimpl->ring_->run(ops, uring_ops);
+	} else
+#endif
+	{
+		for (std::size_t i = 0; i < ops.size(); ++i) {
+			sync_ops.push_back(i);
+		}
+	}
+
+	// io_uringで実行できない操作はスレッドプールで実行し、結果を呼び出し元のスレッドで通知する
+	std::size_t const n = sync_ops.size();
+	if ((1 < n) && (1 < pimpl->workers_)) {
+		if (!pimpl->pool_) {
+			pimpl->pool_.reset(new work_stealing_pool<std::size_t>(pimpl->workers_));
+		}
+		work_stealing_pool<std::size_t> &pool = *pimpl->pool_;
+		for (std::size_t i = 0; i < n; ++i) {
+			pool.push(static_cast<unsigned int>(i % pool.workers()), sync_ops[i]);
+		}
+		pool.run([&ops](unsigned int, std::size_t &index) {
+			ops[index].error_ = run_sync(ops[index]);
+		});
+	} else {
+		for (std::size_t i = 0; i < n; ++i) {
+			batch_op &op = ops[sync_ops[i]];
+			op.error_ = run_sync(op);
+		}
+	}
+	for (std::size_t i = 0; i < n; ++i) {
+		batch_op &op = ops[sync_ops[i]];
+		invalidate_cache(op);
+		if (op.callback_) {
+			op.callback_(op.path_, op.error_);
+		}
+		if (0 != op.error_) {
+			++failed;
+		}
+	}
+	return failed;
+}
+
+HUMANITY_IO_NS_END
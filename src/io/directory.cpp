@@ -1,30 +1,138 @@
 #include <humanity/io/directory.hpp>
 #include <humanity/io/file.hpp>
 #include <humanity/io/path.hpp>
+#include <humanity/io/stat_cache.hpp>
 #include <humanity/exception.hpp>
 #include <humanity/log.hpp>
+#include "work_stealing_pool.hpp"
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <cstdlib>
 #include <climits>
 #include <cerrno>
+#include <cstddef>
+#include <algorithm>
 #include <stack>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+
+#if defined(__linux__)
+/** getdents64システムコールを使ってディレクトリを読み込む設定 */
+#  define HUMANITY_IO_USE_GETDENTS64
+#  include <sys/syscall.h>
+#endif
 
 HUMANITY_IO_NS_BEGIN
 
+#if defined(HUMANITY_IO_USE_GETDENTS64)
 /**
- * ディレクトリエントリの実装用内部データ構造
+ * getdents64で読み込まれるエントリのレイアウト
  */
-struct directory_entry::impl {
-	/** struct dirent型のインスタンス */
-	::dirent entry_;
+struct linux_dirent64 {
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[1];
+};
+#endif
+
+/**
+ * stat構造体のst_modeをd_typeの値に変換する
+ * @param mode st_modeの値
+ * @return 対応するd_typeの値を返す
+ */
+static unsigned char mode_to_type(mode_t mode)
+{
+	if (S_ISREG(mode)) {
+		return DT_REG;
+	}
+	if (S_ISDIR(mode)) {
+		return DT_DIR;
+	}
+	if (S_ISLNK(mode)) {
+		return DT_LNK;
+	}
+	if (S_ISCHR(mode)) {
+		return DT_CHR;
+	}
+	if (S_ISBLK(mode)) {
+		return DT_BLK;
+	}
+	if (S_ISFIFO(mode)) {
+		return DT_FIFO;
+	}
+	if (S_ISSOCK(mode)) {
+		return DT_SOCK;
+	}
+	return DT_UNKNOWN;
+}
+
+/**
+ * ディレクトリのファイルディスクリプタからの相対パスでエントリの種類を調べる。<br/>
+ * シンボリックリンクは辿らない。
+ * @param fd エントリを含むディレクトリのファイルディスクリプタ
+ * @param name エントリの名前
+ * @return エントリの種類（d_typeと同じ値）、調べられなかった場合はDT_UNKNOWNを返す
+ */
+static unsigned char lookup_type(int fd, char const *name)
+{
+	struct stat s;
+	if (0 != ::fstatat(fd, name, &s, AT_SYMLINK_NOFOLLOW)) {
+		return DT_UNKNOWN;
+	}
+	return mode_to_type(s.st_mode);
+}
 
-	impl() : entry_() {
-		std::memset(&entry_, 0, sizeof(entry_));
+/**
+ * ディレクトリエントリの実装用内部データ構造。<br/>
+ * ディレクトリから読み込んだエントリは読み込み用のバッファを直接参照し、コピーされた場合のみ名前を保持する。
+ */
+struct directory_entry::impl {
+	/** エントリの名前 */
+	char const *name_;
+	/** エントリの種類（d_type） */
+	unsigned char type_;
+	/** エントリのiノード番号 */
+	uint64_t inode_;
+	/** コピーされたエントリの名前を保持するインスタンス */
+	std::string name_buf_;
+
+	impl() : name_(""), type_(DT_UNKNOWN), inode_(0), name_buf_() {
 	}
 	/** コピーコンストラクタ */
-	impl(impl const &src) : entry_(src.entry_) {
+	impl(impl const &src) : name_(""), type_(src.type_), inode_(src.inode_), name_buf_(src.name_) {
+		name_ = name_buf_.c_str();
+	}
+	/** 代入演算子 */
+	impl &operator = (impl const &r) {
+		if (&r != this) {
+			name_buf_ = r.name_;
+			name_ = name_buf_.c_str();
+			type_ = r.type_;
+			inode_ = r.inode_;
+		}
+		return *this;
+	}
+	/** 読み込み用のバッファ上のエントリを参照する */
+	void set(char const *name, unsigned char type, uint64_t inode) {
+		name_ = name;
+		type_ = type;
+		inode_ = inode;
+	}
+
+	/** ディレクトリごとに生成と破棄を繰り返すため、スレッドローカルなプールから確保する */
+	static void *operator new(std::size_t n) {
+		(void)n;
+		return fixed_pool<sizeof(impl)>::allocate();
+	}
+	static void operator delete(void *ptr) {
+		fixed_pool<sizeof(impl)>::deallocate(ptr);
 	}
 };
 
@@ -41,6 +149,14 @@ directory_entry::directory_entry(directory_entry const &entry)
 {
 }
 
+/**
+ * ムーブコンストラクタ
+ */
+directory_entry::directory_entry(directory_entry &&entry) noexcept
+	: pimpl(std::move(entry.pimpl))
+{
+}
+
 directory_entry::~directory_entry()
 {
 }
@@ -50,7 +166,20 @@ directory_entry::~directory_entry()
  */
 directory_entry &directory_entry::operator = (directory_entry const &r)
 {
-	pimpl->entry_ = r.pimpl->entry_;
+	if (!pimpl) {
+		pimpl.reset(new impl(*r.pimpl.get()));
+	} else {
+		*pimpl = *r.pimpl;
+	}
+	return *this;
+}
+
+/**
+ * ムーブ代入演算子
+ */
+directory_entry &directory_entry::operator = (directory_entry &&r) noexcept
+{
+	pimpl = std::move(r.pimpl);
 	return *this;
 }
 
@@ -60,7 +189,7 @@ directory_entry &directory_entry::operator = (directory_entry const &r)
  */
 char const *directory_entry::name() const
 {
-	return pimpl->entry_.d_name;
+	return pimpl->name_;
 }
 
 /**
@@ -69,7 +198,7 @@ char const *directory_entry::name() const
  */
 bool directory_entry::is_directory() const
 {
-	return DT_DIR == pimpl->entry_.d_type;
+	return DT_DIR == pimpl->type_;
 }
 
 /**
@@ -78,7 +207,7 @@ bool directory_entry::is_directory() const
  */
 bool directory_entry::is_link() const
 {
-	return DT_LNK == pimpl->entry_.d_type;
+	return DT_LNK == pimpl->type_;
 }
 
 /**
@@ -87,7 +216,65 @@ bool directory_entry::is_link() const
  */
 bool directory_entry::is_regular() const
 {
-	return DT_REG == pimpl->entry_.d_type;
+	return DT_REG == pimpl->type_;
+}
+
+/**
+ * エントリの種類を取得する。<br/>
+ * ファイルシステムがd_typeを返さない（DT_UNKNOWN）場合は、ディレクトリから読み込んだ時点でfstatatで調べた値になる。
+ * 調べる前にエントリが削除されていた場合などはDT_UNKNOWNのままとなる。
+ * @return エントリの種類（struct direntのd_typeと同じ値）を返す
+ */
+unsigned char directory_entry::type() const
+{
+	return pimpl->type_;
+}
+
+/**
+ * エントリのiノード番号を取得する
+ * @return エントリのiノード番号を返す
+ */
+uint64_t directory_entry::inode() const
+{
+	return pimpl->inode_;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * エントリをiノード番号の昇順に並べ替える。<br/>
+ * 続けてエントリごとにstatやopenを行う場合に、iノードテーブルを順に読むことになるため、
+ * ext4などのディスク上の配置がiノード番号の順になるファイルシステムではシークが減る。
+ * 名前を格納する領域も新しい順序で詰め直す。iノード番号が等しいエントリの順序は保たれる。
+ */
+void directory_snapshot::sort_by_inode()
+{
+	std::size_t const n = size();
+	if (std::is_sorted(inodes_.begin(), inodes_.end())) {
+		return;
+	}
+	std::vector< std::pair<uint64_t, uint32_t> > order(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		order[i] = std::make_pair(inodes_[i], static_cast<uint32_t>(i));
+	}
+	std::sort(order.begin(), order.end());
+
+	directory_snapshot sorted;
+	sorted.names_.reserve(names_.size());
+	sorted.name_offsets_.reserve(n + 1);
+	sorted.types_.reserve(n);
+	sorted.inodes_.reserve(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		uint32_t const pos = order[i].second;
+		sorted.names_.append(names_, name_offsets_[pos], name_offsets_[pos + 1] - name_offsets_[pos]);
+		sorted.name_offsets_.push_back(static_cast<uint32_t>(sorted.names_.size()));
+		sorted.types_.push_back(types_[pos]);
+		sorted.inodes_.push_back(order[i].first);
+	}
+	names_.swap(sorted.names_);
+	name_offsets_.swap(sorted.name_offsets_);
+	types_.swap(sorted.types_);
+	inodes_.swap(sorted.inodes_);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -96,17 +283,144 @@ bool directory_entry::is_regular() const
  * ディレクトリの内部実装用データ構造
  */
 struct directory::impl {
-	/** DIR型のインスタンス */
+	/** ディレクトリのファイルディスクリプタ */
+	int fd_;
+#if defined(HUMANITY_IO_USE_GETDENTS64)
+	/** 既定の大きさの読み込み用のバッファを再利用するプール（スレッドごとに4つまで保持する） */
+	typedef fixed_pool<BUFFER_SIZE_DEFAULT, 4> buffer_pool;
+
+	/** getdents64で読み込んだエントリを保持するバッファ */
+	char *buffer_;
+	/** バッファの大きさ */
+	std::size_t capacity_;
+	/** バッファに読み込まれているデータの大きさ */
+	std::size_t size_;
+	/** 次に読み出すエントリのバッファ上の位置 */
+	std::size_t pos_;
+#else
+	/** fdopendirで開いたDIR型のインスタンス */
 	unique_ptr<DIR, int(*)(DIR*)> dir_;
+#endif
 	/** 現在のエントリを保持するインスタンス */
 	directory_entry entry_;
+	/** d_typeが不明なエントリの種類をまとめて調べる際のスレッド数 */
+	unsigned int stat_workers_;
+	/** d_typeが不明だったため、fstatatで種類を調べたエントリの数 */
+	uint64_t type_fallbacks_;
+
+#if defined(HUMANITY_IO_USE_GETDENTS64)
+	/** バッファ中のd_typeが不明なエントリ（作業領域） */
+	std::vector<linux_dirent64*> unknown_;
+
+	/** 開いたディレクトリのファイルディスクリプタを受けて構築するコンストラクタ */
+	impl(int fd, std::size_t buffer_size)
+		: fd_(fd), buffer_(NULL), capacity_(buffer_size), size_(0), pos_(0), entry_(), stat_workers_(1), type_fallbacks_(0), unknown_()
+	{
+		if (BUFFER_SIZE_DEFAULT == buffer_size) {
+			buffer_ = static_cast<char*>(buffer_pool::allocate());
+		} else {
+			buffer_ = static_cast<char*>(::operator new(buffer_size));
+		}
+	}
+	~impl() {
+		if (BUFFER_SIZE_DEFAULT == capacity_) {
+			buffer_pool::deallocate(buffer_);
+		} else {
+			::operator delete(buffer_);
+		}
+		if (0 <= fd_) {
+			::close(fd_);
+		}
+	}
 
-	/** opendirで開いたDIRを受けて構築するコンストラクタ */
-	impl(DIR *dir) : dir_(dir, closedir), entry_() {
+	void resolve_types();
+#else
+	/**
+	 * fdopendirで開いたDIRを受けて構築するコンストラクタ
+	 * @param dir 読み込みに使うDIR（fdの複製から開いたもの）
+	 * @param fd 所有権を渡せるよう、DIRとは別に保持するファイルディスクリプタ
+	 */
+	impl(DIR *dir, int fd) : fd_(fd), dir_(dir, closedir), entry_(), stat_workers_(1), type_fallbacks_(0) {
+	}
+	~impl() {
+		if (0 <= fd_) {
+			::close(fd_);
+		}
+	}
+#endif
+
+	/** ディレクトリごとに生成と破棄を繰り返すため、スレッドローカルなプールから確保する */
+	static void *operator new(std::size_t n) {
+		(void)n;
+		return fixed_pool<sizeof(impl)>::allocate();
+	}
+	static void operator delete(void *ptr) {
+		fixed_pool<sizeof(impl)>::deallocate(ptr);
 	}
-	~impl() {}
 };
 
+#if defined(HUMANITY_IO_USE_GETDENTS64)
+/**
+ * d_typeが不明なエントリの種類を分担して調べるスレッドプール。<br/>
+ * バッファごとにスレッドを起動しないよう、ディレクトリを読み込むスレッドごとに一つ持って使い回す。
+ */
+static thread_local auto_ptr< work_stealing_pool<std::size_t> > type_pool;
+
+/**
+ * バッファに読み込んだエントリのうち、d_typeが不明なものの種類をfstatatで調べてバッファ上のd_typeを書き換える。<br/>
+ * 一つのバッファ分をまとめて処理し、エントリが多い場合はスレッドプールで分担する。
+ * NFSなど一回の問い合わせに時間がかかるファイルシステムでも待ち時間を重ねられる。
+ */
+void directory::impl::resolve_types()
+{
+	/** 一つのワーカーが一度に引き受けるエントリの数 */
+	static std::size_t const CHUNK = 32;
+	/** これ以下のエントリ数ではスレッドプールを使わずにその場で調べる */
+	static std::size_t const INLINE_MAX = 2 * CHUNK;
+
+	unknown_.clear();
+	for (std::size_t pos = 0; pos < size_; ) {
+		linux_dirent64 * const d = reinterpret_cast<linux_dirent64*>(buffer_ + pos);
+		pos += d->d_reclen;
+		if (DT_UNKNOWN != d->d_type) {
+			continue;
+		}
+		if ((0 == std::strncmp(d->d_name, ".", 2)) || (0 == std::strncmp(d->d_name, "..", 3))) {
+			d->d_type = DT_DIR;
+			continue;
+		}
+		unknown_.push_back(d);
+	}
+	if (unknown_.empty()) {
+		return;
+	}
+	type_fallbacks_ += unknown_.size();
+
+	unsigned int const workers = std::max((0 == stat_workers_) ? std::thread::hardware_concurrency() : stat_workers_, 1U);
+	if ((1 == workers) || (unknown_.size() <= INLINE_MAX)) {
+		for (std::size_t i = 0; i < unknown_.size(); ++i) {
+			unknown_[i]->d_type = lookup_type(fd_, unknown_[i]->d_name);
+		}
+		return;
+	}
+
+	if (!type_pool || (type_pool->workers() != workers)) {
+		type_pool.reset(new work_stealing_pool<std::size_t>(workers));
+	}
+	for (std::size_t begin = 0; begin < unknown_.size(); begin += CHUNK) {
+		type_pool->push(static_cast<unsigned int>((begin / CHUNK) % workers), begin);
+	}
+	int const fd = fd_;
+	std::vector<linux_dirent64*> const &unknown = unknown_;
+	type_pool->run([fd, &unknown](unsigned int, std::size_t &begin) {
+		std::size_t const end = std::min(begin + CHUNK, unknown.size());
+		for (std::size_t i = begin; i < end; ++i) {
+			unknown[i]->d_type = lookup_type(fd, unknown[i]->d_name);
+		}
+	});
+}
+#endif
+
 /**
  * パスを指定してディレクトリを開く
  * @param path 開くディレクトリのパス
@@ -115,29 +429,229 @@ directory::directory(path const &path)
 	: pimpl()
 {
 	if (!path.empty()) {
-		DIR *dir = ::opendir(path.full_path());
-		THROW_IF(NULL == dir, system_call_error, "failed to open directory", errno);
-		pimpl.reset(new impl(dir));
+		int const err = open(AT_FDCWD, path.full_path(), 0, BUFFER_SIZE_DEFAULT);
+		THROW_IF(0 != err, system_call_error, "failed to open directory", err);
+		(void)err;
 	}
 }
 
+/**
+ * パスと読み込み用のバッファの大きさを指定してディレクトリを開く。<br/>
+ * バッファの大きさはBUFFER_SIZE_MINからBUFFER_SIZE_MAXの範囲に丸められる。
+ * getdents64が利用できない環境ではバッファの大きさは無視される。
+ * @param path 開くディレクトリのパス
+ * @param buffer_size エントリを一括して読み込むためのバッファの大きさ
+ */
+directory::directory(path const &path, std::size_t buffer_size)
+	: pimpl()
+{
+	if (!path.empty()) {
+		int const err = open(AT_FDCWD, path.full_path(), 0, buffer_size);
+		THROW_IF(0 != err, system_call_error, "failed to open directory", err);
+		(void)err;
+	}
+}
+
+/**
+ * 開いているディレクトリからの相対パスを指定してディレクトリを開く。<br/>
+ * パスの解決は親ディレクトリのファイルディスクリプタを起点に行われるため、
+ * 親ディレクトリまでのパスが探索中に変更されても影響を受けない。
+ * 末尾の要素がシンボリックリンクの場合は開かない。
+ * @param parent 起点となるディレクトリ
+ * @param name 開くディレクトリの相対パス
+ */
+directory::directory(directory const &parent, char const *name)
+	: pimpl()
+{
+	int const err = open(parent.descriptor(), name, O_NOFOLLOW, BUFFER_SIZE_DEFAULT);
+	THROW_IF(0 != err, system_call_error, "failed to open directory", err);
+	(void)err;
+}
+
+/** ムーブコンストラクタ */
+directory::directory(directory &&src) noexcept
+	: pimpl(std::move(src.pimpl))
+{
+}
+
+/**
+ * 開いていない状態で構築するコンストラクタ
+ */
+directory::directory()
+	: pimpl()
+{
+}
+
 directory::~directory() 
 {
 }
 
 /**
- * ディレクトリ内部のエントリを一つ次に進める
+ * パスを指定してディレクトリを開く（例外を送出しない）
+ * @param path 開くディレクトリのパス
+ * @return 開いたディレクトリ、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
+ */
+expected<directory> directory::try_open(path const &path)
+{
+	return try_open(path, BUFFER_SIZE_DEFAULT);
+}
+
+/**
+ * パスと読み込み用のバッファの大きさを指定してディレクトリを開く（例外を送出しない）
+ * @param path 開くディレクトリのパス
+ * @param buffer_size エントリを一括して読み込むためのバッファの大きさ
+ * @return 開いたディレクトリ、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
+ */
+expected<directory> directory::try_open(path const &path, std::size_t buffer_size)
+{
+	if (path.empty()) {
+		return make_unexpected(ENOENT);
+	}
+	directory dir;
+	int const err = dir.open(AT_FDCWD, path.full_path(), 0, buffer_size);
+	if (0 != err) {
+		return make_unexpected(err);
+	}
+	return dir;
+}
+
+/**
+ * 開いているディレクトリからの相対パスを指定してディレクトリを開く（例外を送出しない）。<br/>
+ * 末尾の要素がシンボリックリンクの場合は開かない（ELOOPまたはENOTDIRを返す）。
+ * @param parent 起点となるディレクトリ
+ * @param name 開くディレクトリの相対パス
+ * @return 開いたディレクトリ、失敗した場合はerrnoの値を返す
+ */
+expected<directory> directory::try_open(directory const &parent, char const *name)
+{
+	directory dir;
+	int const err = dir.open(parent.descriptor(), name, O_NOFOLLOW, BUFFER_SIZE_DEFAULT);
+	if (0 != err) {
+		return make_unexpected(err);
+	}
+	return dir;
+}
+
+/**
+ * ディレクトリを開く
+ * @param dirfd 相対パスの起点となるディレクトリのファイルディスクリプタ
+ * @param name 開くディレクトリのパス
+ * @param flags openatに追加で渡すフラグ
+ * @param buffer_size エントリを一括して読み込むためのバッファの大きさ
+ * @return 成功した場合は0、失敗した場合はerrnoの値を返す
+ */
+int directory::open(int dirfd, char const *name, int flags, std::size_t buffer_size)
+{
+	int const fd = ::openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | flags);
+	if (0 > fd) {
+		return errno;
+	}
+#if defined(HUMANITY_IO_USE_GETDENTS64)
+	if (buffer_size < BUFFER_SIZE_MIN) {
+		buffer_size = BUFFER_SIZE_MIN;
+	} else if (buffer_size > BUFFER_SIZE_MAX) {
+		buffer_size = BUFFER_SIZE_MAX;
+	}
+	pimpl.reset(new impl(fd, buffer_size));
+#else
+	(void)buffer_size;
+	// DIRを閉じるとファイルディスクリプタも閉じられるため、DIRには複製を渡して元のファイルディスクリプタを手放せるようにする
+	int const dup_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	DIR *dir = (0 > dup_fd) ? NULL : ::fdopendir(dup_fd);
+	if (NULL == dir) {
+		int const e = errno;
+		if (0 <= dup_fd) {
+			::close(dup_fd);
+		}
+		::close(fd);
+		return e;
+	}
+	pimpl.reset(new impl(dir, fd));
+#endif
+	return 0;
+}
+
+/**
+ * ディレクトリのファイルディスクリプタを取得する
+ * @return ディレクトリのファイルディスクリプタ、開いていない場合は-1を返す
+ */
+int directory::descriptor() const
+{
+	return !pimpl ? -1 : pimpl->fd_;
+}
+
+/**
+ * ディレクトリを閉じ、ファイルディスクリプタの所有権を呼び出し元に渡す。<br/>
+ * 読み込み用のバッファは解放し、ファイルディスクリプタだけを開いたままにする。
+ * @return ディレクトリのファイルディスクリプタ（呼び出し元が閉じること）、開いていない場合は-1を返す
+ */
+int directory::release_descriptor()
+{
+	if (!pimpl) {
+		return -1;
+	}
+	// 既に descriptor() で渡したファイルディスクリプタがそのまま使い続けられる
+	int const fd = pimpl->fd_;
+	pimpl->fd_ = -1;
+	pimpl.reset();
+	return fd;
+}
+
+/**
+ * ディレクトリ内部のエントリを一つ次に進める。<br/>
+ * 取得したエントリは次にこの関数を呼び出すまで有効。
  * @return 次のエントリが存在する場合はtrue、そうでなければfalseを返す
  */
 bool directory::next()
 {
-	dirent *result = NULL;
-	int const err = readdir_r(pimpl->dir_.get(), &pimpl->entry_.pimpl->entry_, &result);
-	THROW_IF(0 != err, system_call_error, "failed to read directory", err);
-	if (NULL == result) {
+	expected<bool> const ret = try_next();
+	THROW_IF(!ret, system_call_error, "failed to read directory", ret.error());
+	return ret.value_or(false);
+}
+
+/**
+ * ディレクトリ内部のエントリを一つ次に進める（例外を送出しない）。<br/>
+ * 取得したエントリは次にこの関数を呼び出すまで有効。
+ * @return 次のエントリが存在するかどうか、読み込みに失敗した場合はerrnoの値を返す
+ */
+expected<bool> directory::try_next()
+{
+#if defined(HUMANITY_IO_USE_GETDENTS64)
+	if (pimpl->pos_ >= pimpl->size_) {
+		long const n = ::syscall(SYS_getdents64, pimpl->fd_, pimpl->buffer_, pimpl->capacity_);
+		if (0 > n) {
+			return make_unexpected(errno);
+		}
+		if (0 == n) {
+			return false;
+		}
+		pimpl->size_ = static_cast<std::size_t>(n);
+		pimpl->pos_ = 0;
+		pimpl->resolve_types();
+	}
+	char const * const record = pimpl->buffer_ + pimpl->pos_;
+	linux_dirent64 const * const d = reinterpret_cast<linux_dirent64 const*>(record);
+	pimpl->pos_ += d->d_reclen;
+	pimpl->entry_.pimpl->set(record + offsetof(linux_dirent64, d_name), d->d_type, d->d_ino);
+	return true;
+#else
+	errno = 0;
+	dirent const * const d = ::readdir(pimpl->dir_.get());
+	if (NULL == d) {
+		int const e = errno;
+		if (0 != e) {
+			return make_unexpected(e);
+		}
 		return false;
 	}
+	unsigned char type = d->d_type;
+	if (DT_UNKNOWN == type) {
+		++pimpl->type_fallbacks_;
+		type = lookup_type(pimpl->fd_, d->d_name);
+	}
+	pimpl->entry_.pimpl->set(d->d_name, type, d->d_ino);
 	return true;
+#endif
 }
 
 /**
@@ -158,6 +672,95 @@ directory_entry const &directory::entry() const
 	return pimpl->entry_;
 }
 
+/**
+ * d_typeが不明なエントリの種類をまとめて調べる際のスレッド数を設定する。<br/>
+ * getdents64で読み込んだバッファごとに、d_typeが不明なエントリの種類をfstatatで調べる。
+ * getdents64が利用できない環境では設定は無視され、エントリごとに一つずつ調べる。
+ * @param workers スレッド数（0の場合はハードウェアの並列度を使う、既定値は1）
+ */
+void directory::set_stat_workers(unsigned int workers)
+{
+	pimpl->stat_workers_ = workers;
+}
+
+/**
+ * d_typeが不明（DT_UNKNOWN）だったため、fstatatで種類を調べたエントリの数を取得する
+ * @return これまでに読み込んだエントリのうち、fstatatで種類を調べたものの数を返す
+ */
+uint64_t directory::type_fallbacks() const
+{
+	return !pimpl ? 0 : pimpl->type_fallbacks_;
+}
+
+/**
+ * ディレクトリの残りのエントリを全て読み込む。<br/>
+ * コンテナの内容は読み込んだエントリで置き換えられる。"."と".."は格納しない。
+ * @param snapshot 読み込んだエントリを格納するコンテナ
+ * @return 正常に読み込みが完了した場合はtrue、そうでなければfalseを返す
+ */
+bool directory::read_all(directory_snapshot &snapshot)
+{
+	expected<void> const ret = try_read_all(snapshot);
+	THROW_IF(!ret, system_call_error, "failed to read directory", ret.error());
+	return ret.has_value();
+}
+
+/**
+ * パスを指定してディレクトリを開き、全てのエントリを読み込む
+ * @param dir_path 読み込み対象のディレクトリのパス
+ * @param snapshot 読み込んだエントリを格納するコンテナ
+ * @return 正常に読み込みが完了した場合はtrue、そうでなければfalseを返す
+ */
+bool directory::read_all(path const &dir_path, directory_snapshot &snapshot)
+{
+	expected<void> const ret = try_read_all(dir_path, snapshot);
+	THROW_IF(!ret, system_call_error, "failed to read directory", ret.error());
+	return ret.has_value();
+}
+
+/**
+ * ディレクトリの残りのエントリを全て読み込む（例外を送出しない）。<br/>
+ * コンテナの内容は読み込んだエントリで置き換えられる。"."と".."は格納しない。
+ * 読み込みに失敗した場合、コンテナにはそれまでに読み込んだエントリが残る。
+ * @param snapshot 読み込んだエントリを格納するコンテナ
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す
+ */
+expected<void> directory::try_read_all(directory_snapshot &snapshot)
+{
+	snapshot.clear();
+	for (;;) {
+		expected<bool> const ret = try_next();
+		if (!ret) {
+			return make_unexpected(ret.error());
+		}
+		if (!*ret) {
+			break;
+		}
+		directory_entry const &entry = pimpl->entry_;
+		char const *name = entry.name();
+		if ((0 == std::strncmp(name, ".", 2)) || (0 == std::strncmp(name, "..", 3))) {
+			continue;
+		}
+		snapshot.push_back(string_view(name, std::strlen(name)), entry.type(), entry.inode());
+	}
+	return expected<void>();
+}
+
+/**
+ * パスを指定してディレクトリを開き、全てのエントリを読み込む（例外を送出しない）
+ * @param dir_path 読み込み対象のディレクトリのパス
+ * @param snapshot 読み込んだエントリを格納するコンテナ
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
+ */
+expected<void> directory::try_read_all(path const &dir_path, directory_snapshot &snapshot)
+{
+	expected<directory> dir = try_open(dir_path);
+	if (!dir) {
+		return make_unexpected(dir.error());
+	}
+	return dir->try_read_all(snapshot);
+}
+
 /**
  * ディレクトリ中の全てのエントリを再帰的に探索して、エントリへのパスをコンテナに格納する
  * @param dir_path 探索対象のディレクトリのパス
@@ -166,27 +769,28 @@ directory_entry const &directory::entry() const
  */
 bool directory::scan_all(path const &dir_path, contained_file_names &container)
 {
-	return scan(dir_path, dir_path, container);
+	directory_walker walker(dir_path);
+	while (walker.next()) {
+		if (walker.entry().is_regular()) {
+			container.push_back(walker.relative_path());
+		}
+	}
+	return true;
 }
 
-bool directory::scan(path const &root_dir_path, path const &dir_path, contained_file_names &container)
+/**
+ * ディレクトリ中の全てのエントリを再帰的に探索して、エントリへのパスを省メモリのコンテナに格納する。<br/>
+ * 格納されるパスと順序は scan_all(path const &, contained_file_names &) と同じ。
+ * @param dir_path 探索対象のディレクトリのパス
+ * @param container 各エントリへのパスを格納するためのコンテナ
+ * @return 正常に探索が完了した場合はtrue、そうでなければfalse
+ */
+bool directory::scan_all(path const &dir_path, compact_file_names &container)
 {
-	directory dir(dir_path);
-	while (dir.next()) {
-		directory_entry const &entry = dir.entry();
-		if ((0 == std::strncmp(entry.name(), ".", 2)) || (0 == std::strncmp(entry.name(), "..", 3))) {
-			continue;
-		}
-		if (entry.is_directory()) {
-			if (!directory::scan(root_dir_path, dir_path + entry.name(), container)) {
-				return false;
-			}
-			continue;
-		}
-		if (entry.is_regular()) {
-			path const &rel = root_dir_path.make_relative(dir_path + entry.name());
-			container.push_back(rel.full_path());
-			continue;
+	directory_walker walker(dir_path);
+	while (walker.next()) {
+		if (walker.entry().is_regular()) {
+			container.push_back(walker.parent_path(), walker.entry().name());
 		}
 	}
 	return true;
@@ -219,90 +823,168 @@ bool directory::rename(path const &src, path const &dst)
  * @return 正常に削除に成功した場合はtrue、そうでなければfalseを返す
  */
 bool directory::rmdir(path const &dir_path)
+{
+	expected<void> const ret = try_rmdir(dir_path);
+	if (!ret && !dir_path.empty()) {
+		LOGE("failed to remove directory: %s (%s)", dir_path.full_path(), std::strerror(ret.error()));
+	}
+	return ret.has_value();
+}
+
+/**
+ * 指定したディレクトリを作成する
+ * @param dir_path 作成するディレクトリのパス
+ * @return 正常にディレクトリが作成できた場合はtrue、そうでなければfalseを返す
+ */
+bool directory::mkdir(path const &dir_path)
+{
+	return try_mkdir(dir_path).has_value();
+}
+
+/**
+ * ディレクトリが存在するかどうか判定する（例外を送出しない）
+ * @param path 判定対象のディレクトリのパス
+ * @return ディレクトリまたはファイルが存在するかどうか、判定できなかった場合はerrnoの値を返す
+ */
+expected<bool> directory::try_is_exist(path const &path)
+{
+	return file::try_is_exist(path);
+}
+
+/**
+ * ディレクトリをリネームする（例外を送出しない）
+ * @param src リネーム対象のディレクトリのパス
+ * @param dst リネーム後のディレクトリのパス
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す
+ */
+expected<void> directory::try_rename(path const &src, path const &dst)
+{
+	return file::try_rename(src, dst);
+}
+
+/**
+ * ディレクトリおよび内部のエントリを再帰的に削除する（例外を送出しない）。<br/>
+ * ディレクトリが存在しない場合は成功として扱う。
+ * @param dir_path 削除対象のディレクトリのパス
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
+ */
+expected<void> directory::try_rmdir(path const &dir_path)
 {
 	if (dir_path.empty()) {
-		return false;
+		return make_unexpected(ENOENT);
 	}
 
-	try {
-		if (!directory::is_exist(dir_path)) {
-			return true;
-		}
+	directory dir;
+	int err = dir.open(AT_FDCWD, dir_path.full_path(), 0, BUFFER_SIZE_DEFAULT);
+	if (ENOENT == err) {
+		return expected<void>();
+	}
+	if (0 == err) {
+		err = directory::remove_entries(dir);
+	}
+	if ((0 == err) && (0 != ::rmdir(dir_path.full_path())) && (ENOENT != errno)) {
+		err = errno;
+	}
+	stat_cache::invalidate_tree(dir_path);
+	if (0 != err) {
+		return make_unexpected(err);
+	}
+	return expected<void>();
+}
 
-		directory dir(dir_path);
-		while (dir.next()) {
-			directory_entry const &entry = dir.entry();
-			if ((0 == std::strncmp(entry.name(), ".", 2)) || (0 == std::strncmp(entry.name(), "..", 3))) {
+/**
+ * 開いているディレクトリ中のエントリを再帰的に削除する。<br/>
+ * サブディレクトリの探索と削除はdirのファイルディスクリプタからの相対パスで行う。
+ * エントリは全て読み込んでからiノード番号の順に削除する。
+ * @param dir 削除対象のエントリを含むディレクトリ
+ * @return 成功した場合は0、失敗した場合はerrnoの値を返す（削除できない種類のエントリはEINVAL）
+ */
+int directory::remove_entries(directory &dir)
+{
+	int const fd = dir.descriptor();
+	directory_snapshot entries;
+	expected<void> const read = dir.try_read_all(entries);
+	if (!read) {
+		return read.error();
+	}
+	entries.sort_by_inode();
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		char const *name = entries.name(i);
+		if (entries.is_directory(i)) {
+			directory sub_dir;
+			int err = sub_dir.open(fd, name, O_NOFOLLOW, BUFFER_SIZE_DEFAULT);
+			if (ENOENT == err) {
 				continue;
 			}
-
-			path new_path = dir_path + entry.name();
-			if (entry.is_directory()) {
-				if (!directory::rmdir(new_path)) {
-					return false;
+			if (0 == err) {
+				err = directory::remove_entries(sub_dir);
+			}
+			if (0 != err) {
+				return err;
+			}
+			if (0 != ::unlinkat(fd, name, AT_REMOVEDIR)) {
+				if (ENOENT != errno) {
+					return errno;
 				}
-			} else if (entry.is_link() || entry.is_regular()) {
-				if (0 != ::unlink(new_path.full_path())) {
-					if (ENOENT != errno) {
-						return false;
-					}
+			}
+		} else if (entries.is_link(i) || entries.is_regular(i) || (DT_UNKNOWN == entries.type(i))) {
+			// 種類を調べられなかったエントリは、既に削除されていればENOENTになる
+			if (0 != ::unlinkat(fd, name, 0)) {
+				if (ENOENT != errno) {
+					return errno;
 				}
-			} else {
-				return false;
 			}
-		}
-	} catch (system_call_error &ex) {
-		LOGE("%s", ex.what());
-		return false;
-	}
-	if (0 != ::rmdir(dir_path.full_path())) {
-		if (ENOENT != errno) {
-			return false;
+		} else {
+			return EINVAL;
 		}
 	}
-	return true;
+	return 0;
 }
 
 /**
- * 指定したディレクトリを作成する
+ * 指定したディレクトリを作成する（例外を送出しない）。<br/>
+ * 途中のディレクトリが存在しない場合はそれらも作成し、既に存在する場合は成功として扱う。
  * @param dir_path 作成するディレクトリのパス
- * @return 正常にディレクトリが作成できた場合はtrue、そうでなければfalseを返す
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
  */
-bool directory::mkdir(path const &dir_path)
+expected<void> directory::try_mkdir(path const &dir_path)
 {
 	if (dir_path.empty()) {
-		return false;
+		return make_unexpected(ENOENT);
 	}
 
 	if (0 == ::mkdir(dir_path.full_path(), S_IRWXU)) {
-		return true;
+		stat_cache::invalidate(dir_path);
+		return expected<void>();
 	}
 	int const e = errno;
 	if (e == EEXIST) {
-		return true;
+		return expected<void>();
 	}
 	if (e != ENOENT) {
-		return false;
+		return make_unexpected(e);
 	}
 
 	std::stack<path> pstack;
 	path current_dir(dir_path);
 	pstack.push(current_dir);
 	for (;;) {
-		path parent_dir = current_dir.parent();
-		if (parent_dir.empty()) {
-			return false;
+		expected<path> parent_dir = current_dir.try_parent();
+		if (!parent_dir) {
+			return make_unexpected(parent_dir.error());
 		}
-		try {
-			if (directory::is_exist(parent_dir)) {
-				break;
-			}
-		} catch (system_call_error &ex) {
-			LOGE("%s", ex.what());
-			return false;
+		if (parent_dir->empty()) {
+			return make_unexpected(ENOENT);
+		}
+		expected<bool> const exist = directory::try_is_exist(*parent_dir);
+		if (!exist) {
+			return make_unexpected(exist.error());
 		}
-		pstack.push(parent_dir);
-		current_dir = parent_dir;
+		if (*exist) {
+			break;
+		}
+		current_dir = *parent_dir;
+		pstack.push(std::move(*parent_dir));
 	}
 
 	while (!pstack.empty()) {
@@ -310,13 +992,14 @@ bool directory::mkdir(path const &dir_path)
 
 		if (0 != ::mkdir(dir.full_path(), S_IRWXU)) {
 			if (EEXIST != errno) {
-				return false;
+				return make_unexpected(errno);
 			}
 		}
+		stat_cache::invalidate(dir);
 
 		pstack.pop();
 	}
-	return true;
+	return expected<void>();
 }
 
 HUMANITY_IO_NS_END
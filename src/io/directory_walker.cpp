@@ -0,0 +1,300 @@
+#include <humanity/io/directory.hpp>
+#include <humanity/io/glob_filter.hpp>
+#include <humanity/io/path.hpp>
+#include <humanity/exception.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * 再帰的な列挙の内部実装用データ構造
+ */
+struct directory_walker::impl {
+	/**
+	 * 開いているディレクトリの階層一つ分
+	 */
+	struct level {
+		/** 開いているディレクトリ */
+		auto_ptr<directory> dir_;
+		/** このディレクトリに入る前のdir_path_の長さ */
+		std::size_t parent_length_;
+		/** このディレクトリのフィルタの照合状態 */
+		glob_filter::state state_;
+
+		level(directory *dir, std::size_t parent_length) : dir_(dir), parent_length_(parent_length), state_() {
+		}
+	};
+
+	/** 開いているディレクトリの階層（末尾が現在のエントリを含むディレクトリ） */
+	std::vector<level> stack_;
+	/** ルートから現在のエントリを含むディレクトリまでの相対パス */
+	std::string dir_path_;
+	/** ルートから現在のエントリまでの相対パス（必要になった時に作る） */
+	mutable std::string rel_path_;
+	/** rel_path_が現在のエントリを指しているかどうか */
+	mutable bool rel_path_valid_;
+	/** 中に入るディレクトリの階層の深さの上限 */
+	unsigned int max_depth_;
+	/** 次に進む時に現在のエントリの中に入るかどうか */
+	bool descend_;
+	/** 次に進む時に現在のエントリを含むディレクトリから抜けるかどうか */
+	bool leave_;
+	/** エントリを絞り込むフィルタ（NULLの場合は絞り込まない） */
+	glob_filter const *filter_;
+	/** 現在のエントリがディレクトリの場合の、その中のフィルタの照合状態 */
+	glob_filter::state pending_state_;
+	/** d_typeが不明なエントリの種類をまとめて調べる際のスレッド数 */
+	unsigned int stat_workers_;
+	/** 既に抜けたディレクトリで、fstatatで種類を調べたエントリの数 */
+	uint64_t type_fallbacks_;
+
+	impl(unsigned int max_depth, glob_filter const *filter, unsigned int stat_workers)
+		: stack_(), dir_path_(), rel_path_(), rel_path_valid_(false), max_depth_(max_depth), descend_(false), leave_(false),
+		  filter_(filter), pending_state_(), stat_workers_(stat_workers), type_fallbacks_(0)
+	{
+	}
+
+	/** ルートディレクトリを開く */
+	void open_root(path const &root) {
+		stack_.push_back(level(new directory(), 0));
+		int const err = stack_.back().dir_->open(AT_FDCWD, root.full_path(), 0, directory::BUFFER_SIZE_DEFAULT);
+		THROW_IF(0 != err, system_call_error, "failed to open directory", err);
+		(void)err;
+		stack_.back().dir_->set_stat_workers(stat_workers_);
+		if (NULL != filter_) {
+			stack_.back().state_ = filter_->root();
+		}
+	}
+
+	/** 現在のエントリを含むディレクトリから抜ける */
+	void pop() {
+		dir_path_.resize(stack_.back().parent_length_);
+		type_fallbacks_ += stack_.back().dir_->type_fallbacks();
+		stack_.pop_back();
+	}
+};
+
+/**
+ * ルートディレクトリを指定して、階層の深さを制限せずに列挙するインスタンスを構築する
+ * @param root 列挙対象のディレクトリのパス
+ */
+directory_walker::directory_walker(path const &root)
+	: pimpl(new impl(DEPTH_UNLIMITED, NULL, 1))
+{
+	pimpl->open_root(root);
+}
+
+/**
+ * ルートディレクトリと階層の深さの上限を指定して、列挙するインスタンスを構築する。<br/>
+ * ルート直下のエントリの深さを0とし、深さがmax_depth未満のディレクトリの中だけに入る。
+ * max_depthに0を指定した場合はルート直下のエントリだけを列挙する。
+ * @param root 列挙対象のディレクトリのパス
+ * @param max_depth 中に入るディレクトリの階層の深さの上限
+ */
+directory_walker::directory_walker(path const &root, unsigned int max_depth)
+	: pimpl(new impl(max_depth, NULL, 1))
+{
+	pimpl->open_root(root);
+}
+
+/**
+ * ルートディレクトリと階層の深さの上限、フィルタを指定して、列挙するインスタンスを構築する。<br/>
+ * フィルタで除外されるディレクトリは列挙せず中にも入らない。
+ * ディレクトリ以外のエントリは、フィルタで対象と判定されたものだけを列挙する。
+ * 判定は名前だけで行うため、除外されるエントリのパス文字列は作られない。
+ * @param root 列挙対象のディレクトリのパス
+ * @param max_depth 中に入るディレクトリの階層の深さの上限
+ * @param filter エントリを絞り込むフィルタ（NULLの場合は絞り込まない、列挙の間は破棄しないこと）
+ */
+directory_walker::directory_walker(path const &root, unsigned int max_depth, glob_filter const *filter)
+	: pimpl(new impl(max_depth, filter, 1))
+{
+	pimpl->open_root(root);
+}
+
+/**
+ * ルートディレクトリと階層の深さの上限、スキャン方法を指定して、列挙するインスタンスを構築する。<br/>
+ * スキャン方法のうち、フィルタとd_typeが不明なエントリの種類を調べる際のスレッド数だけを使う。
+ * @param root 列挙対象のディレクトリのパス
+ * @param max_depth 中に入るディレクトリの階層の深さの上限
+ * @param options スキャン方法（フィルタは列挙の間は破棄しないこと）
+ */
+directory_walker::directory_walker(path const &root, unsigned int max_depth, scan_options const &options)
+	: pimpl(new impl(max_depth, options.filter, options.stat_workers))
+{
+	pimpl->open_root(root);
+}
+
+directory_walker::~directory_walker()
+{
+}
+
+/**
+ * 次のエントリに進む。<br/>
+ * 現在のエントリが中に入る対象のディレクトリであれば、その中の最初のエントリに進む。
+ * 探索中に削除されたサブディレクトリは無視する。
+ * 取得したエントリは次にこの関数を呼び出すまで有効。
+ * @return 次のエントリが存在する場合はtrue、全てのエントリを列挙し終えた場合はfalseを返す
+ */
+bool directory_walker::next()
+{
+	impl &w = *pimpl;
+	w.rel_path_valid_ = false;
+
+	if (w.leave_) {
+		w.leave_ = false;
+		w.descend_ = false;
+		if (!w.stack_.empty()) {
+			w.pop();
+		}
+	} else if (w.descend_) {
+		w.descend_ = false;
+		directory &parent = *w.stack_.back().dir_;
+		char const *name = parent.entry().name();
+		auto_ptr<directory> dir(new directory());
+		int const err = dir->open(parent.descriptor(), name, O_NOFOLLOW, directory::BUFFER_SIZE_DEFAULT);
+		if (0 == err) {
+			std::size_t const parent_length = w.dir_path_.length();
+			if (0 < parent_length) {
+				w.dir_path_ += '/';
+			}
+			w.dir_path_ += name;
+			dir->set_stat_workers(w.stat_workers_);
+			w.stack_.push_back(impl::level(dir.release(), parent_length));
+			w.stack_.back().state_ = std::move(w.pending_state_);
+		} else {
+			THROW_IF((ENOENT != err) && (ENOTDIR != err), system_call_error, "failed to open directory", err);
+		}
+	}
+
+	while (!w.stack_.empty()) {
+		directory &dir = *w.stack_.back().dir_;
+		if (!dir.next()) {
+			w.pop();
+			continue;
+		}
+		directory_entry const &entry = dir.entry();
+		if ((0 == std::strncmp(entry.name(), ".", 2)) || (0 == std::strncmp(entry.name(), "..", 3))) {
+			continue;
+		}
+		if (NULL != w.filter_) {
+			if (entry.is_directory()) {
+				if (!w.filter_->enter(w.stack_.back().state_, entry.name(), w.pending_state_)) {
+					continue;
+				}
+			} else if (!w.filter_->accept(w.stack_.back().state_, entry.name())) {
+				continue;
+			}
+		}
+		w.descend_ = entry.is_directory() && (w.stack_.size() - 1 < w.max_depth_);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * 現在のエントリを取得する
+ * @return 現在のエントリを返す。nextがtrueを返していない場合の動作は未定義。
+ */
+directory_entry const &directory_walker::entry() const
+{
+	return pimpl->stack_.back().dir_->entry();
+}
+
+/**
+ * ルートから現在のエントリまでの相対パスを取得する。<br/>
+ * パス文字列はこの関数を呼び出した時に作られ、次のエントリに進むまで有効。
+ * @return ルートから現在のエントリまでの相対パスを返す
+ */
+std::string const &directory_walker::relative_path() const
+{
+	impl const &w = *pimpl;
+	if (!w.rel_path_valid_) {
+		char const *name = entry().name();
+		std::size_t const n = std::strlen(name);
+		w.rel_path_.reserve(w.dir_path_.length() + n + 1);
+		w.rel_path_.assign(w.dir_path_);
+		if (!w.dir_path_.empty()) {
+			w.rel_path_ += '/';
+		}
+		w.rel_path_.append(name, n);
+		w.rel_path_valid_ = true;
+	}
+	return w.rel_path_;
+}
+
+/**
+ * ルートから現在のエントリを含むディレクトリまでの相対パスを取得する
+ * @return ルートから現在のエントリを含むディレクトリまでの相対パス（ルート直下のエントリの場合は空文字列）を返す
+ */
+std::string const &directory_walker::parent_path() const
+{
+	return pimpl->dir_path_;
+}
+
+/**
+ * 現在のエントリの階層の深さを取得する
+ * @return ルート直下のエントリを0とした階層の深さを返す
+ */
+unsigned int directory_walker::depth() const
+{
+	return static_cast<unsigned int>(pimpl->stack_.size() - 1);
+}
+
+/**
+ * d_typeが不明（DT_UNKNOWN）だったため、fstatatで種類を調べたエントリの数を取得する
+ * @return これまでに読み込んだエントリのうち、fstatatで種類を調べたものの数を返す
+ */
+uint64_t directory_walker::type_fallbacks() const
+{
+	impl const &w = *pimpl;
+	uint64_t ret = w.type_fallbacks_;
+	for (std::size_t i = 0; i < w.stack_.size(); ++i) {
+		ret += w.stack_[i].dir_->type_fallbacks();
+	}
+	return ret;
+}
+
+/**
+ * 現在のエントリがディレクトリであっても、次に進む時にその中に入らないようにする
+ */
+void directory_walker::skip_subdirectory()
+{
+	pimpl->descend_ = false;
+}
+
+/**
+ * 現在のエントリを含むディレクトリの残りのエントリを飛ばし、次に進む時に親ディレクトリの列挙を再開する。<br/>
+ * ルート直下のエントリで呼び出した場合は、次に進む時に列挙が終了する。
+ */
+void directory_walker::leave_directory()
+{
+	pimpl->leave_ = true;
+}
+
+/**
+ * 最初のエントリに進み、範囲for文で使うためのイテレータを取得する。<br/>
+ * nextを呼び出すのと同じく列挙を進めるため、一つのインスタンスにつき一度だけ呼び出せる。
+ * @return 最初のエントリを指すイテレータ、エントリが存在しない場合はendと等しいイテレータを返す
+ */
+directory_walker::iterator directory_walker::begin()
+{
+	return next() ? iterator(this) : iterator();
+}
+
+/**
+ * 列挙の終端を表すイテレータを取得する
+ * @return 列挙の終端を表すイテレータを返す
+ */
+directory_walker::iterator directory_walker::end()
+{
+	return iterator();
+}
+
+HUMANITY_IO_NS_END
@@ -1,5 +1,6 @@
 #include <humanity/io/file.hpp>
 #include <humanity/io/path.hpp>
+#include <humanity/io/stat_cache.hpp>
 #include <humanity/exception.hpp>
 #include <cstdio>
 #include <cerrno>
@@ -14,97 +15,159 @@ HUMANITY_IO_NS_BEGIN
  * @return シンボリックリンクだった場合はtrue、そうでなければfalseを返す
  */
 bool file::is_link(path const &path)
+{
+	expected<bool> const ret = try_is_link(path);
+	THROW_IF(!ret, system_call_error, "cannot get file status", ret.error());
+	return ret.value_or(false);
+}
+
+/**
+ * ファイルが存在するかどうか判定する
+ * @param path 判定対象のファイルのパス
+ * @return ファイルが存在する場合はtrue、そうでなければfalseを返す
+ */
+bool file::is_exist(path const &path)
+{
+	expected<bool> const ret = try_is_exist(path);
+	THROW_IF(!ret, system_call_error, "cannot check file existense", ret.error());
+	return ret.value_or(false);
+}
+
+/**
+ * ファイルのモードを変更する
+ * @param path モードを変更する対象のファイルのパス
+ * @param mode 変更後のモード（複数のモード定数をビット和でまとめて指定する）
+ * @return モード変更に成功した場合はtrue、そうでなければfalseを返す
+ */
+bool file::chmod(path const &path, uint16_t mode)
+{
+	return try_chmod(path, mode).has_value();
+}
+
+/**
+ * 指定したファイルを削除する。<br/>
+ * 実際にはstd::removeを呼び出す。
+ * @param path 削除対象のファイルのパス
+ * @return 削除に成功した場合はtrue、そうでなければfalseを返す
+ */
+bool file::remove(path const &path)
+{
+	return try_remove(path).has_value();
+}
+
+/**
+ * ファイルの名前を変更する。<br/>
+ * 実際にはstd::renameを呼び出す。
+ * @param src 変更前のファイルのパス
+ * @param dst 変更後のファイルのパス
+ * @return 名前の変更に成功した場合はtrue、そうでなければfalseを返す
+ */
+bool file::rename(path const &src, path const &dst)
+{
+	return try_rename(src, dst).has_value();
+}
+
+/**
+ * ファイルがシンボリックリンクかどうか判定する（例外を送出しない）
+ * @param path 判定対象のファイルのパス
+ * @return シンボリックリンクかどうか、ファイルの状態を取得できなかった場合はerrnoの値を返す
+ */
+expected<bool> file::try_is_link(path const &path)
 {
 	if (path.empty()) {
 		return false;
 	}
 
-	struct stat s = { 0, };
-	if (0 == ::lstat(path.full_path(), &s)) {
-		if (S_ISLNK(s.st_mode)) {
-			return true;
-		}
-		return false;
+	uint32_t mode = 0;
+	int const e = stat_cache::lstat_mode(path, mode);
+	if (0 != e) {
+		return make_unexpected(e);
 	}
-
-	THROW(system_call_error, "cannot get file status", errno);
+	return S_ISLNK(mode) ? true : false;
 }
 
 /**
- * ファイルが存在するかどうか判定する
+ * ファイルが存在するかどうか判定する（例外を送出しない）。<br/>
+ * ファイルが存在しない場合（ENOENTとENOTDIR）はエラーではなくfalseを返す。
  * @param path 判定対象のファイルのパス
- * @return ファイルが存在する場合はtrue、そうでなければfalseを返す
+ * @return ファイルが存在するかどうか、判定できなかった場合はerrnoの値を返す
  */
-bool file::is_exist(path const &path)
+expected<bool> file::try_is_exist(path const &path)
 {
 	if (path.empty()) {
 		return false;
 	}
 
-	struct stat s = { 0, };
-	if (0 == ::lstat(path.full_path(), &s)) {
+	uint32_t mode = 0;
+	int const e = stat_cache::lstat_mode(path, mode);
+	if (0 == e) {
 		return true;
 	}
-	int const e = errno;
 	if ((ENOENT == e) || (ENOTDIR == e)) {
 		return false;
 	}
-	THROW(system_call_error, "cannot check file existense", e);
+	return make_unexpected(e);
 }
 
 /**
- * ファイルのモードを変更する
+ * ファイルのモードを変更する（例外を送出しない）
  * @param path モードを変更する対象のファイルのパス
  * @param mode 変更後のモード（複数のモード定数をビット和でまとめて指定する）
- * @return モード変更に成功した場合はtrue、そうでなければfalseを返す
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
  */
-bool file::chmod(path const &path, uint16_t mode)
+expected<void> file::try_chmod(path const &path, uint16_t mode)
 {
 	if (path.empty()) {
-		return false;
+		return make_unexpected(ENOENT);
 	}
 
-	if (0 == ::chmod(path.full_path(), static_cast<mode_t>(mode))) {
-		return true;
+	int const e = (0 == ::chmod(path.full_path(), static_cast<mode_t>(mode))) ? 0 : errno;
+	stat_cache::invalidate(path);
+	if (0 != e) {
+		return make_unexpected(e);
 	}
-	return false;
+	return expected<void>();
 }
 
 /**
- * 指定したファイルを削除する。<br/>
+ * 指定したファイルを削除する（例外を送出しない）。<br/>
  * 実際にはstd::removeを呼び出す。
  * @param path 削除対象のファイルのパス
- * @return 削除に成功した場合はtrue、そうでなければfalseを返す
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
  */
-bool file::remove(path const &path)
+expected<void> file::try_remove(path const &path)
 {
 	if (path.empty()) {
-		return false;
+		return make_unexpected(ENOENT);
 	}
 
-	if (0 == std::remove(path.full_path())) {
-		return true;
+	int const e = (0 == std::remove(path.full_path())) ? 0 : errno;
+	stat_cache::invalidate(path);
+	if (0 != e) {
+		return make_unexpected(e);
 	}
-	return false;
+	return expected<void>();
 }
 
 /**
- * ファイルの名前を変更する。<br/>
+ * ファイルの名前を変更する（例外を送出しない）。<br/>
  * 実際にはstd::renameを呼び出す。
  * @param src 変更前のファイルのパス
  * @param dst 変更後のファイルのパス
- * @return 名前の変更に成功した場合はtrue、そうでなければfalseを返す
+ * @return 成功したかどうか、失敗した場合はerrnoの値を返す（パスが空の場合はENOENT）
  */
-bool file::rename(path const &src, path const &dst)
+expected<void> file::try_rename(path const &src, path const &dst)
 {
 	if (src.empty() || dst.empty()) {
-		return false;
+		return make_unexpected(ENOENT);
 	}
 
-	if (0 == std::rename(src.full_path(), dst.full_path())) {
-		return true;
+	int const e = (0 == std::rename(src.full_path(), dst.full_path())) ? 0 : errno;
+	stat_cache::invalidate_rename(src, dst);
+	if (0 != e) {
+		return make_unexpected(e);
 	}
-	return false;
+	return expected<void>();
 }
 
 HUMANITY_IO_NS_END
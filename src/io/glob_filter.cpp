@@ -0,0 +1,288 @@
+#include <humanity/io/glob_filter.hpp>
+#include <humanity/exception.hpp>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+HUMANITY_IO_NS_BEGIN
+
+glob_filter::glob_filter()
+	: includes_(), excludes_()
+{
+}
+
+glob_filter::~glob_filter()
+{
+}
+
+/**
+ * 対象とするファイルのパターンを登録する
+ * @param pattern 登録するパターン
+ */
+void glob_filter::include(string_view pattern)
+{
+	includes_.push_back(compile(pattern));
+}
+
+/**
+ * 除外するファイルまたはディレクトリのパターンを登録する
+ * @param pattern 登録するパターン
+ */
+void glob_filter::exclude(string_view pattern)
+{
+	excludes_.push_back(compile(pattern));
+}
+
+/**
+ * スキャンのルートディレクトリの照合状態を取得する
+ * @return ルートディレクトリの照合状態を返す
+ */
+glob_filter::state glob_filter::root() const
+{
+	state ret;
+	ret.bits_.reserve(includes_.size() + excludes_.size());
+	for (std::size_t i = 0; i < includes_.size(); ++i) {
+		ret.bits_.push_back(closure(includes_[i], 1));
+	}
+	for (std::size_t i = 0; i < excludes_.size(); ++i) {
+		ret.bits_.push_back(closure(excludes_[i], 1));
+	}
+	return ret;
+}
+
+/**
+ * サブディレクトリの照合状態を求め、その中を探索するかどうかを判定する
+ * @param parent 親ディレクトリの照合状態
+ * @param name サブディレクトリの名前
+ * @param child サブディレクトリの照合状態を受け取る変数
+ * @return 中を探索する場合はtrue、除外される場合はfalseを返す
+ */
+bool glob_filter::enter(state const &parent, string_view name, state &child) const
+{
+	std::size_t const n = includes_.size();
+	child.bits_.resize(parent.bits_.size());
+	for (std::size_t i = 0; i < excludes_.size(); ++i) {
+		uint64_t const bits = step(excludes_[i], parent.bits_[n + i], name);
+		if (0 != (bits & accepted(excludes_[i]))) {
+			return false;
+		}
+		child.bits_[n + i] = bits;
+	}
+	bool alive = includes_.empty();
+	for (std::size_t i = 0; i < n; ++i) {
+		uint64_t const bits = step(includes_[i], parent.bits_[i], name);
+		child.bits_[i] = bits;
+		// 末尾まで照合し終えた位置以外が残っていれば、中のファイルが一致し得る
+		if (0 != (bits & (accepted(includes_[i]) - 1))) {
+			alive = true;
+		}
+	}
+	return alive;
+}
+
+/**
+ * ディレクトリ中のファイルが対象かどうかを判定する
+ * @param dir ファイルを含むディレクトリの照合状態
+ * @param name ファイルの名前
+ * @return 対象の場合はtrue、除外される場合はfalseを返す
+ */
+bool glob_filter::accept(state const &dir, string_view name) const
+{
+	std::size_t const n = includes_.size();
+	for (std::size_t i = 0; i < excludes_.size(); ++i) {
+		if (0 != (step(excludes_[i], dir.bits_[n + i], name) & accepted(excludes_[i]))) {
+			return false;
+		}
+	}
+	if (includes_.empty()) {
+		return true;
+	}
+	for (std::size_t i = 0; i < n; ++i) {
+		if (0 != (step(includes_[i], dir.bits_[i], name) & accepted(includes_[i]))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * ルートからの相対パスが対象かどうかを判定する。<br/>
+ * 途中のディレクトリが除外される場合も対象外と判定する。
+ * @param rel_path ルートからの相対パス
+ * @return 対象の場合はtrue、除外される場合はfalseを返す
+ */
+bool glob_filter::match(string_view rel_path) const
+{
+	state current = root();
+	state next;
+	for (;;) {
+		std::size_t const sep = rel_path.find('/');
+		if (string_view::npos == sep) {
+			return accept(current, rel_path);
+		}
+		if (0 < sep) {
+			if (!enter(current, rel_path.substr(0, sep), next)) {
+				return false;
+			}
+			current.bits_.swap(next.bits_);
+		}
+		rel_path.remove_prefix(sep + 1);
+	}
+}
+
+/**
+ * 一つの要素をパターンと照合する
+ * @param pattern パターンの要素（"/"を含まない）
+ * @param name 照合する名前
+ * @return 一致した場合はtrue、そうでなければfalseを返す
+ */
+bool glob_filter::match_segment(string_view pattern, string_view name)
+{
+	std::size_t p = 0;
+	std::size_t n = 0;
+	// 最後に現れた"*"の次の位置と、その時点の名前の位置（一致しなかった場合はここからやり直す）
+	std::size_t star_p = string_view::npos;
+	std::size_t star_n = 0;
+	while (n < name.size()) {
+		if (p < pattern.size()) {
+			char const c = pattern[p];
+			if ('*' == c) {
+				star_p = ++p;
+				star_n = n;
+				continue;
+			}
+			if ('?' == c) {
+				++p;
+				++n;
+				continue;
+			}
+			if ('[' == c) {
+				std::size_t q = p + 1;
+				bool const negate = (q < pattern.size()) && (('!' == pattern[q]) || ('^' == pattern[q]));
+				if (negate) {
+					++q;
+				}
+				bool found = false;
+				bool first = true;
+				unsigned char const ch = static_cast<unsigned char>(name[n]);
+				while ((q < pattern.size()) && (first || (']' != pattern[q]))) {
+					first = false;
+					unsigned char lo = static_cast<unsigned char>(pattern[q]);
+					if (('\\' == lo) && (q + 1 < pattern.size())) {
+						lo = static_cast<unsigned char>(pattern[++q]);
+					}
+					unsigned char hi = lo;
+					if ((q + 2 < pattern.size()) && ('-' == pattern[q + 1]) && (']' != pattern[q + 2])) {
+						hi = static_cast<unsigned char>(pattern[q + 2]);
+						q += 2;
+					}
+					if ((lo <= ch) && (ch <= hi)) {
+						found = true;
+					}
+					++q;
+				}
+				if (q < pattern.size()) {
+					if (found != negate) {
+						p = q + 1;
+						++n;
+						continue;
+					}
+				} else if ('[' == name[n]) {
+					// 閉じていない"["は通常の文字として扱う
+					++p;
+					++n;
+					continue;
+				}
+			} else {
+				char const lit = (('\\' == c) && (p + 1 < pattern.size())) ? pattern[p + 1] : c;
+				if (lit == name[n]) {
+					p += (('\\' == c) && (p + 1 < pattern.size())) ? 2 : 1;
+					++n;
+					continue;
+				}
+			}
+		}
+		if (string_view::npos == star_p) {
+			return false;
+		}
+		p = star_p;
+		n = ++star_n;
+	}
+	while ((p < pattern.size()) && ('*' == pattern[p])) {
+		++p;
+	}
+	return p == pattern.size();
+}
+
+/**
+ * パターンを要素に分割する
+ * @param pattern パターン
+ * @return 分割したパターンを返す
+ */
+glob_filter::pattern glob_filter::compile(string_view pattern)
+{
+	glob_filter::pattern ret;
+	ret.globstar_ = 0;
+	if (string_view::npos == pattern.find('/')) {
+		// 名前だけのパターンはどの階層にも一致させる
+		ret.segments_.push_back("**");
+	}
+	while (!pattern.empty()) {
+		std::size_t const sep = pattern.find('/');
+		string_view const segment = pattern.substr(0, sep);
+		if (!segment.empty() && (segment != string_view(".", 1))) {
+			// 連続する"**"は一つにまとめる
+			if ((segment != string_view("**", 2)) || ret.segments_.empty() || ("**" != ret.segments_.back())) {
+				ret.segments_.push_back(segment.str());
+			}
+		}
+		if (string_view::npos == sep) {
+			break;
+		}
+		pattern.remove_prefix(sep + 1);
+	}
+	THROW_IF(MAX_SEGMENTS < ret.segments_.size(), std::invalid_argument, "too many segments in glob pattern");
+	for (std::size_t i = 0; i < ret.segments_.size(); ++i) {
+		if ("**" == ret.segments_[i]) {
+			ret.globstar_ |= 1ULL << i;
+		}
+	}
+	return ret;
+}
+
+/**
+ * "**"の要素を読み飛ばした位置を照合状態に加える
+ * @param p パターン
+ * @param bits 照合状態
+ * @return "**"を0個の要素に一致させた位置を加えた照合状態を返す
+ */
+uint64_t glob_filter::closure(pattern const &p, uint64_t bits)
+{
+	// "**"は連続しないため、一つ先に進めれば十分
+	return bits | ((bits & p.globstar_) << 1);
+}
+
+/**
+ * 照合状態から一つの要素を照合した後の照合状態を求める
+ * @param p パターン
+ * @param bits 照合状態
+ * @param name 照合する要素
+ * @return 照合後の照合状態を返す
+ */
+uint64_t glob_filter::step(pattern const &p, uint64_t bits, string_view name)
+{
+	// "**"の位置はその場に留まる
+	uint64_t ret = bits & p.globstar_;
+	uint64_t rest = bits & ~p.globstar_ & (accepted(p) - 1);
+	while (0 != rest) {
+		std::size_t const i = static_cast<std::size_t>(__builtin_ctzll(rest));
+		rest &= rest - 1;
+		if (match_segment(p.segments_[i], name)) {
+			ret |= 1ULL << (i + 1);
+		}
+	}
+	return closure(p, ret);
+}
+
+HUMANITY_IO_NS_END
@@ -0,0 +1,275 @@
+#include <humanity/io/directory.hpp>
+#include <humanity/io/path.hpp>
+#include <humanity/io/stat_cache.hpp>
+#include <humanity/exception.hpp>
+#include <humanity/log.hpp>
+#include "work_stealing_pool.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * 並列削除で一つのディレクトリに対応する処理単位
+ */
+struct remove_node {
+	/** 削除のルートからの相対パス（ルート自身は空文字列、ワーカーのアリーナ上にある） */
+	char const *rel_;
+	/** 親ディレクトリの中での名前（rel_の末尾の要素、ルート自身は"."） */
+	char const *name_;
+	/** 親ディレクトリ（ルートの場合はNULL） */
+	remove_node *parent_;
+	/** ディレクトリのファイルディスクリプタ（子ディレクトリを開いて削除する起点、開いていない場合は-1） */
+	int fd_;
+	/** 削除が終わっていない子ディレクトリの数と、自身のエントリの削除が終わっていなければ1を足した値 */
+	std::atomic<std::size_t> pending_;
+	/** 中のエントリを削除できなかったかどうか（報告済みのため、ディレクトリ自身の削除は試みない） */
+	std::atomic<bool> failed_;
+
+	remove_node() : rel_(""), name_("."), parent_(NULL), fd_(-1), pending_(1), failed_(false) {
+	}
+};
+
+/**
+ * ワーカーごとの作業領域
+ */
+struct remove_worker {
+	/** remove_nodeとその相対パスを確保するアリーナ（ブロックは削除全体のアリーナから受け取る） */
+	monotonic_arena arena_;
+	/** このワーカーが生成したremove_node（要素のアドレスが変わらないようにdequeで保持する） */
+	std::deque< remove_node, arena_allocator<remove_node> > nodes_;
+	/** 処理中のディレクトリのエントリ（ディレクトリごとに再利用する） */
+	directory_snapshot entries_;
+
+	explicit remove_worker(monotonic_arena &upstream)
+		: arena_(&upstream), nodes_(arena_allocator<remove_node>(arena_)), entries_()
+	{
+	}
+};
+
+/**
+ * 並列削除の処理を行う関数オブジェクト。<br/>
+ * 各ディレクトリ直下のファイルを削除し、サブディレクトリは新しいタスクとして積む。
+ * ディレクトリは最後の子ディレクトリの削除が終わった時点で、その処理を行ったスレッドが削除する。
+ */
+class parallel_remover {
+public:
+	parallel_remover(directory const &root, work_stealing_pool<remove_node*> &pool,
+			std::deque<remove_worker> &workers, rmdir_progress &progress, std::atomic<int> &error, bool measure)
+		: root_(root), pool_(pool), workers_(workers), progress_(progress), error_(error), measure_(measure)
+	{
+	}
+
+	void operator () (unsigned int worker, remove_node *node) {
+		// 親ディレクトリから一要素ずつ開くため、途中のディレクトリをシンボリックリンクに差し替えられてもツリーの外には出ない
+		directory dir;
+		int const parent_fd = (NULL == node->parent_) ? root_.descriptor() : node->parent_->fd_;
+		int const err = dir.open(parent_fd, node->name_, O_NOFOLLOW, directory::BUFFER_SIZE_DEFAULT);
+		if (0 != err) {
+			if (ENOENT != err) {
+				report(node, NULL, err);
+			}
+			complete(node);
+			return;
+		}
+
+		// エントリは全て読み込んでからiノード番号の順に削除する
+		int const fd = dir.descriptor();
+		node->fd_ = fd;
+		remove_worker &w = workers_[worker];
+		directory_snapshot &entries = w.entries_;
+		expected<void> const read = dir.try_read_all(entries);
+		if (!read) {
+			// 読み込めたエントリの削除は続ける（ディレクトリ自身の削除は失敗するので試みない）
+			report(node, NULL, read.error());
+		}
+		entries.sort_by_inode();
+		for (std::size_t i = 0; i < entries.size(); ++i) {
+			char const *name = entries.name(i);
+			if (entries.is_directory(i)) {
+				w.nodes_.emplace_back();
+				remove_node *child = &w.nodes_.back();
+				child->rel_ = make_relative(w.arena_, node->rel_, name);
+				child->name_ = child->rel_ + (std::strlen(child->rel_) - std::strlen(name));
+				child->parent_ = node;
+				node->pending_.fetch_add(1);
+				pool_.push(worker, child);
+			} else if (entries.is_link(i) || entries.is_regular(i) || (DT_UNKNOWN == entries.type(i))) {
+				// 種類を調べられなかったエントリは、既に削除されていればENOENTになる
+				uint64_t size = 0;
+				struct stat s;
+				if (measure_ && (0 == ::fstatat(fd, name, &s, AT_SYMLINK_NOFOLLOW)) && (1 >= s.st_nlink)) {
+					size = static_cast<uint64_t>(s.st_blocks) * 512;
+				}
+				if (0 == ::unlinkat(fd, name, 0)) {
+					progress_.entries_removed.fetch_add(1, std::memory_order_relaxed);
+					progress_.bytes_freed.fetch_add(size, std::memory_order_relaxed);
+				} else if (ENOENT != errno) {
+					report(node, name, errno);
+				}
+			} else {
+				report(node, name, EINVAL);
+			}
+		}
+		progress_.type_fallbacks.fetch_add(dir.type_fallbacks(), std::memory_order_relaxed);
+		// ファイルディスクリプタは子ディレクトリの削除が全て終わるまで開いておく
+		dir.release_descriptor();
+		complete(node);
+	}
+
+private:
+	/**
+	 * ディレクトリの処理が一つ終わったことを通知する。<br/>
+	 * 最後の処理であればディレクトリを閉じて親ディレクトリからの相対で削除し、親ディレクトリに通知する。
+	 * 中のエントリを削除できなかったディレクトリは、同じエラーを重ねて報告しないよう削除を試みずに親ディレクトリも失敗とする。
+	 */
+	void complete(remove_node *node) {
+		while ((NULL != node) && (1 == node->pending_.fetch_sub(1))) {
+			if (0 <= node->fd_) {
+				::close(node->fd_);
+				node->fd_ = -1;
+			}
+			remove_node * const parent = node->parent_;
+			if (NULL == parent) {
+				break; // ルートは呼び出し元が削除する
+			}
+			if (node->failed_.load(std::memory_order_relaxed)) {
+				parent->failed_.store(true, std::memory_order_relaxed);
+			} else if (0 == ::unlinkat(parent->fd_, node->name_, AT_REMOVEDIR)) {
+				progress_.entries_removed.fetch_add(1, std::memory_order_relaxed);
+			} else if (ENOENT != errno) {
+				report(parent, node->name_, errno);
+			}
+			node = parent;
+		}
+	}
+
+	static char const *make_relative(monotonic_arena &arena, char const *dir, char const *name) {
+		std::size_t const dir_length = std::strlen(dir);
+		std::size_t const n = std::strlen(name);
+		std::size_t const sep = (0 == dir_length) ? 0 : 1;
+		char *ret = static_cast<char*>(arena.allocate(dir_length + sep + n + 1, 1));
+		std::memcpy(ret, dir, dir_length);
+		ret[dir_length] = '/';
+		std::memcpy(ret + dir_length + sep, name, n + 1);
+		return ret;
+	}
+
+	/**
+	 * エラーを記録し、ディレクトリを失敗とする
+	 * @param dir エラーが発生したディレクトリ
+	 * @param name エラーが発生したエントリの名前（ディレクトリ自身の場合はNULL）
+	 * @param err errnoの値
+	 */
+	void report(remove_node *dir, char const *name, int err) {
+		int none = 0;
+		error_.compare_exchange_strong(none, err, std::memory_order_relaxed);
+		progress_.errors.fetch_add(1, std::memory_order_relaxed);
+		dir->failed_.store(true, std::memory_order_relaxed);
+		char const *rel = ('\0' == dir->rel_[0]) ? "." : dir->rel_;
+		(void)rel;
+		(void)name;
+		LOGE("failed to remove: %s%s%s (%s)", rel, (NULL == name) ? "" : "/", (NULL == name) ? "" : name, std::strerror(err));
+	}
+
+	directory const &root_;
+	work_stealing_pool<remove_node*> &pool_;
+	std::deque<remove_worker> &workers_;
+	rmdir_progress &progress_;
+	/** 最初に発生したエラーのerrnoの値 */
+	std::atomic<int> &error_;
+	/** 削除したファイルの大きさを集計するかどうか */
+	bool measure_;
+};
+
+/**
+ * 複数のスレッドを使ってディレクトリおよび内部のエントリを再帰的に削除する。<br/>
+ * サブディレクトリはそれぞれ独立したタスクとなり、異なるサブツリーのファイルが同時に削除される。
+ * 各ディレクトリは最後の子要素が削除された時点で削除される。
+ * エラーが発生しても削除できるエントリの削除は続け、最後にエラーの有無を返す。
+ * @param dir_path 削除対象のディレクトリのパス
+ * @param options スレッド数や進捗を通知するカウンタなどのオプション
+ * @return 正常に削除に成功した場合はtrue、そうでなければfalseを返す
+ */
+bool directory::rmdir(path const &dir_path, rmdir_options const &options)
+{
+	expected<void> const ret = try_rmdir(dir_path, options);
+	if (!ret && !dir_path.empty()) {
+		LOGE("failed to remove directory: %s (%s)", dir_path.full_path(), std::strerror(ret.error()));
+	}
+	return ret.has_value();
+}
+
+/**
+ * 複数のスレッドを使ってディレクトリおよび内部のエントリを再帰的に削除する（例外を送出しない）。<br/>
+ * ディレクトリが存在しない場合は成功として扱う。
+ * エラーが発生しても削除できるエントリの削除は続け、最初に発生したエラーを返す。
+ * @param dir_path 削除対象のディレクトリのパス
+ * @param options スレッド数や進捗を通知するカウンタなどのオプション
+ * @return 成功したかどうか、失敗した場合は最初に発生したエラーのerrnoの値を返す（パスが空の場合はENOENT）
+ */
+expected<void> directory::try_rmdir(path const &dir_path, rmdir_options const &options)
+{
+	if (dir_path.empty()) {
+		return make_unexpected(ENOENT);
+	}
+
+	rmdir_progress local_progress;
+	rmdir_progress &progress = (NULL == options.progress) ? local_progress : *options.progress;
+
+	directory root_dir;
+	int const err = root_dir.open(AT_FDCWD, dir_path.full_path(), 0, BUFFER_SIZE_MIN);
+	if (ENOENT == err) {
+		return expected<void>();
+	}
+	if (0 != err) {
+		progress.errors.fetch_add(1, std::memory_order_relaxed);
+		stat_cache::invalidate_tree(dir_path);
+		return make_unexpected(err);
+	}
+
+	std::atomic<int> error(0);
+	{
+		work_stealing_pool<remove_node*> pool(options.workers);
+		// 作業領域はワーカーごとのアリーナから確保し、削除の終了時にまとめて解放する
+		monotonic_arena local_arena;
+		std::deque<remove_worker> workers;
+		for (unsigned int i = 0; i < pool.workers(); ++i) {
+			workers.emplace_back((NULL == options.arena) ? local_arena : *options.arena);
+		}
+		remove_node root;
+
+		pool.push(0, &root);
+		pool.run(parallel_remover(root_dir, pool, workers, progress, error, NULL != options.progress));
+	}
+	if (0 != error.load()) {
+		stat_cache::invalidate_tree(dir_path);
+		return make_unexpected(error.load());
+	}
+
+	int e = 0;
+	if (0 != ::rmdir(dir_path.full_path())) {
+		if (ENOENT != errno) {
+			e = errno;
+			progress.errors.fetch_add(1, std::memory_order_relaxed);
+		}
+	} else {
+		progress.entries_removed.fetch_add(1, std::memory_order_relaxed);
+	}
+	stat_cache::invalidate_tree(dir_path);
+	if (0 != e) {
+		return make_unexpected(e);
+	}
+	return expected<void>();
+}
+
+HUMANITY_IO_NS_END
@@ -0,0 +1,291 @@
+#include <humanity/io/directory.hpp>
+#include <humanity/io/glob_filter.hpp>
+#include <humanity/io/path.hpp>
+#include <humanity/exception.hpp>
+#include "work_stealing_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * 並列スキャンで一つのディレクトリに対応する処理単位
+ */
+struct scan_node {
+	/** スキャンのルートからの相対パス（ルート自身は空文字列、ワーカーのアリーナ上にある） */
+	char const *rel_;
+	/** 相対パスの長さ */
+	std::size_t rel_length_;
+	/** 親ディレクトリの中での名前（rel_の末尾の要素、ルート自身は"."） */
+	char const *name_;
+	/** 親ディレクトリ（ルートの場合はNULL） */
+	scan_node *parent_;
+	/** ディレクトリのファイルディスクリプタ（子ディレクトリを開く起点、開いていない場合は-1） */
+	int fd_;
+	/** 開いていない子ディレクトリの数と、自身の列挙が終わっていなければ1を足した値 */
+	std::atomic<std::size_t> pending_;
+	/** このディレクトリを処理したワーカーの番号 */
+	unsigned int worker_;
+	/** ワーカーの結果バッファ上で、このディレクトリ直下のファイルが格納されている範囲の先頭 */
+	std::size_t begin_;
+	/** ワーカーの結果バッファ上で、このディレクトリ直下のファイルが格納されている範囲の終端 */
+	std::size_t end_;
+	/** サブディレクトリと、その前に列挙されたファイルの数の組 */
+	std::vector< std::pair<std::size_t, scan_node*> > children_;
+	/** このディレクトリのフィルタの照合状態 */
+	glob_filter::state state_;
+
+	scan_node()
+		: rel_(""), rel_length_(0), name_("."), parent_(NULL), fd_(-1), pending_(1), worker_(0), begin_(0), end_(0),
+		children_(), state_()
+	{
+	}
+
+	~scan_node() {
+		// 中断した場合は子ディレクトリが開かれないまま残るため、ここで閉じる
+		if (0 <= fd_) {
+			::close(fd_);
+		}
+	}
+};
+
+/**
+ * ワーカーごとのスキャン結果
+ */
+struct scan_worker {
+	/** scan_nodeとその相対パスを確保するアリーナ（ブロックはスキャン全体のアリーナから受け取る） */
+	monotonic_arena arena_;
+	/** 見つかったファイルの相対パス */
+	std::vector<std::string> files_;
+	/** このワーカーが生成したscan_node（要素のアドレスが変わらないようにdequeで保持する） */
+	std::deque< scan_node, arena_allocator<scan_node> > nodes_;
+	/** サブディレクトリのフィルタの照合状態を求めるための作業領域 */
+	glob_filter::state state_;
+	/** d_typeが不明だったため、fstatatで種類を調べたエントリの数 */
+	uint64_t type_fallbacks_;
+
+	explicit scan_worker(monotonic_arena &upstream)
+		: arena_(&upstream), files_(), nodes_(arena_allocator<scan_node>(arena_)), state_(), type_fallbacks_(0)
+	{
+	}
+};
+
+/**
+ * 並列スキャンの処理を行う関数オブジェクト
+ */
+class parallel_scanner {
+public:
+	parallel_scanner(directory const &root, work_stealing_pool<scan_node*> &pool, std::deque<scan_worker> &workers,
+			scan_options const &options)
+		: root_(root), pool_(pool), workers_(workers), filter_(options.filter), stat_workers_(options.stat_workers)
+	{
+	}
+
+	void operator () (unsigned int worker, scan_node *node) {
+		scan_worker &w = workers_[worker];
+		node->worker_ = worker;
+		node->begin_ = w.files_.size();
+		node->end_ = node->begin_;
+
+		// 親ディレクトリから一要素ずつ開くため、途中のディレクトリをシンボリックリンクに差し替えられてもツリーの外には出ない
+		// 列挙してから開くまでの間に消えたり差し替えられたりしたディレクトリは、逐次走査と同様に読み飛ばす
+		directory dir;
+		int const parent_fd = (NULL == node->parent_) ? root_.descriptor() : node->parent_->fd_;
+		int const err = dir.open(parent_fd, node->name_, O_NOFOLLOW, directory::BUFFER_SIZE_DEFAULT);
+		opened(node->parent_);
+		if (0 != err) {
+			THROW_IF((ENOENT != err) && (ENOTDIR != err), system_call_error, "failed to open directory", err);
+			opened(node);
+			return;
+		}
+		node->fd_ = dir.descriptor();
+		dir.set_stat_workers(stat_workers_);
+
+		int read_error = 0;
+		for (;;) {
+			// 開いた後に削除されたディレクトリの読み込みはENOENTで失敗するため、終端として扱う
+			expected<bool> const more = dir.try_next();
+			if (!more) {
+				if (ENOENT != more.error()) {
+					read_error = more.error();
+				}
+				break;
+			}
+			if (!*more || pool_.is_cancelled()) {
+				break;
+			}
+			directory_entry const &entry = dir.entry();
+			if ((0 == std::strncmp(entry.name(), ".", 2)) || (0 == std::strncmp(entry.name(), "..", 3))) {
+				continue;
+			}
+			if (entry.is_directory()) {
+				if ((NULL != filter_) && !filter_->enter(node->state_, entry.name(), w.state_)) {
+					continue;
+				}
+				w.nodes_.emplace_back();
+				scan_node *child = &w.nodes_.back();
+				if (NULL != filter_) {
+					child->state_ = w.state_;
+				}
+				child->rel_ = make_relative(w.arena_, *node, entry.name(), child->rel_length_);
+				child->name_ = child->rel_ + (child->rel_length_ - std::strlen(entry.name()));
+				child->parent_ = node;
+				node->children_.push_back(std::make_pair(w.files_.size() - node->begin_, child));
+				node->pending_.fetch_add(1);
+				pool_.push(worker, child);
+				continue;
+			}
+			if (entry.is_regular()) {
+				if ((NULL != filter_) && !filter_->accept(node->state_, entry.name())) {
+					continue;
+				}
+				w.files_.push_back(std::string());
+				make_relative(*node, entry.name(), w.files_.back());
+				continue;
+			}
+		}
+		node->end_ = w.files_.size();
+		w.type_fallbacks_ += dir.type_fallbacks();
+		// ファイルディスクリプタは子ディレクトリが全て開かれるまで開いておく（読み込みに失敗した場合も、積んだ子ディレクトリのために渡す）
+		dir.release_descriptor();
+		opened(node);
+		THROW_IF(0 != read_error, system_call_error, "failed to read directory", read_error);
+		(void)read_error;
+	}
+
+private:
+	/**
+	 * ディレクトリのファイルディスクリプタの利用が一つ終わったことを通知する。<br/>
+	 * 最後の利用であればディレクトリを閉じる。
+	 * @param node 対象のディレクトリ（NULLの場合は何もしない）
+	 */
+	static void opened(scan_node *node) {
+		if ((NULL != node) && (1 == node->pending_.fetch_sub(1)) && (0 <= node->fd_)) {
+			::close(node->fd_);
+			node->fd_ = -1;
+		}
+	}
+
+	static void make_relative(scan_node const &dir, char const *name, std::string &out) {
+		std::size_t const n = std::strlen(name);
+		out.reserve(dir.rel_length_ + n + 1);
+		out.assign(dir.rel_, dir.rel_length_);
+		if (!out.empty()) {
+			out += '/';
+		}
+		out.append(name, n);
+	}
+
+	static char const *make_relative(monotonic_arena &arena, scan_node const &dir, char const *name, std::size_t &length) {
+		std::size_t const n = std::strlen(name);
+		std::size_t const sep = (0 == dir.rel_length_) ? 0 : 1;
+		length = dir.rel_length_ + sep + n;
+		char *ret = static_cast<char*>(arena.allocate(length + 1, 1));
+		std::memcpy(ret, dir.rel_, dir.rel_length_);
+		ret[dir.rel_length_] = '/';
+		std::memcpy(ret + dir.rel_length_ + sep, name, n + 1);
+		return ret;
+	}
+
+	directory const &root_;
+	work_stealing_pool<scan_node*> &pool_;
+	std::deque<scan_worker> &workers_;
+	glob_filter const *filter_;
+	unsigned int stat_workers_;
+};
+
+/**
+ * ワーカーごとのスキャン結果を、逐次的に探索した場合と同じ順序でコンテナに移す
+ */
+static void merge(scan_node const &node, std::deque<scan_worker> &workers, contained_file_names &container)
+{
+	std::vector<std::string> &files = workers[node.worker_].files_;
+	std::size_t pos = node.begin_;
+	for (std::size_t i = 0; i < node.children_.size(); ++i) {
+		std::size_t const end = node.begin_ + node.children_[i].first;
+		for (; pos < end; ++pos) {
+			container.push_back(std::move(files[pos]));
+		}
+		merge(*node.children_[i].second, workers, container);
+	}
+	for (; pos < node.end_; ++pos) {
+		container.push_back(std::move(files[pos]));
+	}
+}
+
+/**
+ * 複数のスレッドを使ってディレクトリ中の全てのエントリを再帰的に探索し、エントリへのパスをコンテナに格納する。<br/>
+ * 見つかったサブディレクトリはそれぞれ独立したタスクとなり、手の空いたスレッドが処理を引き受ける。
+ * 格納されるパスの集合はスレッド数に関わらず scan_all(path const &, contained_file_names &) と同じになる。
+ * フィルタを指定した場合は、対象のファイルだけを格納し、除外されるディレクトリの中は探索しない。
+ * d_typeを返さないファイルシステムでは、エントリの種類をfstatatで調べ、その数を統計情報に格納する。
+ * @param dir_path 探索対象のディレクトリのパス
+ * @param container 各エントリへのパスを格納するためのコンテナ
+ * @param options スレッド数や結果の並び順などのオプション
+ * @return 正常に探索が完了した場合はtrue、そうでなければfalse
+ */
+bool directory::scan_all(path const &dir_path, contained_file_names &container, scan_options const &options)
+{
+	if (1 == options.workers) {
+		std::size_t const offset = container.size();
+		directory_walker walker(dir_path, directory_walker::DEPTH_UNLIMITED, options);
+		while (walker.next()) {
+			if (walker.entry().is_regular()) {
+				container.push_back(walker.relative_path());
+			}
+		}
+		if (scan_options::ORDER_SORTED == options.order) {
+			std::sort(container.begin() + offset, container.end());
+		}
+		if (NULL != options.stats) {
+			options.stats->type_fallbacks = walker.type_fallbacks();
+		}
+		return true;
+	}
+
+	// サブディレクトリはルートから親ディレクトリのファイルディスクリプタをたどって開く
+	directory root_dir(dir_path);
+	work_stealing_pool<scan_node*> pool(options.workers);
+	// 作業領域はワーカーごとのアリーナから確保し、スキャンの終了時にまとめて解放する
+	monotonic_arena local_arena;
+	monotonic_arena &arena = (NULL == options.arena) ? local_arena : *options.arena;
+	std::deque<scan_worker> workers;
+	for (unsigned int i = 0; i < pool.workers(); ++i) {
+		workers.emplace_back(arena);
+	}
+	scan_node root;
+	if (NULL != options.filter) {
+		root.state_ = options.filter->root();
+	}
+
+	pool.push(0, &root);
+	pool.run(parallel_scanner(root_dir, pool, workers, options));
+
+	std::size_t total = 0;
+	uint64_t type_fallbacks = 0;
+	for (std::size_t i = 0; i < workers.size(); ++i) {
+		total += workers[i].files_.size();
+		type_fallbacks += workers[i].type_fallbacks_;
+	}
+	if (NULL != options.stats) {
+		options.stats->type_fallbacks = type_fallbacks;
+	}
+	std::size_t const offset = container.size();
+	container.reserve(offset + total);
+	merge(root, workers, container);
+	if (scan_options::ORDER_SORTED == options.order) {
+		std::sort(container.begin() + offset, container.end());
+	}
+	return true;
+}
+
+HUMANITY_IO_NS_END
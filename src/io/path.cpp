@@ -2,86 +2,108 @@
 #include <humanity/exception.hpp>
 #include <humanity/string_utils.hpp>
 #include <string>
+#include <cerrno>
 #include <cstddef>
-#include <stack>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define HUMANITY_PATH_USE_AVX2
+#  endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define HUMANITY_PATH_USE_NEON
+#endif
 
 #define C_FILE_SEPARATOR '/'
 #define S_FILE_SEPARATOR "/"
 
 HUMANITY_IO_NS_BEGIN
 
-typedef std::stack<std::string> path_element_stack;
-static void split(std::string const &str, path_element_stack &elements);
-static std::string build(path_element_stack &elements);
-static std::string to_canonical(std::string const &str);
+static std::size_t append_elements(char *buf, std::size_t len, char const *src, std::size_t n, bool is_head, int &err);
+static std::size_t finish_elements(char *buf, std::size_t len);
+static std::size_t remove_last_element(char const *buf, std::size_t len);
+static std::size_t find_last_separator(char const *buf, std::size_t len);
+static std::size_t trim_trailing_separators(char const *buf, std::size_t len);
+static bool is_dot_dot(char const *buf, std::size_t len);
+static bool starts_with_dot_dot(char const *buf, std::size_t len);
+static bool is_canonical(char const *buf, std::size_t len);
+static bool is_canonical_slow(char const *buf, std::size_t len);
 
 
-/**
- * パスの内部実装用データ構造
- */
-struct path::impl {
-	/** パスを保持するインスタンス */
-	std::string path_;
-
-	impl() : path_() {
-	}
-	/** パス文字列を指定して構築するコンストラクタ */
-	impl(char const *path_str) : path_(path_str) {
-	}
-	/** パス文字列と文字列の長さを指定して構築するコンストラクタ */
-	impl(char const *path_str, std::size_t n) : path_(path_str, n) {
-	}
-	/** パス文字列を指定して構築するコンストラクタ */
-	impl(std::string const &path_str) : path_(path_str) {
-	}
-	~impl() {
-	}
-};
-
 path::path()
-	: pimpl(new impl)
+	: data_(inline_), length_(0), capacity_(INLINE_CAPACITY)
 {
+	inline_[0] = '\0';
 }
 
 /** パス文字列を指定して構築するコンストラクタ */
 path::path(std::string const &path_str)
-	: pimpl(new impl(path_str))
+	: data_(inline_), length_(0), capacity_(INLINE_CAPACITY)
 {
+	assign(path_str.data(), path_str.length());
 }
 
 /** NULL終端されたパス文字列を指定して構築するコンストラクタ */
 path::path(char const *path_str)
-	: pimpl(new impl(path_str))
+	: data_(inline_), length_(0), capacity_(INLINE_CAPACITY)
 {
+	assign(path_str, std::strlen(path_str));
 }
 
 /** パス文字列と文字列の長さを指定して構築するコンストラクタ */
 path::path(char const *path_str, std::size_t n)
-	: pimpl(new impl(path_str, n))
+	: data_(inline_), length_(0), capacity_(INLINE_CAPACITY)
 {
+	assign(path_str, n);
 }
 
 /** コピーコンストラクタ */
 path::path(path const &src)
-	: pimpl(new impl(src.pimpl->path_))
+	: data_(inline_), length_(0), capacity_(INLINE_CAPACITY)
+{
+	assign(src.data_, src.length_);
+}
+
+/** ムーブコンストラクタ */
+path::path(path &&src) noexcept
+	: data_(inline_), length_(0), capacity_(INLINE_CAPACITY)
 {
+	steal(src);
 }
 
 path::~path()
 {
+	if (data_ != inline_) {
+		delete[] data_;
+	}
 }
 
 /** 代入演算子 */
 path &path::operator = (path const &r)
 {
-	pimpl->path_ = r.pimpl->path_;
+	if (&r != this) {
+		assign(r.data_, r.length_);
+	}
+	return *this;
+}
+
+/** ムーブ代入演算子 */
+path &path::operator = (path &&r) noexcept
+{
+	if (&r != this) {
+		steal(r);
+	}
 	return *this;
 }
 
 /** 等値比較演算子 */
 bool path::operator == (path const &r) const
 {
-	return pimpl->path_ == r.pimpl->path_;
+	return (length_ == r.length_) && (0 == std::memcmp(data_, r.data_, length_));
 }
 
 /** 等値比較演算子 */
@@ -98,7 +120,7 @@ bool path::operator != (path const &r) const
  */
 path path::operator + (path const &r) const
 {
-	path ret(pimpl->path_.c_str());
+	path ret(*this);
 	ret += r;
 	return ret;
 }
@@ -110,13 +132,70 @@ path path::operator + (path const &r) const
  */
 path &path::operator += (path const &r)
 {
-	path_element_stack stack;
+	int const err = append(r);
+	THROW_IF(0 != err, std::runtime_error, "cannot over the top level directory");
+	(void)err;
+	return *this;
+}
 
-	split(pimpl->path_, stack);
-	split(r.pimpl->path_, stack);
-	pimpl->path_ = build(stack);
+/**
+ * パス文字列の結合を行う（例外を送出しない）
+ * @param r 結合するパス文字列
+ * @return 結合結果のパス、ルートより上に遡る場合はEINVALを返す
+ */
+expected<path> path::try_append(path const &r) const
+{
+	path ret(*this);
+	int const err = ret.append(r);
+	if (0 != err) {
+		return make_unexpected(err);
+	}
+	return ret;
+}
 
-	return *this;
+/**
+ * パス文字列を結合する。<br/>
+ * ルートより上に遡る".."は無視して結合を続ける。
+ * @param r 結合するパス文字列
+ * @return 成功した場合は0、ルートより上に遡る".."が含まれていた場合はEINVALを返す
+ */
+int path::append(path const &r)
+{
+	if (&r == this) {
+		path const tmp(r);
+		return append(tmp);
+	}
+
+	std::size_t const n = length_;
+
+	// 両辺が正規化済みで、右辺が".."で始まらない相対パスであれば、セパレータを挟んで繋げるだけで済む
+	if (is_canonical(r.data_, r.length_) && ((0 == n) || (r.is_relative() && !starts_with_dot_dot(r.data_, r.length_)))
+			&& is_canonical(data_, n)) {
+		if (0 == r.length_) {
+			return 0;
+		}
+		bool const need_separator = (0 < n) && (C_FILE_SEPARATOR != data_[n - 1]);
+		reserve(n + r.length_ + 1);
+		if (need_separator) {
+			data_[length_++] = C_FILE_SEPARATOR;
+		}
+		std::memcpy(data_ + length_, r.data_, r.length_);
+		length_ += r.length_;
+		data_[length_] = '\0';
+		return 0;
+	}
+
+	// 結合結果は「正規化済みの左辺 + セパレータ + 右辺 + 末尾の'/'」を超えないため、
+	// 最初に一度だけ領域を確保して、その中で左辺の正規化と右辺の追加を行う。
+	reserve(n + r.length_ + 2);
+	int err = 0;
+	std::size_t len = append_elements(data_, 0, data_, n, true, err);
+	len = append_elements(data_, len, r.data_, r.length_, 0 == n, err);
+	len = finish_elements(data_, len);
+	length_ = len;
+	data_[length_] = '\0';
+
+	return err;
 }
 
 /**
@@ -125,7 +204,7 @@ path &path::operator += (path const &r)
  */
 bool path::empty() const
 {
-	return pimpl->path_.empty();
+	return 0 == length_;
 }
 
 /**
@@ -134,10 +213,10 @@ bool path::empty() const
  */
 bool path::is_relative() const
 {
-	if (pimpl->path_.empty()) {
+	if (0 == length_) {
 		return false;
 	}
-	char const c = *pimpl->path_.begin();
+	char const c = data_[0];
 	return c == C_FILE_SEPARATOR ? false : true;
 }
 
@@ -147,7 +226,7 @@ bool path::is_relative() const
  */
 bool path::is_absolute() const
 {
-	if (pimpl->path_.empty()) {
+	if (0 == length_) {
 		return false;
 	}
 	return !is_relative();
@@ -161,30 +240,75 @@ bool path::is_absolute() const
  */
 bool path::is_parent(path const &child) const
 {
-	std::string const p = to_canonical(pimpl->path_);
-	std::string const q = to_canonical(child.pimpl->path_);
-	if (p.empty() || q.empty()) {
+	expected<bool> const ret = try_is_parent(child);
+	THROW_IF(!ret, std::runtime_error, "cannot over the top level directory");
+	return ret.value_or(false);
+}
+
+/**
+ * 引数に指定したパスとの相対パスを生成する
+ * @param child 子要素へのパス
+ * @return 正常にパスが生成された場合はそのパス、そうでなければ空のパスを返す
+ */
+path path::make_relative(path const &child) const
+{
+	expected<path> ret = try_make_relative(child);
+	THROW_IF(!ret, std::runtime_error, "cannot over the top level directory");
+	return ret ? std::move(*ret) : path();
+}
+
+/**
+ * パスが引数に指定したパスの親のパスかどうかを判定する（例外を送出しない）
+ * @param child 子要素へのパス
+ * @return 親のパスかどうか、どちらかのパスがルートより上に遡る場合はEINVALを返す
+ */
+expected<bool> path::try_is_parent(path const &child) const
+{
+	std::size_t plen = length_;
+	std::size_t qlen = child.length_;
+	if (!is_canonical(data_, length_) || !is_canonical(child.data_, child.length_)) {
+		path p(*this);
+		path q(child);
+		int const err = (0 != p.normalize()) ? EINVAL : q.normalize();
+		if (0 != err) {
+			return make_unexpected(err);
+		}
+		plen = p.length_;
+		qlen = q.length_;
+	}
+	if ((0 == plen) || (0 == qlen)) {
 		return false;
 	}
-	if (p.length() >= q.length()) {
+	if (plen >= qlen) {
 		return false;
 	}
-	return 0 == child.pimpl->path_.compare(0, pimpl->path_.length(), pimpl->path_);
+	return (child.length_ >= length_) && (0 == std::memcmp(child.data_, data_, length_));
 }
 
 /**
- * 引数に指定したパスとの相対パスを生成する
+ * 引数に指定したパスとの相対パスを生成する（例外を送出しない）
  * @param child 子要素へのパス
- * @return 正常にパスが生成された場合はそのパス、そうでなければ空のパスを返す
+ * @return 生成したパス（親のパスでない場合は空のパス）、どちらかのパスがルートより上に遡る場合はEINVALを返す
  */
-path path::make_relative(path const &child) const
+expected<path> path::try_make_relative(path const &child) const
 {
-	if (!is_parent(child)) {
+	expected<bool> const parent = try_is_parent(child);
+	if (!parent) {
+		return make_unexpected(parent.error());
+	}
+	if (!*parent) {
 		return path();
 	}
-	std::string const p = to_canonical(pimpl->path_);
-	std::string q = to_canonical(child.pimpl->path_);
-	return q.erase(0, p.length() + 1);
+	if (is_canonical(data_, length_) && is_canonical(child.data_, child.length_)) {
+		std::size_t const offset = length_ + 1;
+		return path(child.data_ + offset, child.length_ - offset);
+	}
+	path p(*this);
+	path q(child);
+	p.normalize();
+	q.normalize();
+	std::size_t const offset = p.length_ + 1;
+	return path(q.data_ + offset, q.length_ - offset);
 }
 
 /**
@@ -193,24 +317,35 @@ path path::make_relative(path const &child) const
  */
 std::string path::file_name() const
 {
-	path_element_stack stack;
-	split(pimpl->path_, stack);
-	for(; !stack.empty(); stack.pop()) {
-		path_element_stack::value_type const &top = stack.top();
-		if (top.empty()) {
-			continue;
-		}
-		if (top == std::string(".")) {
-			continue;
-		}
-		if (top == std::string("..")) {
-			THROW_IF(stack.empty(), std::runtime_error, "cannot over the top level directory");
-			stack.pop();
-			continue;
-		}
-		return top;
+	expected<std::string> ret = try_file_name();
+	THROW_IF(!ret, std::runtime_error, "cannot over the top level directory");
+	return ret ? std::move(*ret) : std::string();
+}
+
+/**
+ * パスからファイルまたはディレクトリの名前を取得する（例外を送出しない）
+ * @return ファイルまたはディレクトリの名前、パスがルートより上に遡る場合はEINVALを返す
+ */
+expected<std::string> path::try_file_name() const
+{
+	if (is_canonical(data_, length_)) {
+		return file_name_view().str();
+	}
+	path p(*this);
+	int err = 0;
+	std::size_t const len = append_elements(p.data_, 0, p.data_, p.length_, true, err);
+	if (0 != err) {
+		return make_unexpected(err);
+	}
+	if ((1 == len) && (C_FILE_SEPARATOR == p.data_[0])) {
+		return std::string(S_FILE_SEPARATOR);
+	}
+	std::size_t const sep = find_last_separator(p.data_, len);
+	std::size_t const begin = (std::string::npos == sep) ? 0 : sep + 1;
+	if ((2 == len - begin) && ('.' == p.data_[begin]) && ('.' == p.data_[begin + 1])) {
+		return std::string();
 	}
-	return std::string();
+	return std::string(p.data_ + begin, len - begin);
 }
 
 /**
@@ -219,7 +354,16 @@ std::string path::file_name() const
  */
 char const *path::full_path() const
 {
-	return pimpl->path_.c_str();
+	return data_;
+}
+
+/**
+ * パス文字列の長さを取得する
+ * @return パス文字列の長さ（終端文字を含まない）を返す
+ */
+std::size_t path::length() const
+{
+	return length_;
 }
 
 /**
@@ -228,13 +372,38 @@ char const *path::full_path() const
  */
 path path::parent() const
 {
-	std::string const p = to_canonical(pimpl->path_);
-	path_element_stack stack;
-	split(p, stack);
-	if (!stack.empty()) {
-		stack.pop();
+	expected<path> ret = try_parent();
+	THROW_IF(!ret, std::runtime_error, "cannot over the top level directory");
+	return ret ? std::move(*ret) : path();
+}
+
+/**
+ * 親ディレクトリのパスを生成する（例外を送出しない）
+ * @return 生成された親ディレクトリのパス、パスがルートより上に遡る場合はEINVALを返す
+ */
+expected<path> path::try_parent() const
+{
+	if (is_canonical(data_, length_)) {
+		// 正規化済みで親が".."で終わらなければ、文字列の切り出しだけで済む
+		string_view const v = parent_view();
+		std::size_t const sep = find_last_separator(v.data(), v.size());
+		std::size_t const begin = (std::string::npos == sep) ? 0 : sep + 1;
+		if (!is_dot_dot(v.data() + begin, v.size() - begin)) {
+			return path(v.data(), v.size());
+		}
+	}
+	path p(*this);
+	p.reserve(p.length_ + 1);
+	int err = 0;
+	std::size_t len = append_elements(p.data_, 0, p.data_, p.length_, true, err);
+	if (0 != err) {
+		return make_unexpected(err);
 	}
-	return build(stack);
+	len = remove_last_element(p.data_, len);
+	len = finish_elements(p.data_, len);
+	p.length_ = len;
+	p.data_[len] = '\0';
+	return p;
 }
 
 /**
@@ -244,99 +413,531 @@ path path::parent() const
  */
 path path::add_file_name_suffix(std::string const &suffix) const
 {
-	if (pimpl->path_.empty()) {
+	expected<path> ret = try_add_file_name_suffix(suffix);
+	THROW_IF(!ret, std::runtime_error, "cannot over the top level directory");
+	return ret ? std::move(*ret) : path();
+}
+
+/**
+ * ファイル名に接尾辞を追加したパスを生成する（例外を送出しない）
+ * @param suffix 追加する接尾辞の文字列
+ * @return 生成されたパス、パスがルートより上に遡る場合はEINVALを返す
+ */
+expected<path> path::try_add_file_name_suffix(std::string const &suffix) const
+{
+	if (0 == length_) {
 		return path(suffix);
 	}
 
-	std::string file_name(this->file_name());
-	file_name += suffix;
+	expected<std::string> file_name = try_file_name();
+	if (!file_name) {
+		return make_unexpected(file_name.error());
+	}
+	*file_name += suffix;
 
-	return this->parent() + file_name;
+	expected<path> const parent = try_parent();
+	if (!parent) {
+		return make_unexpected(parent.error());
+	}
+	return parent->try_append(path(*file_name));
 }
 
-static void split(std::string const &str, path_element_stack &elements)
+/**
+ * パスからファイルまたはディレクトリの名前を参照する。<br/>
+ * パス文字列を正規化せずに末尾の要素を切り出すため、領域を確保しない。
+ * 正規化済みのパスでは file_name と同じ文字列になる。
+ * @return パス文字列中の末尾の要素を参照するstring_viewを返す（ルートの場合は"/"、末尾が".."の場合は空）
+ */
+string_view path::file_name_view() const
+{
+	std::size_t const len = trim_trailing_separators(data_, length_);
+	if ((1 == len) && (C_FILE_SEPARATOR == data_[0])) {
+		return string_view(data_, 1);
+	}
+	std::size_t const sep = find_last_separator(data_, len);
+	std::size_t const begin = (std::string::npos == sep) ? 0 : sep + 1;
+	if (is_dot_dot(data_ + begin, len - begin)) {
+		return string_view(data_ + length_, 0);
+	}
+	return string_view(data_ + begin, len - begin);
+}
+
+/**
+ * 親ディレクトリのパスを参照する。<br/>
+ * パス文字列を正規化せずに末尾の要素を取り除いた範囲を返すため、領域を確保しない。
+ * 正規化済みで親が".."で終わらないパスでは、parent と同じ文字列になる。
+ * @return パス文字列中の親ディレクトリの範囲を参照するstring_viewを返す（親が無い場合は空、ルートの親はルート）
+ */
+string_view path::parent_view() const
+{
+	std::size_t const len = trim_trailing_separators(data_, length_);
+	if ((1 == len) && (C_FILE_SEPARATOR == data_[0])) {
+		return string_view(data_, 1);
+	}
+	std::size_t const sep = find_last_separator(data_, len);
+	if (std::string::npos == sep) {
+		return string_view(data_ + length_, 0);
+	}
+	std::size_t const end = trim_trailing_separators(data_, sep + 1);
+	return string_view(data_, end);
+}
+
+/**
+ * ファイル名の拡張子を参照する。<br/>
+ * 拡張子は末尾の要素の最後の"."以降（"."を含む）で、"."で始まるファイル名の先頭の"."は拡張子とみなさない。
+ * @return 拡張子を参照するstring_viewを返す（拡張子が無い場合は空）
+ */
+string_view path::extension() const
 {
-	if (str.empty()) {
+	string_view const name = file_name_view();
+	std::size_t const dot = name.rfind('.');
+	if ((string_view::npos == dot) || (0 == dot)) {
+		return string_view(data_ + length_, 0);
+	}
+	return name.substr(dot);
+}
+
+/**
+ * 先頭の要素を指すイテレータを取得する
+ * @return 先頭の要素を指すイテレータを返す
+ */
+path::component_iterator path::begin() const
+{
+	return component_iterator(data_, data_ + length_);
+}
+
+/**
+ * 終端を指すイテレータを取得する
+ * @return 終端を指すイテレータを返す
+ */
+path::component_iterator path::end() const
+{
+	return component_iterator();
+}
+
+/**
+ * パス文字列を置き換える
+ * @param str 新しいパス文字列
+ * @param n 新しいパス文字列の長さ
+ */
+void path::assign(char const *str, std::size_t n)
+{
+	length_ = 0;
+	reserve(n);
+	std::memmove(data_, str, n);
+	length_ = n;
+	data_[length_] = '\0';
+}
+
+/**
+ * 指定した長さのパス文字列を格納できる領域を確保する。<br/>
+ * 内部バッファに収まらない場合のみヒープ上に領域を確保し、既存のパス文字列は引き継がれる。
+ * @param n 格納したいパス文字列の長さ（終端文字を含まない）
+ */
+void path::reserve(std::size_t n)
+{
+	if (n < capacity_) {
 		return;
 	}
-	if (elements.empty() && (0 == str.find_first_of(C_FILE_SEPARATOR))) {
-		elements.push(S_FILE_SEPARATOR); // push root element
+	std::size_t capacity = capacity_ * 2;
+	if (capacity <= n) {
+		capacity = n + 1;
 	}
-	std::string tmp = str;
-	std::size_t offset = 0;
-	for (;;) {
-		std::size_t const pos = tmp.find_first_of(C_FILE_SEPARATOR, offset);
-		if (pos == std::string::npos) {
-			elements.push(tmp.substr(offset));
-			return;
+	char *buf = new char[capacity];
+	std::memcpy(buf, data_, length_ + 1);
+	if (data_ != inline_) {
+		delete[] data_;
+	}
+	data_ = buf;
+	capacity_ = capacity;
+}
+
+/**
+ * 別のパスからパス文字列を引き継ぐ。<br/>
+ * ヒープ上の領域はそのまま譲り受け、引き継ぎ元は空のパスになる。
+ * @param src 引き継ぎ元のパス
+ */
+void path::steal(path &src) noexcept
+{
+	if (data_ != inline_) {
+		delete[] data_;
+	}
+	if (src.data_ != src.inline_) {
+		data_ = src.data_;
+		capacity_ = src.capacity_;
+	} else {
+		data_ = inline_;
+		capacity_ = INLINE_CAPACITY;
+		std::memcpy(inline_, src.inline_, src.length_ + 1);
+	}
+	length_ = src.length_;
+
+	src.data_ = src.inline_;
+	src.capacity_ = INLINE_CAPACITY;
+	src.length_ = 0;
+	src.inline_[0] = '\0';
+}
+
+/**
+ * パス文字列をその場で正規化する。<br/>
+ * ルートより上に遡る".."は無視する。
+ * @return 成功した場合は0、ルートより上に遡る".."が含まれていた場合はEINVALを返す
+ */
+int path::normalize()
+{
+	if (is_canonical(data_, length_)) {
+		return 0;
+	}
+	reserve(length_ + 1);
+	int err = 0;
+	std::size_t len = append_elements(data_, 0, data_, length_, true, err);
+	len = finish_elements(data_, len);
+	length_ = len;
+	data_[length_] = '\0';
+	return err;
+}
+
+/**
+ * 正規化済みのパス文字列の末尾に、未正規化のパス文字列の各要素を追加する。<br/>
+ * 空の要素と"."は読み飛ばし、".."は直前の要素を取り除く。
+ * 書き込み位置は常に読み込み位置を追い越さないため、srcとbufは同じ領域を指していてもよい。
+ * @param buf 正規化済みのパス文字列を保持する領域（十分な大きさが確保されていること）
+ * @param len bufに格納されているパス文字列の長さ
+ * @param src 追加するパス文字列
+ * @param n srcの長さ
+ * @param is_head srcがパスの先頭要素かどうか（先頭の場合のみルート要素を解釈する）
+ * @param err ルートより上に遡る".."が含まれていた場合にEINVALを設定する変数（".."は無視する）
+ * @return 追加後のパス文字列の長さ
+ */
+static std::size_t append_elements(char *buf, std::size_t len, char const *src, std::size_t n, bool is_head, int &err)
+{
+	std::size_t pos = 0;
+	if (is_head && (0 == len) && (0 < n) && (C_FILE_SEPARATOR == src[0])) {
+		buf[len++] = C_FILE_SEPARATOR; // root element
+		pos = 1;
+	}
+	while (pos < n) {
+		if (C_FILE_SEPARATOR == src[pos]) {
+			++pos;
+			continue;
 		}
-		if (offset == pos) {
-			++offset;
+		char const * const sep = static_cast<char const*>(std::memchr(src + pos, C_FILE_SEPARATOR, n - pos));
+		std::size_t const end = (NULL == sep) ? n : static_cast<std::size_t>(sep - src);
+		std::size_t const elen = end - pos;
+
+		if ((1 == elen) && ('.' == src[pos])) {
+			// nothing to do
+		} else if ((2 == elen) && ('.' == src[pos]) && ('.' == src[pos + 1])) {
+			if ((1 == len) && (C_FILE_SEPARATOR == buf[0])) {
+				err = EINVAL;
+			} else {
+				std::size_t const last = find_last_separator(buf, len);
+				std::size_t const begin = (std::string::npos == last) ? 0 : last + 1;
+				if ((len == begin) || ((2 == len - begin) && ('.' == buf[begin]) && ('.' == buf[begin + 1]))) {
+					// 先頭から続く".."は取り除けないので、そのまま残す
+					if (0 < len) {
+						buf[len++] = C_FILE_SEPARATOR;
+					}
+					buf[len++] = '.';
+					buf[len++] = '.';
+				} else {
+					len = remove_last_element(buf, len);
+				}
+			}
 		} else {
-			elements.push(tmp.substr(offset, pos - offset));
-			tmp = tmp.substr(pos + 1);
-			offset = 0;
+			if ((0 < len) && !((1 == len) && (C_FILE_SEPARATOR == buf[0]))) {
+				buf[len++] = C_FILE_SEPARATOR;
+			}
+			std::memmove(buf + len, src + pos, elen);
+			len += elen;
 		}
+		pos = end;
 	}
+	return len;
 }
 
-static std::string build(path_element_stack &elements)
+/**
+ * 正規化済みのパス文字列を最終的な表現に整える。<br/>
+ * ".."だけで構成される相対パスは、従来の表現に合わせて末尾にセパレータを付与する。
+ * @param buf 正規化済みのパス文字列（1文字分の余裕が確保されていること）
+ * @param len パス文字列の長さ
+ * @return 整形後のパス文字列の長さ
+ */
+static std::size_t finish_elements(char *buf, std::size_t len)
 {
-	std::string ret;
-	int pop_count = 0;
-	while(!elements.empty()) {
-		path_element_stack::value_type elem = elements.top();
+	if ((2 <= len) && ('.' == buf[len - 1]) && ('.' == buf[len - 2]) && ((2 == len) || (C_FILE_SEPARATOR == buf[len - 3]))) {
+		buf[len++] = C_FILE_SEPARATOR;
+	}
+	return len;
+}
 
-		elements.pop();
+/**
+ * 正規化済みのパス文字列から末尾の要素を取り除く
+ * @param buf 正規化済みのパス文字列
+ * @param len パス文字列の長さ
+ * @return 末尾の要素を取り除いた後のパス文字列の長さ
+ */
+static std::size_t remove_last_element(char const *buf, std::size_t len)
+{
+	std::size_t const last = find_last_separator(buf, len);
+	if (std::string::npos == last) {
+		return 0;
+	}
+	if (0 == last) {
+		return 1; // keep root element
+	}
+	return last;
+}
 
-		if (elem.empty()) {
-			continue;
+/**
+ * パス文字列中の最後のセパレータの位置を探す
+ * @param buf パス文字列
+ * @param len パス文字列の長さ
+ * @return 最後のセパレータの位置、見つからない場合はstd::string::nposを返す
+ */
+static std::size_t find_last_separator(char const *buf, std::size_t len)
+{
+	while (0 < len) {
+		--len;
+		if (C_FILE_SEPARATOR == buf[len]) {
+			return len;
 		}
+	}
+	return std::string::npos;
+}
 
-		if (elem == std::string(".")) {
-			continue;
+/**
+ * パス文字列の末尾のセパレータを除いた長さを求める（ルート要素は残す）
+ * @param buf パス文字列
+ * @param len パス文字列の長さ
+ * @return 末尾のセパレータを除いた長さ
+ */
+static std::size_t trim_trailing_separators(char const *buf, std::size_t len)
+{
+	while ((1 < len) && (C_FILE_SEPARATOR == buf[len - 1])) {
+		--len;
+	}
+	return len;
+}
+
+/**
+ * 要素が".."かどうかを判定する
+ */
+static bool is_dot_dot(char const *buf, std::size_t len)
+{
+	return (2 == len) && ('.' == buf[0]) && ('.' == buf[1]);
+}
+
+/**
+ * パス文字列の先頭の要素が".."かどうかを判定する
+ */
+static bool starts_with_dot_dot(char const *buf, std::size_t len)
+{
+	return (2 <= len) && ('.' == buf[0]) && ('.' == buf[1]) && ((2 == len) || (C_FILE_SEPARATOR == buf[2]));
+}
+
+/**
+ * パス文字列が正規化済みかどうかを要素ごとに判定する。<br/>
+ * 正規化済みのパスは空の要素と"."を含まず、".."は相対パスの先頭にのみ続き、
+ * 末尾のセパレータは".."の後（finish_elementsが付与するもの）とルートのみに現れる。
+ * @param buf パス文字列
+ * @param len パス文字列の長さ
+ * @return 正規化済みの場合はtrue、そうでなければfalseを返す
+ */
+static bool is_canonical_slow(char const *buf, std::size_t len)
+{
+	if (0 == len) {
+		return true;
+	}
+	std::size_t pos = 0;
+	bool const is_absolute = (C_FILE_SEPARATOR == buf[0]);
+	if (is_absolute) {
+		if (1 == len) {
+			return true;
 		}
+		pos = 1;
+	}
+	bool leading = !is_absolute;
+	for (;;) {
+		char const * const sep = static_cast<char const*>(std::memchr(buf + pos, C_FILE_SEPARATOR, len - pos));
+		std::size_t const end = (NULL == sep) ? len : static_cast<std::size_t>(sep - buf);
+		std::size_t const elen = end - pos;
+		if ((0 == elen) || ((1 == elen) && ('.' == buf[pos]))) {
+			return false;
+		}
+		bool const dot_dot = is_dot_dot(buf + pos, elen);
+		if (dot_dot && !leading) {
+			return false;
+		}
+		leading = dot_dot;
+		if (len == end) {
+			return !dot_dot;
+		}
+		if (len == end + 1) {
+			return dot_dot;
+		}
+		pos = end + 1;
+	}
+}
 
-		if (elem == std::string("..")) {
-			++pop_count;
-			continue;
+/**
+ * "/"の直後に"/"または"."が現れる位置が無いかを調べる（スカラー版）。<br/>
+ * 相対パスの先頭は"/"の直後として扱う。
+ * @param buf パス文字列
+ * @param len パス文字列の長さ
+ * @param pos 調べ始める位置
+ * @param after_sep 直前の文字が"/"かどうか
+ * @return 該当する位置が見つかった場合はtrue、そうでなければfalseを返す
+ */
+static bool has_dot_or_separator_after_separator_scalar(char const *buf, std::size_t len, std::size_t pos, bool after_sep)
+{
+	for (; pos < len; ++pos) {
+		char const c = buf[pos];
+		if (after_sep && ((C_FILE_SEPARATOR == c) || ('.' == c))) {
+			return true;
 		}
+		after_sep = (C_FILE_SEPARATOR == c);
+	}
+	return false;
+}
 
-		if (0 < pop_count) {
-			elements.push(elem);
-			for (int i = 0; i < pop_count; ++i) {
-				if (elements.empty()) {
-					if (elem == S_FILE_SEPARATOR) {
-						break;
-					} else {
-						ret.insert(0, "../");
-					}
-				} else {
-					elem = elements.top();
-					elements.pop();
-				}
-			}
-			THROW_IF(elements.empty() && (elem == S_FILE_SEPARATOR), std::runtime_error, "cannot over the top level directory");
-			pop_count = 0;
-			continue;
+#if defined(__SSE2__)
+/**
+ * has_dot_or_separator_after_separator_scalarの16バイト単位の処理。<br/>
+ * 16バイトに満たない末尾は、末尾から16バイトを読み直して未確認の位置だけを調べる。
+ * AVX2版の残りの処理にも使うため、呼び出し元に展開させる（AVX2版ではVEX形式の命令になり、SSEとの切り替えが起きない）。
+ * @param carry 直前の文字が"/"の場合は1、そうでなければ0
+ */
+static inline __attribute__((always_inline)) bool scan_blocks_sse2(char const *buf, std::size_t len, std::size_t pos, unsigned int carry)
+{
+	__m128i const sep = _mm_set1_epi8(C_FILE_SEPARATOR);
+	__m128i const dot = _mm_set1_epi8('.');
+	for (; pos + 16 <= len; pos += 16) {
+		__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + pos));
+		unsigned int const ms = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, sep)));
+		unsigned int const md = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, dot)));
+		if (0 != (((ms << 1) | carry) & (ms | md) & 0xFFFFU)) {
+			return true;
 		}
+		carry = (ms >> 15) & 1U;
+	}
+	if (pos >= len) {
+		return false;
+	}
+	if (len < 16) {
+		return has_dot_or_separator_after_separator_scalar(buf, len, pos, 0 != carry);
+	}
+	std::size_t const off = len - 16;
+	unsigned int const skip = static_cast<unsigned int>(pos - off);
+	__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(buf + off));
+	unsigned int const ms = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, sep)));
+	unsigned int const md = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, dot)));
+	unsigned int const after = ((ms << 1) & ~(1U << skip)) | (carry << skip);
+	return 0 != (after & (ms | md) & (0xFFFFU << skip) & 0xFFFFU);
+}
+
+/**
+ * has_dot_or_separator_after_separator_scalarのSSE2版（16バイトずつ調べる）
+ */
+static bool has_dot_or_separator_after_separator_sse2(char const *buf, std::size_t len, std::size_t pos, bool after_sep)
+{
+	return scan_blocks_sse2(buf, len, pos, after_sep ? 1U : 0U);
+}
+#endif
 
-		if (!ret.empty() && (elem != std::string(S_FILE_SEPARATOR))) {
-			ret.insert(0, 1, C_FILE_SEPARATOR);
+#if defined(HUMANITY_PATH_USE_AVX2)
+/**
+ * has_dot_or_separator_after_separator_scalarのAVX2版（32バイトずつ調べ、残りは16バイト単位で調べる）
+ */
+__attribute__((target("avx2")))
+static bool has_dot_or_separator_after_separator_avx2(char const *buf, std::size_t len, std::size_t pos, bool after_sep)
+{
+	__m256i const sep = _mm256_set1_epi8(C_FILE_SEPARATOR);
+	__m256i const dot = _mm256_set1_epi8('.');
+	uint32_t carry = after_sep ? 1U : 0U;
+	for (; pos + 32 <= len; pos += 32) {
+		__m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(buf + pos));
+		uint32_t const ms = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, sep)));
+		uint32_t const md = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, dot)));
+		if (0 != (((ms << 1) | carry) & (ms | md))) {
+			return true;
 		}
-		ret.insert(0, elem);
+		carry = ms >> 31;
 	}
-	for (int i = 0; i < pop_count; ++i) {
-		ret.insert(0, "../");
+	return scan_blocks_sse2(buf, len, pos, carry);
+}
+#endif
+
+#if defined(HUMANITY_PATH_USE_NEON)
+/**
+ * has_dot_or_separator_after_separator_scalarのNEON版（16バイトずつ調べる）。<br/>
+ * 1バイトずらした読み込みで直前の文字と比較する。
+ */
+static bool has_dot_or_separator_after_separator_neon(char const *buf, std::size_t len, std::size_t pos, bool after_sep)
+{
+	if (pos < len) {
+		if (after_sep && ((C_FILE_SEPARATOR == buf[pos]) || ('.' == buf[pos]))) {
+			return true;
+		}
+		++pos;
 	}
-	return ret;
+	uint8x16_t const sep = vdupq_n_u8(C_FILE_SEPARATOR);
+	uint8x16_t const dot = vdupq_n_u8('.');
+	for (; pos + 16 <= len; pos += 16) {
+		uint8x16_t const prev = vld1q_u8(reinterpret_cast<uint8_t const*>(buf + pos - 1));
+		uint8x16_t const cur = vld1q_u8(reinterpret_cast<uint8_t const*>(buf + pos));
+		uint8x16_t const hit = vandq_u8(vceqq_u8(prev, sep), vorrq_u8(vceqq_u8(cur, sep), vceqq_u8(cur, dot)));
+		uint64x2_t const h = vreinterpretq_u64_u8(hit);
+		if (0 != (vgetq_lane_u64(h, 0) | vgetq_lane_u64(h, 1))) {
+			return true;
+		}
+	}
+	return has_dot_or_separator_after_separator_scalar(buf, len, pos, (0 < pos) && (C_FILE_SEPARATOR == buf[pos - 1]));
 }
+#endif
 
-static std::string to_canonical(std::string const &str)
+typedef bool (*separator_scanner)(char const *, std::size_t, std::size_t, bool);
+
+/**
+ * 実行環境で使える最も速いhas_dot_or_separator_after_separatorの実装を選ぶ
+ */
+static separator_scanner select_separator_scanner()
 {
-	path_element_stack stack;
-	split(str, stack);
-	return build(stack);
+#if defined(HUMANITY_PATH_USE_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return has_dot_or_separator_after_separator_avx2;
+	}
+#endif
+#if defined(__SSE2__)
+	return has_dot_or_separator_after_separator_sse2;
+#elif defined(HUMANITY_PATH_USE_NEON)
+	return has_dot_or_separator_after_separator_neon;
+#else
+	return has_dot_or_separator_after_separator_scalar;
+#endif
+}
+
+/**
+ * パス文字列が正規化済みかどうかを判定する。<br/>
+ * 正規化が必要なパスには必ず「"/"の直後（相対パスの先頭を含む）の"/"か"."」か末尾の"/"が現れるため、
+ * まずSIMD命令でそれらが無いことを確認し、見つかった場合のみ要素ごとの判定を行う。
+ * 隠しファイルや先頭の".."もここで見つかるため、その場合は要素ごとの判定で確定させる。
+ * @param buf パス文字列
+ * @param len パス文字列の長さ
+ * @return 正規化済みの場合はtrue、そうでなければfalseを返す
+ */
+static bool is_canonical(char const *buf, std::size_t len)
+{
+	static separator_scanner const scan = select_separator_scanner();
+	if (len <= 1) {
+		return is_canonical_slow(buf, len);
+	}
+	bool const is_absolute = (C_FILE_SEPARATOR == buf[0]);
+	if ((C_FILE_SEPARATOR == buf[len - 1]) || scan(buf, len, is_absolute ? 1 : 0, true)) {
+		return is_canonical_slow(buf, len);
+	}
+	return true;
 }
 
 HUMANITY_IO_NS_END
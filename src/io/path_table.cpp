@@ -0,0 +1,389 @@
+#include <humanity/io/path_table.hpp>
+#include <humanity/io/path.hpp>
+#include <humanity/exception.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define C_FILE_SEPARATOR '/'
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * 要素を探すためのキー（親の要素と名前の組）
+ */
+struct path_node_key {
+	path_node const *parent_;
+	string_view name_;
+	/** 親のハッシュ値と名前から計算した要素のハッシュ値 */
+	std::size_t hash_;
+
+	bool operator == (path_node_key const &r) const {
+		return (parent_ == r.parent_) && (name_ == r.name_);
+	}
+};
+
+struct path_node_key_hash {
+	std::size_t operator () (path_node_key const &key) const {
+		return key.hash_;
+	}
+};
+
+/**
+ * 親のハッシュ値に要素の名前を混ぜ込んだハッシュ値を計算する
+ */
+static std::size_t combine_hash(std::size_t parent_hash, string_view name)
+{
+	// FNV-1a
+	uint64_t h = 14695981039346656037ULL;
+	for (std::size_t i = 0; i < name.size(); ++i) {
+		h ^= static_cast<unsigned char>(name[i]);
+		h *= 1099511628211ULL;
+	}
+	std::size_t const n = static_cast<std::size_t>(h ^ (h >> 32));
+	return parent_hash ^ (n + static_cast<std::size_t>(0x9e3779b97f4a7c15ULL) + (parent_hash << 6) + (parent_hash >> 2));
+}
+
+/**
+ * テーブルのシャード。<br/>
+ * 要素はシャードごとの領域に確保し、テーブルが破棄されるまで移動も解放もしない。
+ */
+struct path_table_shard {
+	/** 名前を格納する領域の単位 */
+	enum { NAME_CHUNK_SIZE = 16 * 1024 };
+
+	std::mutex mutex_;
+	std::unordered_map<path_node_key, path_node const*, path_node_key_hash> index_;
+	std::deque<path_node> nodes_;
+	/** 名前を格納する領域の一覧 */
+	std::vector<char*> chunks_;
+	/** 最後の領域の使用済みの大きさ */
+	std::size_t chunk_used_;
+	/** 確保した名前の領域の合計 */
+	std::size_t chunk_bytes_;
+
+	path_table_shard() : mutex_(), index_(), nodes_(), chunks_(), chunk_used_(NAME_CHUNK_SIZE), chunk_bytes_(0) {
+	}
+	~path_table_shard() {
+		for (std::size_t i = 0; i < chunks_.size(); ++i) {
+			std::free(chunks_[i]);
+		}
+	}
+
+	/** 名前を領域に複写する（ミューテックスを取得した状態で呼び出す） */
+	char const *store_name(string_view name) {
+		if (NAME_CHUNK_SIZE < name.size()) {
+			// 大きな名前は専用の領域に格納し、現在の領域はそのまま使い続ける
+			char *p = static_cast<char*>(std::malloc(name.size()));
+			THROW_IF(NULL == p, std::bad_alloc);
+			chunks_.insert(chunks_.end() - (chunks_.empty() ? 0 : 1), p);
+			chunk_bytes_ += name.size();
+			std::memcpy(p, name.data(), name.size());
+			return p;
+		}
+		if (NAME_CHUNK_SIZE - chunk_used_ < name.size()) {
+			char *p = static_cast<char*>(std::malloc(NAME_CHUNK_SIZE));
+			THROW_IF(NULL == p, std::bad_alloc);
+			chunks_.push_back(p);
+			chunk_bytes_ += NAME_CHUNK_SIZE;
+			chunk_used_ = 0;
+		}
+		char *p = chunks_.back() + chunk_used_;
+		std::memcpy(p, name.data(), name.size());
+		chunk_used_ += name.size();
+		return p;
+	}
+};
+
+struct path_table::impl {
+	/** 絶対パスのルート（"/"） */
+	path_node root_;
+	/** 相対パスのルート（カレントディレクトリ） */
+	path_node current_;
+	/** 登録された要素の数（ルートを除く） */
+	mutable std::atomic<std::size_t> size_;
+	mutable path_table_shard shards_[SHARDS];
+
+	impl() : root_(), current_(), size_(0) {
+		root_.parent_ = NULL;
+		root_.name_ = "/";
+		root_.name_length_ = 1;
+		root_.depth_ = 0;
+		root_.hash_ = combine_hash(0, string_view("/", 1));
+		current_.parent_ = NULL;
+		current_.name_ = "";
+		current_.name_length_ = 0;
+		current_.depth_ = 0;
+		current_.hash_ = combine_hash(1, string_view());
+	}
+
+	/**
+	 * 親の要素の下にある名前の要素を探し、無ければ登録する
+	 * @param parent 親の要素
+	 * @param name 要素の名前（セパレータを含まないこと）
+	 * @param create 見つからなかった場合に登録するかどうか
+	 * @return 見つかったか登録した要素、createがfalseで見つからなかった場合はNULLを返す
+	 */
+	path_node const *child(path_node const *parent, string_view name, bool create) const {
+		path_node_key key = { parent, name, combine_hash(parent->hash_, name) };
+		path_table_shard &shard = shards_[key.hash_ % SHARDS];
+		std::lock_guard<std::mutex> lock(shard.mutex_);
+		std::unordered_map<path_node_key, path_node const*, path_node_key_hash>::const_iterator it = shard.index_.find(key);
+		if (shard.index_.end() != it) {
+			return it->second;
+		}
+		if (!create) {
+			return NULL;
+		}
+		shard.nodes_.push_back(path_node());
+		path_node &node = shard.nodes_.back();
+		node.parent_ = parent;
+		node.name_ = shard.store_name(name);
+		node.name_length_ = static_cast<uint32_t>(name.size());
+		node.depth_ = parent->depth_ + 1;
+		node.hash_ = key.hash_;
+		key.name_ = string_view(node.name_, node.name_length_);
+		shard.index_.insert(std::make_pair(key, &node));
+		size_.fetch_add(1, std::memory_order_relaxed);
+		return &node;
+	}
+
+	/**
+	 * 要素から".."をたどる。<br/>
+	 * 通常は親の要素を返すが、カレントディレクトリと".."の要素の下では
+	 * 先頭から続く".."を取り除けないので、".."を要素として残す。
+	 * @param node 起点の要素
+	 * @param create ".."の要素が見つからなかった場合に登録するかどうか
+	 * @return たどった先の要素、createがfalseで見つからなかった場合はNULLを返す
+	 */
+	path_node const *up(path_node const *node, bool create) const {
+		if (&root_ == node) {
+			THROW(std::runtime_error, "cannot over the top level directory");
+			return NULL;
+		}
+		bool const is_dotdot = (2 == node->name_length_) && ('.' == node->name_[0]) && ('.' == node->name_[1]);
+		if ((&current_ != node) && !is_dotdot) {
+			return node->parent_;
+		}
+		return child(node, string_view("..", 2), create);
+	}
+
+	/**
+	 * パス文字列を正規化しながら要素をたどる。<br/>
+	 * 空の要素と"."は読み飛ばし、".."は親の要素に戻る（path の正規化と同じ規則）。
+	 * @param str パス文字列
+	 * @param n パス文字列の長さ
+	 * @param create 見つからなかった要素を登録するかどうか
+	 * @return 末尾の要素、createがfalseで見つからなかった場合はNULLを返す
+	 */
+	path_node const *lookup(char const *str, std::size_t n, bool create) const {
+		std::size_t pos = 0;
+		path_node const *node = &current_;
+		if ((0 < n) && (C_FILE_SEPARATOR == str[0])) {
+			node = &root_;
+			pos = 1;
+		}
+		while (pos < n) {
+			if (C_FILE_SEPARATOR == str[pos]) {
+				++pos;
+				continue;
+			}
+			char const * const sep = static_cast<char const*>(std::memchr(str + pos, C_FILE_SEPARATOR, n - pos));
+			std::size_t const end = (NULL == sep) ? n : static_cast<std::size_t>(sep - str);
+			string_view const name(str + pos, end - pos);
+			pos = end;
+
+			if ((1 == name.size()) && ('.' == name[0])) {
+				continue;
+			}
+			node = ((2 == name.size()) && ('.' == name[0]) && ('.' == name[1])) ? up(node, create) : child(node, name, create);
+			if (NULL == node) {
+				return NULL;
+			}
+		}
+		return node;
+	}
+};
+
+/**
+ * 空のテーブルを構築する
+ */
+path_table::path_table()
+	: pimpl(new impl())
+{
+}
+
+path_table::~path_table()
+{
+}
+
+/**
+ * パスを正規化して登録する。<br/>
+ * 既に同じパスが登録されている場合は、そのパスのハンドルを返す。
+ * @param path 登録するパス
+ * @return パスのハンドルを返す
+ */
+path_handle path_table::insert(path const &path)
+{
+	return insert(path.full_path(), path.length());
+}
+
+/**
+ * パス文字列を正規化して登録する
+ * @param path_str 登録するパス文字列
+ * @param n パス文字列の長さ
+ * @return パスのハンドルを返す
+ */
+path_handle path_table::insert(char const *path_str, std::size_t n)
+{
+	return path_handle(pimpl->lookup(path_str, n, true));
+}
+
+/**
+ * 登録済みのパスの直下に要素を登録する。<br/>
+ * ディレクトリの走査結果を登録する場合など、親のハンドルが既にある場合は
+ * パス全体をたどらずに一要素分の処理だけで登録できる。
+ * @param parent 親のハンドル
+ * @param name 要素の名前（セパレータを含まないこと。"."と".."は正規化される）
+ * @return 登録した要素のハンドル、親のハンドルが空の場合は空のハンドルを返す
+ */
+path_handle path_table::insert(path_handle const &parent, string_view name)
+{
+	if (parent.empty()) {
+		return path_handle();
+	}
+	if (name.empty() || ((1 == name.size()) && ('.' == name[0]))) {
+		return parent;
+	}
+	if ((2 == name.size()) && ('.' == name[0]) && ('.' == name[1])) {
+		return path_handle(pimpl->up(parent.node_, true));
+	}
+	return path_handle(pimpl->child(parent.node_, name, true));
+}
+
+/**
+ * 登録済みのパスを探す
+ * @param path 探すパス
+ * @return 登録されている場合はそのハンドル、そうでなければ空のハンドルを返す
+ */
+path_handle path_table::find(path const &path) const
+{
+	return path_handle(pimpl->lookup(path.full_path(), path.length(), false));
+}
+
+/**
+ * ルートディレクトリ（"/"）のハンドルを取得する
+ * @return ルートディレクトリのハンドルを返す
+ */
+path_handle path_table::root() const
+{
+	return path_handle(&pimpl->root_);
+}
+
+/**
+ * 相対パスの起点（カレントディレクトリ）のハンドルを取得する
+ * @return カレントディレクトリのハンドルを返す
+ */
+path_handle path_table::current() const
+{
+	return path_handle(&pimpl->current_);
+}
+
+/**
+ * 登録されている要素の数を取得する
+ * @return 登録されている要素の数（ルートを除く）を返す
+ */
+std::size_t path_table::size() const
+{
+	return pimpl->size_.load(std::memory_order_relaxed);
+}
+
+/**
+ * テーブルが使用しているメモリの概算を取得する
+ * @return 要素、名前、索引に使用しているバイト数を返す
+ */
+std::size_t path_table::memory_usage() const
+{
+	std::size_t ret = sizeof(impl);
+	for (std::size_t i = 0; i < SHARDS; ++i) {
+		path_table_shard &shard = pimpl->shards_[i];
+		std::lock_guard<std::mutex> lock(shard.mutex_);
+		ret += shard.nodes_.size() * sizeof(path_node);
+		ret += shard.chunk_bytes_;
+		ret += shard.index_.bucket_count() * sizeof(void*);
+		ret += shard.index_.size() * (sizeof(path_node_key) + sizeof(path_node const*) + 2 * sizeof(void*));
+	}
+	return ret;
+}
+
+/**
+ * ハンドルが絶対パスを表しているかどうかを判定する
+ * @return 絶対パスの場合はtrue、そうでなければfalseを返す
+ */
+bool path_handle::is_absolute() const
+{
+	if (NULL == node_) {
+		return false;
+	}
+	path_node const *p = node_;
+	while (NULL != p->parent_) {
+		p = p->parent_;
+	}
+	return (1 == p->name_length_) && (C_FILE_SEPARATOR == p->name_[0]);
+}
+
+/**
+ * ハンドルが表す正規化済みのパス文字列を生成する
+ * @return パス文字列を返す
+ */
+std::string path_handle::str() const
+{
+	std::string ret;
+	if (NULL == node_) {
+		return ret;
+	}
+	std::vector<path_node const*> nodes;
+	nodes.reserve(node_->depth_ + 1);
+	std::size_t len = 0;
+	for (path_node const *p = node_; NULL != p; p = p->parent_) {
+		nodes.push_back(p);
+		len += p->name_length_ + 1;
+	}
+	ret.reserve(len + 1);
+
+	// nodesの末尾がルート（"/"または空文字列）
+	ret.append(nodes.back()->name_, nodes.back()->name_length_);
+	for (std::size_t i = nodes.size() - 1; 0 < i--; ) {
+		if (i + 2 != nodes.size()) {
+			ret += C_FILE_SEPARATOR;
+		}
+		ret.append(nodes[i]->name_, nodes[i]->name_length_);
+	}
+
+	// 従来の表現に合わせて、".."で終わる相対パスの末尾にはセパレータを付与する
+	if ((2 == node_->name_length_) && ('.' == node_->name_[0]) && ('.' == node_->name_[1])) {
+		ret += C_FILE_SEPARATOR;
+	}
+	return ret;
+}
+
+/**
+ * ハンドルが表す正規化済みのパスを生成する
+ * @return パスを返す
+ */
+path path_handle::to_path() const
+{
+	std::string const s = str();
+	return path(s.data(), s.size());
+}
+
+HUMANITY_IO_NS_END
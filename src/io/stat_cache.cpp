@@ -0,0 +1,361 @@
+#include <humanity/io/stat_cache.hpp>
+#include <humanity/io/path.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * キャッシュしたlstatの結果
+ */
+struct stat_cache_entry {
+	/** lstatが成功した場合は0、失敗した場合はerrnoの値 */
+	int error_;
+	/** st_modeの値 */
+	uint32_t mode_;
+	/** エントリが無効になる時刻（steady_clockのナノ秒） */
+	int64_t expires_;
+};
+
+/**
+ * キャッシュのシャード。<br/>
+ * ヒット数とミス数もシャードごとに数え、カウンタの更新が他のコアと競合しないようにキャッシュラインに揃える。
+ */
+struct alignas(64) stat_cache_shard {
+	std::mutex mutex_;
+	std::unordered_map<std::string, stat_cache_entry> entries_;
+	std::atomic<uint64_t> hits_;
+	std::atomic<uint64_t> misses_;
+	/** エントリを破棄するたびに増える値（lstatの実行中に破棄されたかどうかを判定する） */
+	uint64_t generation_;
+
+	stat_cache_shard() : mutex_(), entries_(), hits_(0), misses_(0), generation_(0) {
+	}
+
+	/** 期限切れのエントリを取り除き、それでも上限に達していれば全て取り除く（ミューテックスを取得した状態で呼び出す） */
+	void shrink(int64_t now) {
+		for (std::unordered_map<std::string, stat_cache_entry>::iterator it = entries_.begin(); it != entries_.end(); ) {
+			if (it->second.expires_ <= now) {
+				it = entries_.erase(it);
+			} else {
+				++it;
+			}
+		}
+		if (entries_.size() >= stat_cache::MAX_ENTRIES_PER_SHARD) {
+			entries_.clear();
+		}
+	}
+};
+
+/**
+ * キャッシュ全体の状態
+ */
+struct stat_cache_state {
+	std::atomic<bool> enabled_;
+	std::atomic<int64_t> ttl_;
+	stat_cache_shard shards_[stat_cache::SHARDS];
+
+	stat_cache_state() : enabled_(false), ttl_(0) {
+	}
+
+	/** プロセスで一つのインスタンスを取得する（終了時に他のスレッドから使われる可能性があるため解放しない） */
+	static stat_cache_state &instance() {
+		// newではキャッシュラインへの整列が保証されないため、整列した静的領域に構築する
+		alignas(stat_cache_state) static char storage[sizeof(stat_cache_state)];
+		static stat_cache_state *s = new (storage) stat_cache_state();
+		return *s;
+	}
+
+	stat_cache_shard &shard_of(std::string const &key) {
+		return shards_[std::hash<std::string>()(key) % stat_cache::SHARDS];
+	}
+};
+
+/**
+ * パスからキャッシュのキーを作る。<br/>
+ * 連続したセパレータと"."の要素だけを取り除き、"/a//b"や"/a/./b"を"/a/b"と同じキーにする。
+ * lstatは".."の前や末尾のセパレータの前にあるシンボリックリンクをたどり、末尾のセパレータがあるとファイルに対してENOTDIRになるため、
+ * ".."の要素を含むパスと、末尾がセパレータか"."で終わるパスは字面が同じでも結果が異なる。これらのパスはキャッシュしない。
+ * @param p 対象のパス
+ * @param key キーを受け取る文字列
+ * @return キャッシュできるパスの場合はtrue、そうでなければfalseを返す
+ */
+static bool make_key(path const &p, std::string &key)
+{
+	char const * const str = p.full_path();
+	std::size_t const n = p.length();
+	key.clear();
+	key.reserve(n);
+	std::size_t pos = 0;
+	if ((0 < n) && ('/' == str[0])) {
+		key += '/';
+		pos = 1;
+	}
+	bool named = false;
+	bool dir_only = false;
+	while (pos < n) {
+		if ('/' == str[pos]) {
+			dir_only = true;
+			++pos;
+			continue;
+		}
+		std::size_t end = pos;
+		while ((end < n) && ('/' != str[end])) {
+			++end;
+		}
+		std::size_t const len = end - pos;
+		if ((2 == len) && ('.' == str[pos]) && ('.' == str[pos + 1])) {
+			return false;
+		}
+		if ((1 == len) && ('.' == str[pos])) {
+			dir_only = true;
+		} else {
+			if (!key.empty() && ('/' != key[key.length() - 1])) {
+				key += '/';
+			}
+			key.append(str + pos, len);
+			named = true;
+			dir_only = false;
+		}
+		pos = end;
+	}
+	if (named && dir_only) {
+		return false;
+	}
+	if (key.empty()) {
+		key = ".";
+	}
+	return true;
+}
+
+static int lstat_mode_uncached(path const &path, uint32_t &mode)
+{
+	struct stat st;
+	if (0 != ::lstat(path.full_path(), &st)) {
+		return errno;
+	}
+	mode = static_cast<uint32_t>(st.st_mode);
+	return 0;
+}
+
+static int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * キャッシュを有効にする。<br/>
+ * 既に有効な場合は有効期間だけを変更する。
+ * @param ttl_ms キャッシュしたエントリの有効期間（ミリ秒）
+ */
+void stat_cache::enable(unsigned int ttl_ms)
+{
+	stat_cache_state &s = stat_cache_state::instance();
+	s.ttl_.store(static_cast<int64_t>(ttl_ms) * 1000000, std::memory_order_relaxed);
+	s.enabled_.store(true, std::memory_order_release);
+}
+
+/**
+ * キャッシュを無効にして、キャッシュしたエントリを全て破棄する
+ */
+void stat_cache::disable()
+{
+	stat_cache_state::instance().enabled_.store(false, std::memory_order_release);
+	invalidate_all();
+}
+
+/**
+ * キャッシュが有効かどうかを判定する
+ * @return キャッシュが有効な場合はtrue、そうでなければfalseを返す
+ */
+bool stat_cache::is_enabled()
+{
+	return stat_cache_state::instance().enabled_.load(std::memory_order_acquire);
+}
+
+/**
+ * 指定したパスのエントリを破棄する。<br/>
+ * キャッシュしないパス（".."を含むパスなど）を指定した場合は、どのエントリに当たるかが分からないため全て破棄する。
+ * @param path 破棄するエントリのパス
+ */
+void stat_cache::invalidate(path const &path)
+{
+	if (!is_enabled()) {
+		return;
+	}
+	std::string key;
+	if (!make_key(path, key)) {
+		invalidate_all();
+		return;
+	}
+	stat_cache_shard &shard = stat_cache_state::instance().shard_of(key);
+	std::lock_guard<std::mutex> lock(shard.mutex_);
+	shard.entries_.erase(key);
+	++shard.generation_;
+}
+
+/**
+ * 指定したパスとその下にある全てのエントリを破棄する。<br/>
+ * ディレクトリを削除・リネームした場合に使う。全てのシャードを走査するため、invalidateより重い。
+ * キャッシュしないパス（".."を含むパスなど）を指定した場合は全て破棄する。
+ * @param path 破棄するディレクトリのパス
+ */
+void stat_cache::invalidate_tree(path const &path)
+{
+	if (!is_enabled() || path.empty()) {
+		return;
+	}
+	std::string key;
+	if (!make_key(path, key)) {
+		invalidate_all();
+		return;
+	}
+	stat_cache_state &s = stat_cache_state::instance();
+	for (std::size_t i = 0; i < SHARDS; ++i) {
+		stat_cache_shard &shard = s.shards_[i];
+		std::lock_guard<std::mutex> lock(shard.mutex_);
+		++shard.generation_;
+		for (std::unordered_map<std::string, stat_cache_entry>::iterator it = shard.entries_.begin(); it != shard.entries_.end(); ) {
+			std::string const &k = it->first;
+			bool const under = (0 == k.compare(0, key.length(), key))
+				&& ((k.length() == key.length()) || ('/' == k[key.length()]) || ('/' == key[key.length() - 1]));
+			if (under) {
+				it = shard.entries_.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+/**
+ * 名前を変更したパスのエントリを破棄する。<br/>
+ * 変更後のパスがディレクトリの場合だけ、その下のエントリも含めて破棄する。
+ * ファイルの場合は全てのシャードを走査せずに済むため、大量のファイルの名前を変更する場合に軽い。
+ * @param src 変更前のパス
+ * @param dst 変更後のパス
+ */
+void stat_cache::invalidate_rename(path const &src, path const &dst)
+{
+	if (!is_enabled()) {
+		return;
+	}
+	struct stat st;
+	if ((0 == ::lstat(dst.full_path(), &st)) && S_ISDIR(st.st_mode)) {
+		invalidate_tree(src);
+		invalidate_tree(dst);
+	} else {
+		invalidate(src);
+		invalidate(dst);
+	}
+}
+
+/**
+ * キャッシュしたエントリを全て破棄する
+ */
+void stat_cache::invalidate_all()
+{
+	stat_cache_state &s = stat_cache_state::instance();
+	for (std::size_t i = 0; i < SHARDS; ++i) {
+		std::lock_guard<std::mutex> lock(s.shards_[i].mutex_);
+		s.shards_[i].entries_.clear();
+		++s.shards_[i].generation_;
+	}
+}
+
+/**
+ * キャッシュにヒットした回数を取得する
+ * @return キャッシュにヒットした回数を返す
+ */
+uint64_t stat_cache::hits()
+{
+	stat_cache_state &s = stat_cache_state::instance();
+	uint64_t ret = 0;
+	for (std::size_t i = 0; i < SHARDS; ++i) {
+		ret += s.shards_[i].hits_.load(std::memory_order_relaxed);
+	}
+	return ret;
+}
+
+/**
+ * キャッシュにヒットしなかった回数を取得する
+ * @return キャッシュにヒットしなかった回数を返す
+ */
+uint64_t stat_cache::misses()
+{
+	stat_cache_state &s = stat_cache_state::instance();
+	uint64_t ret = 0;
+	for (std::size_t i = 0; i < SHARDS; ++i) {
+		ret += s.shards_[i].misses_.load(std::memory_order_relaxed);
+	}
+	return ret;
+}
+
+/**
+ * ファイルの状態を取得する。<br/>
+ * キャッシュが有効であればキャッシュを参照し、無ければlstatを呼び出して結果をキャッシュする。
+ * 存在しないことを表す結果（ENOENT、ENOTDIR）もキャッシュする。
+ * シンボリックリンクを通してモードを変更した場合、リンク先のエントリの権限のビットは有効期間が過ぎるまで古いままになる。
+ * @param path 対象のファイルのパス
+ * @param mode 成功した場合にst_modeの値を受け取る変数
+ * @return lstatが成功した場合は0、失敗した場合はerrnoの値を返す
+ */
+int stat_cache::lstat_mode(path const &path, uint32_t &mode)
+{
+	stat_cache_state &s = stat_cache_state::instance();
+	if (!s.enabled_.load(std::memory_order_acquire)) {
+		return lstat_mode_uncached(path, mode);
+	}
+
+	std::string key;
+	if (!make_key(path, key)) {
+		return lstat_mode_uncached(path, mode);
+	}
+	stat_cache_shard &shard = s.shard_of(key);
+	int64_t const now = now_ns();
+	uint64_t generation = 0;
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex_);
+		generation = shard.generation_;
+		std::unordered_map<std::string, stat_cache_entry>::const_iterator it = shard.entries_.find(key);
+		if ((shard.entries_.end() != it) && (now < it->second.expires_)) {
+			shard.hits_.fetch_add(1, std::memory_order_relaxed);
+			mode = it->second.mode_;
+			return it->second.error_;
+		}
+	}
+	shard.misses_.fetch_add(1, std::memory_order_relaxed);
+
+	stat_cache_entry entry;
+	struct stat st;
+	if (0 == ::lstat(path.full_path(), &st)) {
+		entry.error_ = 0;
+		entry.mode_ = static_cast<uint32_t>(st.st_mode);
+	} else {
+		entry.error_ = errno;
+		entry.mode_ = 0;
+	}
+	entry.expires_ = now + s.ttl_.load(std::memory_order_relaxed);
+	if ((0 == entry.error_) || (ENOENT == entry.error_) || (ENOTDIR == entry.error_)) {
+		// lstatの実行中に破棄された場合は、変更前の状態を取得した可能性があるのでキャッシュしない
+		std::lock_guard<std::mutex> lock(shard.mutex_);
+		if (generation == shard.generation_) {
+			if (shard.entries_.size() >= MAX_ENTRIES_PER_SHARD) {
+				shard.shrink(now);
+			}
+			shard.entries_[key] = entry;
+		}
+	}
+	mode = entry.mode_;
+	return entry.error_;
+}
+
+HUMANITY_IO_NS_END
@@ -0,0 +1,265 @@
+/**
+ * ディレクトリ操作を並列に処理するためのワークスティーリング型スレッドプール
+ * @file work_stealing_pool.hpp
+ */
+
+#ifndef HUMANITY_IO_WORK_STEALING_POOL_H
+#define HUMANITY_IO_WORK_STEALING_POOL_H
+
+#include <humanity/io/io.hpp>
+#include <humanity/utils.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+HUMANITY_IO_NS_BEGIN
+
+/**
+ * ワーカーごとにタスクキューを持つスレッドプール。<br/>
+ * ワーカーは自身のキューの末尾からタスクを取り出し、空になると他のワーカーのキューの先頭からタスクを奪う。
+ * 全てのタスクが処理されるとrunから戻る。
+ * ワーカーのスレッドは最初のrunで起動し、プールを破棄するまで次のrunを待って使い回す。
+ * runは同時に一つのスレッドからだけ呼び出すこと。
+ */
+template <typename Task_> class work_stealing_pool : private non_copyable< work_stealing_pool<Task_> > {
+private:
+	/** ワーカーごとのタスクキュー */
+	struct queue {
+		std::mutex mutex_;
+		std::deque<Task_> tasks_;
+	};
+
+public:
+	/**
+	 * ワーカー数を指定して構築するコンストラクタ
+	 * @param workers ワーカー数（0の場合はハードウェアの並列度を使う）
+	 */
+	explicit work_stealing_pool(unsigned int workers)
+		: queues_(), pending_(0), cancelled_(false), idle_mutex_(), idle_cv_(), error_mutex_(), error_(),
+		  threads_(), run_mutex_(), run_cv_(), done_cv_(), fn_(), generation_(0), running_(0), shutdown_(false)
+	{
+		if (0 == workers) {
+			workers = std::thread::hardware_concurrency();
+		}
+		std::vector<queue>(0 == workers ? 1 : workers).swap(queues_);
+	}
+
+	~work_stealing_pool() {
+		{
+			std::lock_guard<std::mutex> lock(run_mutex_);
+			shutdown_ = true;
+		}
+		run_cv_.notify_all();
+		for (std::size_t i = 0; i < threads_.size(); ++i) {
+			threads_[i].join();
+		}
+	}
+
+	/** ワーカー数を取得する */
+	unsigned int workers() const {
+		return static_cast<unsigned int>(queues_.size());
+	}
+
+	/**
+	 * タスクを追加する
+	 * @param worker タスクを追加するキューを持つワーカーの番号
+	 * @param task 追加するタスク
+	 */
+	void push(unsigned int worker, Task_ const &task) {
+		pending_.fetch_add(1);
+		{
+			queue &q = queues_[worker];
+			std::lock_guard<std::mutex> lock(q.mutex_);
+			q.tasks_.push_back(task);
+		}
+		idle_cv_.notify_one();
+	}
+
+	/**
+	 * 全てのタスクが処理されるまでワーカーを動かす。<br/>
+	 * 呼び出し元のスレッドも0番のワーカーとして処理を行う。
+	 * タスクの処理中に例外が発生した場合は残りのタスクを破棄し、最初に発生した例外を再送出する。
+	 * @param fn タスクを処理する関数オブジェクト（fn(unsigned int worker, Task_ &task)の形で呼び出される）
+	 */
+	template <typename Fn_> void run(Fn_ fn) {
+		cancelled_.store(false);
+		error_ = std::exception_ptr();
+		if (1 < queues_.size()) {
+			if (threads_.empty()) {
+				threads_.reserve(queues_.size() - 1);
+				for (unsigned int i = 1; i < queues_.size(); ++i) {
+					threads_.push_back(std::thread(&work_stealing_pool::loop, this, i));
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lock(run_mutex_);
+				fn_.fn_ = &fn;
+				fn_.invoke_ = &invoke<Fn_>;
+				running_ = queues_.size() - 1;
+				++generation_;
+			}
+			run_cv_.notify_all();
+		}
+		work(0, fn);
+		if (1 < queues_.size()) {
+			std::unique_lock<std::mutex> lock(run_mutex_);
+			while (0 != running_) {
+				done_cv_.wait(lock);
+			}
+			fn_ = erased_fn();
+		}
+		if (is_cancelled()) {
+			// 中断した場合は、次のrunに備えて残りのタスクを捨てる
+			for (std::size_t i = 0; i < queues_.size(); ++i) {
+				queues_[i].tasks_.clear();
+			}
+			pending_.store(0);
+		}
+#if defined(HUMANITY_ENABLE_EXCEPTIONS)
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+#endif
+	}
+
+	/** 残りのタスクを破棄してワーカーを停止させる */
+	void cancel() {
+		cancelled_.store(true);
+		idle_cv_.notify_all();
+	}
+
+	/** 処理が中断されたかどうかを判定する */
+	bool is_cancelled() const {
+		return cancelled_.load(std::memory_order_relaxed);
+	}
+
+private:
+	/**
+	 * 実行中のrunに渡された関数オブジェクトを、型を消してワーカーのスレッドに渡すための関数オブジェクト
+	 */
+	struct erased_fn {
+		void *fn_;
+		void (*invoke_)(void *fn, unsigned int worker, Task_ &task);
+
+		erased_fn() : fn_(NULL), invoke_(NULL) {}
+		void operator () (unsigned int worker, Task_ &task) { invoke_(fn_, worker, task); }
+	};
+
+	template <typename Fn_> static void invoke(void *fn, unsigned int worker, Task_ &task) {
+		(*static_cast<Fn_*>(fn))(worker, task);
+	}
+
+	/** ワーカーのスレッドの本体（runが呼び出されるたびにタスクを処理し、プールの破棄で終了する） */
+	void loop(unsigned int worker) {
+		uint64_t seen = 0;
+		for (;;) {
+			erased_fn fn;
+			{
+				std::unique_lock<std::mutex> lock(run_mutex_);
+				while (!shutdown_ && (seen == generation_)) {
+					run_cv_.wait(lock);
+				}
+				if (shutdown_) {
+					return;
+				}
+				seen = generation_;
+				fn = fn_;
+			}
+			work(worker, fn);
+			bool last = false;
+			{
+				std::lock_guard<std::mutex> lock(run_mutex_);
+				last = (0 == --running_);
+			}
+			if (last) {
+				done_cv_.notify_all();
+			}
+		}
+	}
+
+	template <typename Fn_> void work(unsigned int worker, Fn_ &fn) {
+		Task_ task;
+		while (!is_cancelled()) {
+			if (pop(worker, task)) {
+#if defined(HUMANITY_ENABLE_EXCEPTIONS)
+				try {
+					fn(worker, task);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(error_mutex_);
+					if (!error_) {
+						error_ = std::current_exception();
+					}
+					cancel();
+				}
+#else
+				fn(worker, task);
+#endif
+				if (1 == pending_.fetch_sub(1)) {
+					idle_cv_.notify_all();
+				}
+				continue;
+			}
+			if (0 == pending_.load()) {
+				break;
+			}
+			std::unique_lock<std::mutex> lock(idle_mutex_);
+			idle_cv_.wait_for(lock, std::chrono::milliseconds(1));
+		}
+	}
+
+	bool pop(unsigned int worker, Task_ &task) {
+		{
+			queue &q = queues_[worker];
+			std::lock_guard<std::mutex> lock(q.mutex_);
+			if (!q.tasks_.empty()) {
+				task = q.tasks_.back();
+				q.tasks_.pop_back();
+				return true;
+			}
+		}
+		for (std::size_t i = 1; i < queues_.size(); ++i) {
+			queue &q = queues_[(worker + i) % queues_.size()];
+			std::lock_guard<std::mutex> lock(q.mutex_);
+			if (!q.tasks_.empty()) {
+				task = q.tasks_.front();
+				q.tasks_.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::vector<queue> queues_;
+	/** キューに積まれているか処理中のタスクの数 */
+	std::atomic<std::size_t> pending_;
+	std::atomic<bool> cancelled_;
+	std::mutex idle_mutex_;
+	std::condition_variable idle_cv_;
+	std::mutex error_mutex_;
+	std::exception_ptr error_;
+	/** 使い回すワーカーのスレッド（0番のワーカーはrunを呼び出したスレッド） */
+	std::vector<std::thread> threads_;
+	std::mutex run_mutex_;
+	/** runの開始とプールの破棄をワーカーに通知する */
+	std::condition_variable run_cv_;
+	/** ワーカーがタスクを処理し終えたことをrunに通知する */
+	std::condition_variable done_cv_;
+	/** 実行中のrunに渡された関数オブジェクト */
+	erased_fn fn_;
+	/** runを呼び出すたびに増える値 */
+	uint64_t generation_;
+	/** 実行中のrunでタスクを処理しているワーカーのスレッドの数 */
+	std::size_t running_;
+	bool shutdown_;
+};
+
+HUMANITY_IO_NS_END
+
+#endif // end of HUMANITY_IO_WORK_STEALING_POOL_H
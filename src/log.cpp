@@ -0,0 +1,659 @@
+#include <humanity/log_record.hpp>
+#include <humanity/log_async.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * 書式指定を一つ分だけ書式化して文字列の末尾に追加する
+ */
+template <typename T_> static void append_formatted(std::string &out, char const *spec, T_ value)
+{
+	char buf[128];
+	int const n = std::snprintf(buf, sizeof(buf), spec, value);
+	if (0 > n) {
+		return;
+	}
+	if (static_cast<std::size_t>(n) < sizeof(buf)) {
+		out.append(buf, n);
+		return;
+	}
+	std::size_t const offset = out.size();
+	out.resize(offset + n + 1);
+	std::snprintf(&out[offset], n + 1, spec, value);
+	out.resize(offset + n);
+}
+
+/**
+ * バイト列に詰めた引数を一つ読み出すためのクラス。<br/>
+ * ファイルから読み込んだ壊れたバイト列も扱えるよう、全ての読み出しを終端と照合し、
+ * 不正な種類や長さを見つけた場合は以降の引数が残っていないものとして扱う。
+ */
+class log_arg_reader {
+public:
+	log_arg_reader(char const *p, std::size_t size) : p_(p), end_(p + size) {
+	}
+
+	/** 次の引数の種類を取得する（引数が残っていなければ0を返す） */
+	int peek() const {
+		return (p_ < end_) ? static_cast<unsigned char>(*p_) : 0;
+	}
+
+	/** 次の引数を整数として読み出す */
+	int64_t read_int() {
+		int64_t ret = 0;
+		switch (peek()) {
+		case LOG_ARG_INT:
+		case LOG_ARG_UINT:
+		case LOG_ARG_POINTER:
+			read_value(ret);
+			break;
+		case LOG_ARG_DOUBLE:
+			ret = static_cast<int64_t>(read_double());
+			break;
+		default:
+			skip();
+			break;
+		}
+		return ret;
+	}
+
+	/** 次の引数を浮動小数点数として読み出す */
+	double read_double() {
+		double ret = 0.0;
+		switch (peek()) {
+		case LOG_ARG_DOUBLE:
+			read_value(ret);
+			break;
+		case LOG_ARG_INT:
+			ret = static_cast<double>(read_int());
+			break;
+		case LOG_ARG_UINT:
+			ret = static_cast<double>(static_cast<uint64_t>(read_int()));
+			break;
+		default:
+			skip();
+			break;
+		}
+		return ret;
+	}
+
+	/** 次の引数を文字列として読み出す（文字列でないか、終端が'\0'でなければNULLを返す） */
+	char const *read_string() {
+		if (LOG_ARG_STRING != peek()) {
+			skip();
+			return NULL;
+		}
+		uint32_t n = 0;
+		if (!read_value(n)) {
+			return NULL;
+		}
+		// 長さには終端の'\0'を含む
+		if ((0 == n) || (remaining() < n) || ('\0' != p_[n - 1])) {
+			p_ = end_;
+			return NULL;
+		}
+		char const *ret = p_;
+		p_ += n;
+		return ret;
+	}
+
+private:
+	std::size_t remaining() const {
+		return static_cast<std::size_t>(end_ - p_);
+	}
+
+	/**
+	 * 種類を表す1バイトに続く値を読み出す
+	 * @return 値が途中で切れていなければtrue、そうでなければ以降を読み飛ばしてfalseを返す
+	 */
+	template <typename T_> bool read_value(T_ &value) {
+		if (remaining() < 1 + sizeof(value)) {
+			p_ = end_;
+			return false;
+		}
+		std::memcpy(&value, p_ + 1, sizeof(value));
+		p_ += 1 + sizeof(value);
+		return true;
+	}
+
+	void skip() {
+		switch (peek()) {
+		case 0:
+			break;
+		case LOG_ARG_STRING:
+			read_string();
+			break;
+		case LOG_ARG_INT:
+		case LOG_ARG_UINT:
+		case LOG_ARG_POINTER:
+		case LOG_ARG_DOUBLE:
+			{
+				uint64_t v = 0;
+				read_value(v);
+			}
+			break;
+		default:
+			// 種類が不明な引数は大きさが分からないため、以降を読み飛ばす
+			p_ = end_;
+			break;
+		}
+	}
+
+	char const *p_;
+	char const *end_;
+};
+
+/**
+ * printfと同じ形式の書式文字列に従って、バイト列に詰めた引数を書式化する。<br/>
+ * 書式指定の長さ修飾子は無視し、保存されている値の型に合わせて書式化する。
+ * 引数が足りない書式指定はそのまま出力する。
+ * @param out 書式化した結果を追加する文字列
+ * @param fmt 書式文字列
+ * @param args encode_log_argsで詰めた引数
+ * @param size argsの大きさ
+ */
+void format_log_record(std::string &out, char const *fmt, char const *args, std::size_t size)
+{
+	log_arg_reader reader(args, size);
+	char const *p = fmt;
+	std::string spec;
+	while ('\0' != *p) {
+		if ('%' != *p) {
+			char const *q = std::strchr(p, '%');
+			std::size_t const n = (NULL == q) ? std::strlen(p) : static_cast<std::size_t>(q - p);
+			out.append(p, n);
+			p += n;
+			continue;
+		}
+		if ('%' == p[1]) {
+			out += '%';
+			p += 2;
+			continue;
+		}
+
+		char const *start = p++;
+		spec.assign(1, '%');
+		while ((NULL != std::strchr("-+ #0'", *p)) && ('\0' != *p)) {
+			spec += *p++;
+		}
+		for (int i = 0; i < 2; ++i) {
+			// 幅と精度（*の場合は引数から値を取り出す）
+			if ((1 == i) && ('.' == *p)) {
+				spec += *p++;
+			} else if (1 == i) {
+				break;
+			}
+			if ('*' == *p) {
+				char num[24];
+				std::snprintf(num, sizeof(num), "%d", static_cast<int>(reader.read_int()));
+				spec += num;
+				++p;
+			} else {
+				while (('0' <= *p) && ('9' >= *p)) {
+					spec += *p++;
+				}
+			}
+		}
+		while ((NULL != std::strchr("hljztLq", *p)) && ('\0' != *p)) {
+			++p;
+		}
+
+		char const conv = *p;
+		if ('\0' == conv) {
+			out.append(start);
+			break;
+		}
+		++p;
+		if ((0 == reader.peek()) && ('n' != conv)) {
+			out.append(start, p - start);
+			continue;
+		}
+		switch (conv) {
+		case 'd':
+		case 'i':
+			spec += "ll";
+			spec += conv;
+			append_formatted(out, spec.c_str(), static_cast<long long>(reader.read_int()));
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			spec += "ll";
+			spec += conv;
+			append_formatted(out, spec.c_str(), static_cast<unsigned long long>(reader.read_int()));
+			break;
+		case 'c':
+			spec += conv;
+			append_formatted(out, spec.c_str(), static_cast<int>(reader.read_int()));
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			spec += conv;
+			append_formatted(out, spec.c_str(), reader.read_double());
+			break;
+		case 's':
+			{
+				char const *s = reader.read_string();
+				spec += conv;
+				append_formatted(out, spec.c_str(), NULL == s ? "(invalid)" : s);
+			}
+			break;
+		case 'p':
+			spec += conv;
+			append_formatted(out, spec.c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(reader.read_int())));
+			break;
+		case 'n':
+			break;
+		default:
+			out.append(start, p - start);
+			break;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+#if !defined(__ANDROID__)
+// Androidではログをlogcatに出力するため、非同期の出力は使わない
+
+/**
+ * リングバッファ上のレコードの先頭に置く情報
+ */
+struct log_record_header {
+	/** ヘッダを含むレコード全体の大きさ（8バイト単位に切り上げる） */
+	uint32_t size_;
+	/** 引数の大きさ（WRAP_MARKの場合はバッファの末尾までを読み飛ばす） */
+	uint32_t args_size_;
+	/** 出力先のストリーム */
+	std::FILE *fp_;
+	/** 書式文字列 */
+	char const *fmt_;
+
+	enum { WRAP_MARK = 0xFFFFFFFFU };
+};
+
+/**
+ * スレッドごとのリングバッファ。<br/>
+ * 書き込みはログを出力するスレッドだけが、読み出しはバックグラウンドのスレッドだけが行う。
+ */
+struct log_ring {
+	enum { MASK = async_log::RING_SIZE - 1 };
+
+	/** 読み出し位置（読み出し側だけが進める） */
+	std::atomic<std::size_t> head_;
+	/** 書き込み位置（書き込み側だけが進める） */
+	std::atomic<std::size_t> tail_;
+	/** 書き込み側のスレッドが終了したかどうか */
+	std::atomic<bool> abandoned_;
+	/** 書き込み側がレコードを予約してからcommitするまでの間かどうか */
+	std::atomic<bool> writing_;
+	/** 予約中のレコードを書き込んだ後の書き込み位置（書き込み側だけが使う） */
+	std::size_t reserved_tail_;
+	/** レコードを格納する領域 */
+	alignas(8) char buffer_[async_log::RING_SIZE];
+
+	log_ring() : head_(0), tail_(0), abandoned_(false), writing_(false), reserved_tail_(0) {
+	}
+};
+
+/**
+ * スレッドが終了した時にリングバッファを手放すためのクラス
+ */
+struct log_ring_owner {
+	log_ring *ring_;
+
+	log_ring_owner() : ring_(NULL) {
+	}
+	~log_ring_owner() {
+		if (NULL != ring_) {
+			ring_->abandoned_.store(true, std::memory_order_release);
+			ring_ = NULL;
+		}
+	}
+};
+
+/**
+ * リングバッファからログを読み出して書き出すバックグラウンドのスレッド
+ */
+class log_worker {
+public:
+	log_worker()
+		: mutex_(), rings_(), cv_(), stopping_(false), stopped_(false), stop_requested_(false),
+		  policy_(async_log::OVERFLOW_COUNT), dropped_(0), reported_(0), thread_()
+	{
+		thread_ = std::thread(&log_worker::run, this);
+		std::atexit(&log_worker::stop_at_exit);
+	}
+
+	/** プロセスで一つのインスタンスを取得する（終了時に他のスレッドから使われる可能性があるため解放しない） */
+	static log_worker &instance() {
+		static log_worker *w = new log_worker();
+		return *w;
+	}
+
+	/** 新しいリングバッファを登録する */
+	void add(log_ring *ring) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		rings_.push_back(ring);
+	}
+
+	/** 全てのリングバッファが空になるまで待つ */
+	void flush() {
+		while (!stopped_.load(std::memory_order_acquire) && !is_empty()) {
+			cv_.notify_one();
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+
+	void wake() {
+		cv_.notify_one();
+	}
+
+	/** 終了処理が始まっているかどうか（以降のログはその場で書き出す） */
+	bool is_stopping() const {
+		return stopping_.load();
+	}
+
+	/** バックグラウンドのスレッドが最後の書き出しを終えて停止したかどうか */
+	bool is_stopped() const {
+		return stopped_.load(std::memory_order_acquire);
+	}
+
+	std::atomic<int> &policy() {
+		return policy_;
+	}
+
+	std::atomic<uint64_t> &dropped() {
+		return dropped_;
+	}
+
+private:
+	static void stop_at_exit() {
+		log_worker &w = instance();
+		// 予約中のレコードがcommitされるのを待ってから最後の書き出しを行う
+		w.stopping_.store(true);
+		while (w.is_writing()) {
+			std::this_thread::yield();
+		}
+		w.stop_requested_.store(true, std::memory_order_release);
+		w.cv_.notify_one();
+		w.thread_.join();
+		w.stopped_.store(true, std::memory_order_release);
+	}
+
+	bool is_empty() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (std::size_t i = 0; i < rings_.size(); ++i) {
+			if (rings_[i]->head_.load(std::memory_order_acquire) != rings_[i]->tail_.load(std::memory_order_acquire)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool is_writing() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (std::size_t i = 0; i < rings_.size(); ++i) {
+			if (rings_[i]->writing_.load()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void run() {
+		std::vector<log_ring*> rings;
+		std::string text;
+		for (;;) {
+			bool const stop = stop_requested_.load(std::memory_order_acquire);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				rings = rings_;
+			}
+
+			bool written = false;
+			for (std::size_t i = 0; i < rings.size(); ++i) {
+				bool const abandoned = rings[i]->abandoned_.load(std::memory_order_acquire);
+				written = drain(*rings[i], text) || written;
+				if (abandoned) {
+					remove(rings[i]);
+				}
+			}
+			report_dropped();
+
+			if (stop) {
+				break;
+			}
+			if (!written) {
+				std::unique_lock<std::mutex> lock(mutex_);
+				cv_.wait_for(lock, std::chrono::milliseconds(2));
+			}
+		}
+	}
+
+	/** リングバッファに積まれているレコードを全て書き出す */
+	bool drain(log_ring &ring, std::string &text) {
+		std::size_t head = ring.head_.load(std::memory_order_relaxed);
+		std::size_t const tail = ring.tail_.load(std::memory_order_acquire);
+		if (head == tail) {
+			return false;
+		}
+		std::FILE *last_fp = NULL;
+		while (head != tail) {
+			log_record_header const *h = reinterpret_cast<log_record_header const*>(&ring.buffer_[head & log_ring::MASK]);
+			if (log_record_header::WRAP_MARK != h->args_size_) {
+				text.clear();
+				format_log_record(text, h->fmt_, reinterpret_cast<char const*>(h + 1), h->args_size_);
+				std::fwrite(text.data(), 1, text.size(), h->fp_);
+				if ((NULL != last_fp) && (last_fp != h->fp_)) {
+					std::fflush(last_fp);
+				}
+				last_fp = h->fp_;
+			}
+			head += h->size_;
+		}
+		if (NULL != last_fp) {
+			std::fflush(last_fp);
+		}
+		ring.head_.store(head, std::memory_order_release);
+		return true;
+	}
+
+	/** 書き込み側のスレッドが終了したリングバッファを解放する */
+	void remove(log_ring *ring) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (std::size_t i = 0; i < rings_.size(); ++i) {
+				if (rings_[i] == ring) {
+					rings_.erase(rings_.begin() + i);
+					break;
+				}
+			}
+		}
+		delete ring;
+	}
+
+	void report_dropped() {
+		uint64_t const dropped = dropped_.load(std::memory_order_relaxed);
+		if ((dropped != reported_) && (async_log::OVERFLOW_COUNT == policy_.load(std::memory_order_relaxed))) {
+			std::fprintf(stderr, "humanity: %llu log messages dropped\n", static_cast<unsigned long long>(dropped - reported_));
+			std::fflush(stderr);
+		}
+		reported_ = dropped;
+	}
+
+	std::mutex mutex_;
+	std::vector<log_ring*> rings_;
+	std::condition_variable cv_;
+	std::atomic<bool> stopping_;
+	std::atomic<bool> stopped_;
+	std::atomic<bool> stop_requested_;
+	std::atomic<int> policy_;
+	std::atomic<uint64_t> dropped_;
+	uint64_t reported_;
+	std::thread thread_;
+};
+
+/** このスレッドのリングバッファ */
+static thread_local log_ring_owner ring_owner;
+/** バックグラウンドのスレッドが停止した後に、その場で書き出すための作業領域 */
+static thread_local std::vector<char> *sync_buffer = NULL;
+/** 予約中のレコードがsync_bufferに書き込まれているかどうか */
+static thread_local bool sync_reserved = false;
+
+/**
+ * リングバッファに空きが無い時の動作を設定する
+ * @param policy リングバッファに空きが無い時の動作
+ */
+void async_log::set_overflow_policy(overflow_policy policy)
+{
+	log_worker::instance().policy().store(policy, std::memory_order_relaxed);
+}
+
+/**
+ * リングバッファに空きが無い時の動作を取得する
+ * @return リングバッファに空きが無い時の動作を返す
+ */
+async_log::overflow_policy async_log::get_overflow_policy()
+{
+	return static_cast<overflow_policy>(log_worker::instance().policy().load(std::memory_order_relaxed));
+}
+
+/**
+ * 空きが無いために捨てたログの数を取得する
+ * @return 捨てたログの数を返す
+ */
+uint64_t async_log::dropped()
+{
+	return log_worker::instance().dropped().load(std::memory_order_relaxed);
+}
+
+/**
+ * それまでに出力した全てのログが書き出されるまで待つ
+ */
+void async_log::flush()
+{
+	log_worker::instance().flush();
+}
+
+/**
+ * このスレッドのリングバッファにレコードを書き込む領域を予約する。<br/>
+ * 予約に成功した場合は、返された領域に引数を書き込んでからcommitを呼び出す。
+ * @param fp 出力先のストリーム
+ * @param fmt 書式文字列
+ * @param args_size 引数を詰めるのに必要なバイト数
+ * @return 引数を書き込む領域、ログを捨てる場合はNULLを返す
+ */
+char *async_log::reserve(std::FILE *fp, char const *fmt, std::size_t args_size)
+{
+	log_worker &worker = log_worker::instance();
+	std::size_t const size = (sizeof(log_record_header) + args_size + 7) & ~static_cast<std::size_t>(7);
+
+	log_ring *ring = ring_owner.ring_;
+	if ((NULL == ring) && !worker.is_stopping()) {
+		ring = new log_ring();
+		ring_owner.ring_ = ring;
+		worker.add(ring);
+	}
+	// writing_を立ててから終了処理の開始を確認するため、終了処理はこのレコードのcommitを待つか、
+	// このスレッドが終了処理の開始を確認してその場で書き出すかのどちらかになる
+	if (NULL != ring) {
+		ring->writing_.store(true);
+	}
+	sync_reserved = worker.is_stopping();
+	if (sync_reserved) {
+		// 終了処理の後に出力されたログはその場で書き出す
+		if (NULL != ring) {
+			ring->writing_.store(false, std::memory_order_release);
+		}
+		// リングバッファに積んだ先のレコードより前に書き出さないよう、最後の書き出しを待つ
+		while (!worker.is_stopped()) {
+			std::this_thread::yield();
+		}
+		if (NULL == sync_buffer) {
+			sync_buffer = new std::vector<char>();
+		}
+		sync_buffer->resize(size);
+		log_record_header *h = reinterpret_cast<log_record_header*>(&(*sync_buffer)[0]);
+		h->size_ = static_cast<uint32_t>(size);
+		h->args_size_ = static_cast<uint32_t>(args_size);
+		h->fp_ = fp;
+		h->fmt_ = fmt;
+		return reinterpret_cast<char*>(h + 1);
+	}
+
+	if (size > RING_SIZE / 4) {
+		ring->writing_.store(false, std::memory_order_release);
+		worker.dropped().fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	std::size_t tail = ring->tail_.load(std::memory_order_relaxed);
+	std::size_t const to_end = RING_SIZE - (tail & log_ring::MASK);
+	std::size_t const needed = (size > to_end) ? size + to_end : size;
+	for (;;) {
+		std::size_t const head = ring->head_.load(std::memory_order_acquire);
+		if (RING_SIZE - (tail - head) >= needed) {
+			break;
+		}
+		if (OVERFLOW_BLOCK != worker.policy().load(std::memory_order_relaxed)) {
+			ring->writing_.store(false, std::memory_order_release);
+			worker.dropped().fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		}
+		worker.wake();
+		std::this_thread::yield();
+	}
+
+	if (size > to_end) {
+		log_record_header *mark = reinterpret_cast<log_record_header*>(&ring->buffer_[tail & log_ring::MASK]);
+		mark->size_ = static_cast<uint32_t>(to_end);
+		mark->args_size_ = log_record_header::WRAP_MARK;
+		tail += to_end;
+	}
+	log_record_header *h = reinterpret_cast<log_record_header*>(&ring->buffer_[tail & log_ring::MASK]);
+	h->size_ = static_cast<uint32_t>(size);
+	h->args_size_ = static_cast<uint32_t>(args_size);
+	h->fp_ = fp;
+	h->fmt_ = fmt;
+	ring->reserved_tail_ = tail + size;
+	return reinterpret_cast<char*>(h + 1);
+}
+
+/**
+ * reserveで予約したレコードをバックグラウンドのスレッドに渡す
+ */
+void async_log::commit()
+{
+	if (sync_reserved) {
+		log_record_header const *h = reinterpret_cast<log_record_header const*>(&(*sync_buffer)[0]);
+		std::string text;
+		format_log_record(text, h->fmt_, reinterpret_cast<char const*>(h + 1), h->args_size_);
+		std::fwrite(text.data(), 1, text.size(), h->fp_);
+		return;
+	}
+	log_ring *ring = ring_owner.ring_;
+	ring->tail_.store(ring->reserved_tail_, std::memory_order_release);
+	ring->writing_.store(false, std::memory_order_release);
+}
+
+#endif // end of !__ANDROID__
+
+HUMANITY_NS_END
@@ -0,0 +1,263 @@
+#include <humanity/log_binary.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+
+HUMANITY_NS_BEGIN
+
+std::atomic<bool> binary_log::opened_(false);
+
+/**
+ * バイナリログ全体で共有する状態
+ */
+struct binary_log_state {
+	/** 以下のメンバを保護するミューテックス */
+	std::mutex mutex_;
+	/** 登録された書式（番号順） */
+	std::vector<binary_log_format const*> formats_;
+	/** 書式定義をファイルに書き込んだ書式の数 */
+	std::size_t defined_;
+	/** 書き込み先のファイル */
+	std::FILE *fp_;
+	/** 次に割り当てるスレッド番号 */
+	uint32_t next_thread_;
+	/** ファイルを開くたびに進める世代（スレッドのバッファがどのファイルに対するものかを判定する） */
+	std::atomic<uint32_t> generation_;
+	/** スレッドの終了時にバッファを書き出すためのキー */
+	pthread_key_t key_;
+
+	binary_log_state();
+
+	/** プロセスで一つのインスタンスを取得する（終了時に他のスレッドから使われる可能性があるため解放しない） */
+	static binary_log_state &instance() {
+		static binary_log_state *s = new binary_log_state();
+		return *s;
+	}
+};
+
+/**
+ * スレッドごとのバッファ
+ */
+struct binary_log_buffer {
+	/** バッファの先頭 */
+	char *data_;
+	/** 書き込まれているデータの大きさ */
+	std::size_t size_;
+	/** 確保している領域の大きさ */
+	std::size_t capacity_;
+	/** スレッド番号 */
+	uint32_t thread_;
+	/** バッファのログを書き込んだ時のファイルの世代 */
+	uint32_t generation_;
+
+	binary_log_buffer(uint32_t thread, uint32_t generation)
+		: data_(static_cast<char*>(std::malloc(binary_log::BUFFER_SIZE))), size_(0), capacity_(binary_log::BUFFER_SIZE),
+		  thread_(thread), generation_(generation)
+	{
+	}
+	~binary_log_buffer() {
+		std::free(data_);
+	}
+};
+
+/** このスレッドのバッファ */
+static thread_local binary_log_buffer *thread_buffer = NULL;
+
+template <typename T_> static void write_value(std::FILE *fp, T_ value)
+{
+	std::fwrite(&value, sizeof(value), 1, fp);
+}
+
+/**
+ * まだ書き込んでいない書式定義を書き込む（ミューテックスを取得した状態で呼び出す）
+ */
+static void write_formats(binary_log_state &s)
+{
+	for (; s.defined_ < s.formats_.size(); ++s.defined_) {
+		binary_log_format const &f = *s.formats_[s.defined_];
+		std::size_t const file_len = std::strlen(f.file());
+		std::size_t const fmt_len = std::strlen(f.format());
+		write_value<uint8_t>(s.fp_, binary_log::RECORD_FORMAT);
+		write_value<uint32_t>(s.fp_, f.id());
+		write_value<uint8_t>(s.fp_, static_cast<uint8_t>(f.level()));
+		write_value<uint32_t>(s.fp_, static_cast<uint32_t>(f.line()));
+		write_value<uint16_t>(s.fp_, static_cast<uint16_t>(file_len));
+		std::fwrite(f.file(), 1, static_cast<uint16_t>(file_len), s.fp_);
+		write_value<uint16_t>(s.fp_, static_cast<uint16_t>(fmt_len));
+		std::fwrite(f.format(), 1, static_cast<uint16_t>(fmt_len), s.fp_);
+	}
+}
+
+/**
+ * スレッドのバッファの内容をファイルに書き出して空にする。<br/>
+ * 以前に開いていたファイルに対するログは、開き直したファイルには書き出さずに捨てる。
+ */
+static void write_buffer(binary_log_buffer &b)
+{
+	if (0 == b.size_) {
+		return;
+	}
+	binary_log_state &s = binary_log_state::instance();
+	std::lock_guard<std::mutex> lock(s.mutex_);
+	if ((NULL != s.fp_) && (b.generation_ == s.generation_.load(std::memory_order_relaxed))) {
+		write_formats(s);
+		std::fwrite(b.data_, 1, b.size_, s.fp_);
+	}
+	b.size_ = 0;
+}
+
+/**
+ * スレッドの終了時にバッファを書き出して解放する
+ */
+static void release_buffer(void *p)
+{
+	binary_log_buffer *b = static_cast<binary_log_buffer*>(p);
+	write_buffer(*b);
+	delete b;
+	thread_buffer = NULL;
+}
+
+static void close_at_exit()
+{
+	binary_log::close();
+}
+
+binary_log_state::binary_log_state()
+	: mutex_(), formats_(), defined_(0), fp_(NULL), next_thread_(0), generation_(0), key_()
+{
+	pthread_key_create(&key_, release_buffer);
+	std::atexit(close_at_exit);
+}
+
+/**
+ * 書式を登録して番号を割り当てる
+ * @param level ログのレベル
+ * @param fmt printfと同じ形式の書式文字列
+ * @param file 出力箇所のファイル名
+ * @param line 出力箇所の行番号
+ */
+binary_log_format::binary_log_format(int level, char const *fmt, char const *file, int line)
+	: id_(0), level_(level), fmt_(fmt), file_(file), line_(line)
+{
+	binary_log_state &s = binary_log_state::instance();
+	std::lock_guard<std::mutex> lock(s.mutex_);
+	id_ = static_cast<uint32_t>(s.formats_.size());
+	s.formats_.push_back(this);
+}
+
+/**
+ * ログを書き込むファイルを開く。<br/>
+ * 既にファイルを開いている場合は、そのファイルを閉じてから開き直す。
+ * @param path ログを書き込むファイルのパス
+ * @return 正常にファイルを開けた場合はtrue、そうでなければfalseを返す
+ */
+bool binary_log::open(char const *path)
+{
+	close();
+
+	binary_log_state &s = binary_log_state::instance();
+	std::lock_guard<std::mutex> lock(s.mutex_);
+	s.fp_ = std::fopen(path, "wb");
+	if (NULL == s.fp_) {
+		return false;
+	}
+	std::fwrite("HMNBLOG", 1, 8, s.fp_);
+	write_value<uint32_t>(s.fp_, 0x01020304U);
+	write_value<uint32_t>(s.fp_, VERSION);
+	s.defined_ = 0;
+	s.generation_.fetch_add(1, std::memory_order_relaxed);
+	opened_.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+/**
+ * 呼び出したスレッドのバッファを書き出してからファイルを閉じる。<br/>
+ * 他のスレッドのバッファに残っているログは書き出されず、次に開いたファイルにも書き出さずに捨てられる。
+ */
+void binary_log::close()
+{
+	if (NULL != thread_buffer) {
+		write_buffer(*thread_buffer);
+	}
+	binary_log_state &s = binary_log_state::instance();
+	std::lock_guard<std::mutex> lock(s.mutex_);
+	opened_.store(false, std::memory_order_relaxed);
+	if (NULL != s.fp_) {
+		std::fclose(s.fp_);
+		s.fp_ = NULL;
+	}
+}
+
+/**
+ * 呼び出したスレッドのバッファをファイルに書き出す
+ */
+void binary_log::flush()
+{
+	if (NULL != thread_buffer) {
+		write_buffer(*thread_buffer);
+	}
+	binary_log_state &s = binary_log_state::instance();
+	std::lock_guard<std::mutex> lock(s.mutex_);
+	if (NULL != s.fp_) {
+		std::fflush(s.fp_);
+	}
+}
+
+/**
+ * このスレッドのバッファにログのレコードを書き込む領域を確保し、固定長部分を書き込む
+ * @param id 書式の番号
+ * @param args_size 引数を詰めるのに必要なバイト数
+ * @return 引数を書き込む領域を返す
+ */
+char *binary_log::reserve(uint32_t id, std::size_t args_size)
+{
+	binary_log_state &s = binary_log_state::instance();
+	uint32_t const generation = s.generation_.load(std::memory_order_relaxed);
+	binary_log_buffer *b = thread_buffer;
+	if (NULL == b) {
+		{
+			std::lock_guard<std::mutex> lock(s.mutex_);
+			b = new binary_log_buffer(s.next_thread_++, generation);
+		}
+		pthread_setspecific(s.key_, b);
+		thread_buffer = b;
+	}
+	if (b->generation_ != generation) {
+		// 以前に開いていたファイルに対するログは捨てる
+		b->size_ = 0;
+		b->generation_ = generation;
+	}
+
+	std::size_t const n = RECORD_HEADER_SIZE + args_size;
+	if (b->size_ + n > b->capacity_) {
+		write_buffer(*b);
+		if (n > b->capacity_) {
+			std::free(b->data_);
+			b->data_ = static_cast<char*>(std::malloc(n));
+			b->capacity_ = n;
+		}
+	}
+
+	timespec ts;
+	::clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t const time = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+	uint32_t const size = static_cast<uint32_t>(args_size);
+
+	char *p = b->data_ + b->size_;
+	b->size_ += n;
+	*p++ = RECORD_LOG;
+	std::memcpy(p, &id, sizeof(id));
+	p += sizeof(id);
+	std::memcpy(p, &b->thread_, sizeof(b->thread_));
+	p += sizeof(b->thread_);
+	std::memcpy(p, &time, sizeof(time));
+	p += sizeof(time);
+	std::memcpy(p, &size, sizeof(size));
+	return p + sizeof(size);
+}
+
+HUMANITY_NS_END
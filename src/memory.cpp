@@ -0,0 +1,99 @@
+#include <humanity/memory.hpp>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+HUMANITY_NS_BEGIN
+
+/**
+ * ブロックを自身で確保するアリーナを構築する
+ * @param block_size 一度に確保するブロックの大きさ
+ */
+monotonic_arena::monotonic_arena(std::size_t block_size)
+	: blocks_(NULL), cur_(NULL), end_(NULL), block_size_(block_size), usage_(0), upstream_(NULL), mutex_()
+{
+}
+
+/**
+ * 上位のアリーナからブロックを受け取るアリーナを構築する。<br/>
+ * 受け取ったブロックは上位のアリーナが解放するため、このアリーナを先に破棄しても解放されない。
+ * 上位のアリーナは、下位のアリーナにブロックを渡している間は直接allocateしないこと。
+ * @param upstream ブロックを受け取る上位のアリーナ（NULLの場合は上位のアリーナを持たない）
+ * @param block_size 一度に受け取るブロックの大きさ
+ */
+monotonic_arena::monotonic_arena(monotonic_arena *upstream, std::size_t block_size)
+	: blocks_(NULL), cur_(NULL), end_(NULL), block_size_(block_size), usage_(0), upstream_(upstream), mutex_()
+{
+}
+
+monotonic_arena::~monotonic_arena()
+{
+	release();
+}
+
+/**
+ * 切り出した全ての領域を解放する。<br/>
+ * 上位のアリーナからブロックを受け取っている場合は、ブロックは上位のアリーナの解放時に解放される。
+ */
+void monotonic_arena::release()
+{
+	while (NULL != blocks_) {
+		block *b = blocks_;
+		blocks_ = b->next_;
+		::operator delete(b);
+	}
+	cur_ = NULL;
+	end_ = NULL;
+	usage_ = 0;
+}
+
+/**
+ * 確保したブロックの大きさの合計を取得する
+ * @return 確保したブロックの大きさの合計（バイト単位）を返す
+ */
+std::size_t monotonic_arena::memory_usage() const
+{
+	return usage_;
+}
+
+/**
+ * 現在のブロックに収まらない領域を切り出す。<br/>
+ * ブロックの半分を超える大きさの領域は専用のブロックに切り出し、現在のブロックの残りはそのまま使い続ける。
+ * @param n 領域の大きさ（バイト単位）
+ * @param alignment 領域の境界（2の冪）
+ * @return 切り出した領域の先頭を返す
+ */
+void *monotonic_arena::allocate_slow(std::size_t n, std::size_t alignment)
+{
+	std::size_t const size = n + alignment;
+	bool const large = size > block_size_ / 2;
+	std::size_t const bytes = large ? size : block_size_;
+	char *p = static_cast<char*>(allocate_block(bytes));
+	char *ret = p + ((alignment - (reinterpret_cast<std::size_t>(p) & (alignment - 1))) & (alignment - 1));
+	if (!large) {
+		cur_ = ret + n;
+		end_ = p + bytes;
+	}
+	return ret;
+}
+
+/**
+ * 新しいブロックを確保する
+ * @param n ブロックの大きさ（バイト単位）
+ * @return 確保したブロックの先頭を返す
+ */
+void *monotonic_arena::allocate_block(std::size_t n)
+{
+	usage_ += n;
+	if (NULL != upstream_) {
+		std::lock_guard<std::mutex> lock(upstream_->mutex_);
+		return upstream_->allocate(n);
+	}
+	block *b = static_cast<block*>(::operator new(sizeof(block) + n));
+	b->next_ = blocks_;
+	b->size_ = n;
+	blocks_ = b;
+	return b + 1;
+}
+
+HUMANITY_NS_END
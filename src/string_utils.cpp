@@ -1,5 +1,8 @@
 #include <humanity/string_utils.hpp>
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <map>
 
 HUMANITY_NS_BEGIN
 
@@ -9,7 +12,7 @@ HUMANITY_NS_BEGIN
  * @param suffix 終端文字列
  * @return 指定した終端文字列で終端している場合はtrue、そうでなければfalseを返す
  */
-bool string_utils::ends_with(std::string const &target, std::string const &suffix)
+bool string_utils::ends_with(string_view target, string_view suffix)
 {
 	if (suffix.empty()) {
 		return false;
@@ -20,7 +23,7 @@ bool string_utils::ends_with(std::string const &target, std::string const &suffi
 
 	std::size_t const offset = target.length() - suffix.length();
 
-	return 0 == target.compare(offset, suffix.length(), suffix);
+	return 0 == std::memcmp(target.data() + offset, suffix.data(), suffix.length());
 }
 
 /**
@@ -29,7 +32,7 @@ bool string_utils::ends_with(std::string const &target, std::string const &suffi
  * @param prefix 先頭文字列
  * @return 指定した先頭文字列で開始している場合はtrue、そうでなければfalseを返す
  */
-bool string_utils::starts_with(std::string const &target, std::string const &prefix)
+bool string_utils::starts_with(string_view target, string_view prefix)
 {
 	if (prefix.empty()) {
 		return false;
@@ -38,8 +41,192 @@ bool string_utils::starts_with(std::string const &target, std::string const &pre
 		return false;
 	}
 
-	return 0 == target.compare(0, prefix.length(), prefix);
+	return 0 == std::memcmp(target.data(), prefix.data(), prefix.length());
 }
 
-HUMANITY_NS_END
+std::size_t const string_matcher::npos;
+
+string_matcher::string_matcher()
+	: prefixes_(), suffixes_(), prefix_trie_(), suffix_trie_()
+{
+}
+
+string_matcher::~string_matcher()
+{
+}
+
+/**
+ * 接頭辞を登録する。<br/>
+ * 登録した順に0から番号が振られ、find_prefixはその番号を返す。
+ * @param prefix 登録する接頭辞（空の場合は何もしない）
+ */
+void string_matcher::add_prefix(string_view prefix)
+{
+	if (prefix.empty()) {
+		return;
+	}
+	prefixes_.push_back(prefix.str());
+	prefix_trie_.build(prefixes_, false);
+}
 
+/**
+ * 接尾辞を登録する。<br/>
+ * 登録した順に0から番号が振られ、find_suffixはその番号を返す。
+ * @param suffix 登録する接尾辞（空の場合は何もしない）
+ */
+void string_matcher::add_suffix(string_view suffix)
+{
+	if (suffix.empty()) {
+		return;
+	}
+	suffixes_.push_back(suffix.str());
+	suffix_trie_.build(suffixes_, true);
+}
+
+/**
+ * 登録したパターンを全て取り除く
+ */
+void string_matcher::clear()
+{
+	prefixes_.clear();
+	suffixes_.clear();
+	prefix_trie_.build(prefixes_, false);
+	suffix_trie_.build(suffixes_, true);
+}
+
+/**
+ * 対象の文字列が開始している接頭辞を探す
+ * @param target 判定対象の文字列
+ * @return 一致した接頭辞のうち最も短いものの番号、一致するものが無い場合はnposを返す
+ */
+std::size_t string_matcher::find_prefix(string_view target) const
+{
+	if (target.empty()) {
+		return npos;
+	}
+	uint32_t n = prefix_trie_.root_[static_cast<unsigned char>(target[0])];
+	for (std::size_t i = 1; ; ++i) {
+		if (0 == n) {
+			return npos;
+		}
+		std::size_t const pattern = prefix_trie_.nodes_[n].pattern_;
+		if (npos != pattern) {
+			return pattern;
+		}
+		if (i == target.size()) {
+			return npos;
+		}
+		n = prefix_trie_.child(n, static_cast<unsigned char>(target[i]));
+	}
+}
+
+/**
+ * 対象の文字列が終了している接尾辞を探す
+ * @param target 判定対象の文字列
+ * @return 一致した接尾辞のうち最も短いものの番号、一致するものが無い場合はnposを返す
+ */
+std::size_t string_matcher::find_suffix(string_view target) const
+{
+	if (target.empty()) {
+		return npos;
+	}
+	std::size_t i = target.size() - 1;
+	uint32_t n = suffix_trie_.root_[static_cast<unsigned char>(target[i])];
+	for (;;) {
+		if (0 == n) {
+			return npos;
+		}
+		std::size_t const pattern = suffix_trie_.nodes_[n].pattern_;
+		if (npos != pattern) {
+			return pattern;
+		}
+		if (0 == i) {
+			return npos;
+		}
+		--i;
+		n = suffix_trie_.child(n, static_cast<unsigned char>(target[i]));
+	}
+}
+
+string_matcher::trie::trie()
+	: nodes_(1), edges_()
+{
+	std::fill(root_, root_ + 256, 0U);
+	nodes_[0].first_edge_ = 0;
+	nodes_[0].edge_count_ = 0;
+	nodes_[0].pattern_ = npos;
+}
+
+/**
+ * パターンの一覧から木を構築し直す
+ * @param patterns パターンの一覧（空のパターンを含まないこと）
+ * @param reverse パターンを末尾から並べるかどうか（接尾辞の場合はtrue）
+ */
+void string_matcher::trie::build(std::vector<std::string> const &patterns, bool reverse)
+{
+	std::vector< std::map<unsigned char, uint32_t> > children(1);
+	std::vector<std::size_t> terminals(1, npos);
+	for (std::size_t i = 0; i < patterns.size(); ++i) {
+		std::string const &p = patterns[i];
+		uint32_t n = 0;
+		for (std::size_t k = 0; k < p.size(); ++k) {
+			unsigned char const c = static_cast<unsigned char>(reverse ? p[p.size() - 1 - k] : p[k]);
+			std::map<unsigned char, uint32_t>::const_iterator it = children[n].find(c);
+			if (children[n].end() == it) {
+				uint32_t const child = static_cast<uint32_t>(children.size());
+				children[n][c] = child;
+				children.push_back(std::map<unsigned char, uint32_t>());
+				terminals.push_back(npos);
+				n = child;
+			} else {
+				n = it->second;
+			}
+		}
+		if (npos == terminals[n]) {
+			terminals[n] = i;
+		}
+	}
+
+	std::fill(root_, root_ + 256, 0U);
+	nodes_.resize(children.size());
+	edges_.clear();
+	for (std::size_t n = 0; n < children.size(); ++n) {
+		nodes_[n].first_edge_ = static_cast<uint32_t>(edges_.size());
+		nodes_[n].edge_count_ = static_cast<uint32_t>(children[n].size());
+		nodes_[n].pattern_ = terminals[n];
+		for (std::map<unsigned char, uint32_t>::const_iterator it = children[n].begin(); it != children[n].end(); ++it) {
+			edge const e = { it->first, it->second };
+			edges_.push_back(e);
+			if (0 == n) {
+				root_[it->first] = it->second;
+			}
+		}
+	}
+}
+
+/**
+ * 節点から文字に対応する子を探す
+ * @param n 節点の番号
+ * @param c 文字
+ * @return 子の節点の番号、無い場合は0を返す
+ */
+uint32_t string_matcher::trie::child(uint32_t n, unsigned char c) const
+{
+	node const &nd = nodes_[n];
+	edge const *first = edges_.data() + nd.first_edge_;
+	edge const *last = first + nd.edge_count_;
+	while (first < last) {
+		edge const *mid = first + (last - first) / 2;
+		if (mid->c_ < c) {
+			first = mid + 1;
+		} else {
+			last = mid;
+		}
+	}
+	if ((first != edges_.data() + nd.first_edge_ + nd.edge_count_) && (first->c_ == c)) {
+		return first->child_;
+	}
+	return 0;
+}
+
+HUMANITY_NS_END
@@ -0,0 +1,143 @@
+/**
+ * HUMANITY_LOG_BINARYで記録したログファイルを文字列に変換するツール
+ * @file log_decode.cpp
+ */
+
+#include <humanity/log_binary.hpp>
+#include <humanity/log_record.hpp>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+using HUMANITY_NS::binary_log;
+
+/**
+ * ファイルから読み込んだ書式定義
+ */
+struct format_definition {
+	int level_;
+	uint32_t line_;
+	std::string file_;
+	std::string fmt_;
+};
+
+template <typename T_> static bool read_value(std::FILE *fp, T_ &value)
+{
+	return 1 == std::fread(&value, sizeof(value), 1, fp);
+}
+
+static bool read_string(std::FILE *fp, std::string &s)
+{
+	uint16_t n = 0;
+	if (!read_value(fp, n)) {
+		return false;
+	}
+	s.resize(n);
+	return (0 == n) || (n == std::fread(&s[0], 1, n, fp));
+}
+
+static char const *level_name(int level)
+{
+	switch (level) {
+	case 2: return "VERB";
+	case 3: return "DBG ";
+	case 4: return "INFO";
+	case 5: return "WARN";
+	case 6: return "ERR ";
+	default: return "????";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (2 != argc) {
+		std::fprintf(stderr, "usage: %s <binary log file>\n", argv[0]);
+		return 1;
+	}
+	std::FILE *fp = std::fopen(argv[1], "rb");
+	if (NULL == fp) {
+		std::perror(argv[1]);
+		return 1;
+	}
+
+	char magic[8];
+	uint32_t order = 0;
+	uint32_t version = 0;
+	if ((1 != std::fread(magic, sizeof(magic), 1, fp)) || (0 != std::memcmp(magic, "HMNBLOG", 8))
+			|| !read_value(fp, order) || !read_value(fp, version)) {
+		std::fprintf(stderr, "%s: not a binary log file\n", argv[1]);
+		return 1;
+	}
+	if (0x01020304U != order) {
+		std::fprintf(stderr, "%s: byte order mismatch\n", argv[1]);
+		return 1;
+	}
+	if (binary_log::VERSION != version) {
+		std::fprintf(stderr, "%s: unsupported version %u\n", argv[1], version);
+		return 1;
+	}
+
+	std::map<uint32_t, format_definition> formats;
+	std::vector<char> args;
+	std::string text;
+	for (;;) {
+		uint8_t type = 0;
+		if (!read_value(fp, type)) {
+			break;
+		}
+		if (binary_log::RECORD_FORMAT == type) {
+			uint32_t id = 0;
+			uint8_t level = 0;
+			format_definition def;
+			if (!read_value(fp, id) || !read_value(fp, level) || !read_value(fp, def.line_)
+					|| !read_string(fp, def.file_) || !read_string(fp, def.fmt_)) {
+				std::fprintf(stderr, "%s: truncated format definition\n", argv[1]);
+				return 1;
+			}
+			def.level_ = level;
+			formats[id] = def;
+			continue;
+		}
+		if (binary_log::RECORD_LOG != type) {
+			std::fprintf(stderr, "%s: unknown record type %u\n", argv[1], type);
+			return 1;
+		}
+
+		uint32_t id = 0;
+		uint32_t thread = 0;
+		uint64_t time = 0;
+		uint32_t size = 0;
+		if (!read_value(fp, id) || !read_value(fp, thread) || !read_value(fp, time) || !read_value(fp, size)) {
+			std::fprintf(stderr, "%s: truncated record\n", argv[1]);
+			return 1;
+		}
+		args.resize(size + 1);
+		if ((0 < size) && (size != std::fread(&args[0], 1, size, fp))) {
+			std::fprintf(stderr, "%s: truncated record\n", argv[1]);
+			return 1;
+		}
+		args[size] = '\0';
+
+		std::map<uint32_t, format_definition>::const_iterator it = formats.find(id);
+		if (formats.end() == it) {
+			std::fprintf(stderr, "%s: undefined format %u\n", argv[1], id);
+			return 1;
+		}
+		format_definition const &def = it->second;
+		text.clear();
+		HUMANITY_NS::format_log_record(text, def.fmt_.c_str(), &args[0], size);
+
+		time_t const sec = static_cast<time_t>(time / 1000000000ULL);
+		struct tm tm;
+		::gmtime_r(&sec, &tm);
+		char stamp[32];
+		std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+		std::printf("%s.%09llu [%u] %s (%s:%u) %s\n", stamp, static_cast<unsigned long long>(time % 1000000000ULL),
+				thread, level_name(def.level_), def.file_.c_str(), def.line_, text.c_str());
+	}
+	std::fclose(fp);
+	return 0;
+}